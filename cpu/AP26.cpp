@@ -6,6 +6,8 @@
 
 #include <cinttypes>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <pthread.h>
 #include <thread>
 
@@ -22,7 +24,7 @@
 
 #define STATE_FILENAME_A "AP26-state.a.txt"
 #define STATE_FILENAME_B "AP26-state.b.txt"
-#define RESULTS_FILENAME "SOL-AP26.txt"
+#define STATS_FILENAME "AP26-stats.txt"
 
 #define MINIMUM_AP_LENGTH_TO_REPORT 20
 
@@ -31,28 +33,48 @@ using namespace std;
 /* Global variables */
 static int KMIN, KMAX, K_DONE, K_COUNT;
 static FILE *results_file = NULL;
-uint64_t *n43_h;
 bool write_state_a_next;
 uint64_t last_trickle;
 time_t last_ckpt;
 
 
-/////////////////////////////
-// main lock for search data
-int current_n43;
-pthread_mutex_t lock1;
-/////////////////////////////
-
 ///////////////////////////////////
-// lock used for writing results to file
+// lock used for the I/O thread queue
+// solution records and checkpoint snapshots are queued by main
+// and written to disk by io_thread
+#define IO_SOLUTION	0
+#define IO_CHECKPOINT	1
+
+typedef struct _io_msg_t {
+	int type;
+	int AP_Length, difference;
+	uint64_t First_Term;
+	int SHIFT, K;
+	uint32_t cksum, totalaps;
+	struct _io_msg_t *next;
+} io_msg_t;
+
+io_msg_t *io_head = NULL;
+io_msg_t *io_tail = NULL;
+bool io_quit = false;
+pthread_t io_thr;
+pthread_cond_t io_cond;		// a message was queued
 pthread_mutex_t lock2;
 ///////////////////////////////////
 
 ///////////////////////////////////
-// lock used for checksum and ap count
+// checksum and ap count, only updated by main between K
 uint32_t totalaps;
 uint32_t cksum;
-pthread_mutex_t lock3;
+///////////////////////////////////
+
+///////////////////////////////////
+// sum of the per thread search counters for the last K, see stats.h
+stats_t k_stats;
+
+// validated APs to report from the last K merged, in output order
+sol_t *k_sol = NULL;
+int k_nsol = 0, k_size = 0;
 ///////////////////////////////////
 
 
@@ -88,179 +110,7 @@ void handle_trickle_up(){
 }
 
 
-/*
-	tests primality of each term of the AP sequence
-	test is good to 2^64-1
-*/
-
-
-uint64_t invert(uint64_t p)
-{
-	uint64_t p_inv = 1, prev = 0;
-	while (p_inv != prev) { prev = p_inv; p_inv *= 2 - p * p_inv; }
-	return p_inv;
-}
-
-
-uint64_t montMul(uint64_t a, uint64_t b, uint64_t p, uint64_t q)
-{
-	unsigned __int128 res;
-
-	res  = (unsigned __int128)a * b;
-	uint64_t ab0 = (uint64_t)res;
-	uint64_t ab1 = res >> 64;
-
-	uint64_t m = ab0 * q;
-
-	res = (unsigned __int128)m * p;
-	uint64_t mp = res >> 64;
-
-	uint64_t r = ab1 - mp;
-
-	return ( ab1 < mp ) ? r + p : r;
-}
-
-
-uint64_t add(uint64_t a, uint64_t b, uint64_t p)
-{
-	uint64_t r;
-
-	uint64_t c = (a >= p - b) ? p : 0;
-
-	r = a + b - c;
-
-	return r;
-}
-
-
-// initialize montgomery constants
-void mont_init(uint64_t N, int & t, uint64_t & curBit, uint64_t & exp, uint64_t & nmo, uint64_t & q, uint64_t & one, uint64_t & r2){
-
-	nmo = N-1;
-	t = __builtin_ctzll(nmo);
-	exp = N >> t;
-	curBit = 0x8000000000000000;
-	curBit >>= ( __builtin_clzll(exp) + 1 );
-	q = invert(N);
-	one = (-N) % N;
-	nmo = N - one;
-	uint64_t two = add(one, one, N);
-	r2 = add(two, two, N);
-	for (int i = 0; i < 5; ++i)
-		r2 = montMul(r2, r2, N, q);	// 4^{2^5} = 2^64
-
-}
-
-
-bool strong_prp(int base, uint64_t N, int t, uint64_t curBit, uint64_t exp, uint64_t nmo, uint64_t q, uint64_t one, uint64_t r2)
-{
-
-	/* If N is prime and N = d*2^t+1, where d is odd, then either
-		1.  a^d = 1 (mod N), or
-		2.  a^(d*2^s) = -1 (mod N) for some s in 0 <= s < t    */
-
-
-	uint64_t a = base;
-	uint64_t mbase = montMul(a,r2,N,q);  // convert base to montgomery form
-
-	a = mbase;
-
-  	/* r <-- a^d mod N, assuming d odd */
-	while( curBit )
-	{
-		a = montMul(a,a,N,q);
-
-		if(exp & curBit){
-			a = montMul(a,mbase,N,q);
-		}
-
-		curBit >>= 1;
-	}
-
-	/* Clause 1. and s = 0 case for clause 2. */
-	if (a == one || a == nmo){
-		return true;
-	}
-
-	/* 0 < s < t cases for clause 2. */
-	for (int s = 1; s < t; ++s){
-
-		a = montMul(a,a,N,q);
-
-		if(a == nmo){
-	    	return true;
-		}
-	}
-
-
-	return false;
-}
-
-
-// strong probable prime to base 2
-bool PrimeQ(uint64_t N)
-{
-	uint64_t nmo = N-1;
-	int t = __builtin_ctzll(nmo);
-	uint64_t exp = N >> t;
-	uint64_t curBit = 0x8000000000000000;
-	curBit >>= ( __builtin_clzll(exp) + 1 );
-	uint64_t q = invert(N);
-	uint64_t one = (-N) % N;
-	nmo = N - one;
-	uint64_t two = add(one, one, N);
-	
-	uint64_t a = two;
-
-	/* If N is prime and N = d*2^t+1, where d is odd, then either
-		1.  a^d = 1 (mod N), or
-		2.  a^(d*2^s) = -1 (mod N) for some s in 0 <= s < t    */
-
-  	/* r <-- a^d mod N, assuming d odd */
-	while( curBit )
-	{
-		a = montMul(a,a,N,q);
-
-		if(exp & curBit){
-			a = add(a,a,N);
-		}
-
-		curBit >>= 1;
-	}
-
-	/* Clause 1. and s = 0 case for clause 2. */
-	if (a == one || a == nmo){
-		return true;
-	}
-
-	/* 0 < s < t cases for clause 2. */
-	for (int s = 1; s < t; ++s){
-
-		a = montMul(a,a,N,q);
-
-		if(a == nmo){
-	    	return true;
-		}
-	}
-
-	return false;
-}
-
-
-void ckerr(int err){
-	if(err){
-		fprintf(stderr, "ERROR: pthreads, code: %d\n", err);
-		exit(EXIT_FAILURE);
-	}
-}
-
-int boinc_standalone()
-{
-	return boinc_is_standalone();
-}
-
-
-static FILE *my_fopen(const char *filename, const char *mode)
+FILE *my_fopen(const char *filename, const char *mode)
 {
 	char resolved_name[512];
 
@@ -309,35 +159,41 @@ void write_cksum()
 
 
 
-void write_state(int KMIN, int KMAX, int SHIFT, int K)
+/* Write the state to a temporary file and rename it over the
+   current state file, so a crash never leaves a partial checkpoint.
+*/
+void write_state(int KMIN, int KMAX, int SHIFT, int K, uint32_t state_cksum, uint32_t state_totalaps)
 {
 	FILE *out;
+	char state_name[512];
+	char temp_name[520];
 
 	if (write_state_a_next)
-	{
-		if ((out = my_fopen(STATE_FILENAME_A,"w")) == NULL)
-			fprintf(stderr,"Cannot open %s !!!\n",STATE_FILENAME_A);
-	}
+		boinc_resolve_filename(STATE_FILENAME_A,state_name,sizeof(state_name));
 	else
-	{
-		if ((out = my_fopen(STATE_FILENAME_B,"w")) == NULL)
-			fprintf(stderr,"Cannot open %s !!!\n",STATE_FILENAME_B);
+		boinc_resolve_filename(STATE_FILENAME_B,state_name,sizeof(state_name));
+
+	sprintf(temp_name,"%s.tmp",state_name);
+
+	if ((out = boinc_fopen(temp_name,"w")) == NULL){
+		fprintf(stderr,"Cannot open %s !!! Continuing...\n",temp_name);
+		return;
 	}
 
-	if (fprintf(out,"%d %d %d %d %u %u %" PRIu64 "\n",KMIN,KMAX,SHIFT,K,cksum,totalaps,last_trickle) < 0){
-		if (write_state_a_next)
-			fprintf(stderr,"Cannot write to %s !!! Continuing...\n",STATE_FILENAME_A);
-		else
-			fprintf(stderr,"Cannot write to %s !!! Continuing...\n",STATE_FILENAME_B);
+	if (fprintf(out,"%d %d %d %d %u %u %" PRIu64 "\n",KMIN,KMAX,SHIFT,K,state_cksum,state_totalaps,last_trickle) < 0){
+		fprintf(stderr,"Cannot write to %s !!! Continuing...\n",temp_name);
 
 		// Attempt to close, even though we failed to write
 		fclose(out);
 	}
-	else
+	else if (fclose(out) == 0)
 	{
-		// If state file is closed OK, write to the other state file
+		// If state file is replaced OK, write to the other state file
 		// next time round
-		if (fclose(out) == 0) write_state_a_next = !write_state_a_next; 
+		if (boinc_rename(temp_name,state_name) == 0)
+			write_state_a_next = !write_state_a_next;
+		else
+			fprintf(stderr,"Cannot rename %s !!! Continuing...\n",temp_name);
 	}
 }
 
@@ -432,6 +288,139 @@ int read_state(int KMIN, int KMAX, int SHIFT, int *K)
 }
 
 
+// append a solution record to the results file, called by io_thread only
+void write_solution(int AP_Length, int difference, uint64_t First_Term)
+{
+	if (results_file == NULL)
+		results_file = my_fopen(RESULTS_FILENAME,"a");
+
+	if(boinc_is_standalone()){
+		printf("Solution: %d %d %" PRId64 "\n",AP_Length,difference,First_Term);
+	}
+
+	if (results_file == NULL){
+		fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+		exit(EXIT_FAILURE);
+	}
+
+	if (fprintf(results_file,"%d %d %" PRId64 "\n",AP_Length,difference,First_Term)<0){
+		fprintf(stderr,"Cannot write to %s !!!\n",RESULTS_FILENAME);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+// flush queued solutions to disk, then write the state file, called by io_thread only
+void write_checkpoint(int SHIFT, int K, uint32_t state_cksum, uint32_t state_totalaps)
+{
+	if (results_file != NULL){
+		fclose(results_file);
+		results_file = NULL;
+	}
+
+	write_state(KMIN,KMAX,SHIFT,K,state_cksum,state_totalaps);
+
+	if(boinc_is_standalone()){
+		printf("Checkpoint: KMIN:%d KMAX:%d SHIFT:%d K:%d\n",KMIN,KMAX,SHIFT,K);
+	}
+
+	boinc_checkpoint_completed();
+
+	handle_trickle_up();
+}
+
+
+/* I/O thread
+   Messages are written in the order they were queued, so every solution
+   found before a checkpoint is on disk before that checkpoint's state file.
+*/
+void *io_thread(void *)
+{
+	ckerr(pthread_mutex_lock(&lock2));
+
+	while(true){
+
+		while(io_head == NULL && !io_quit){
+			ckerr(pthread_cond_wait(&io_cond, &lock2));
+		}
+
+		// quit only after the queue is drained
+		if(io_head == NULL){
+			break;
+		}
+
+		io_msg_t *msg = io_head;
+		io_head = msg->next;
+		if(io_head == NULL){
+			io_tail = NULL;
+		}
+
+		ckerr(pthread_mutex_unlock(&lock2));
+
+		if(msg->type == IO_SOLUTION){
+			write_solution(msg->AP_Length, msg->difference, msg->First_Term);
+		}
+		else{
+			write_checkpoint(msg->SHIFT, msg->K, msg->cksum, msg->totalaps);
+		}
+
+		free(msg);
+
+		ckerr(pthread_mutex_lock(&lock2));
+	}
+
+	ckerr(pthread_mutex_unlock(&lock2));
+
+	return NULL;
+}
+
+
+// queue a message for io_thread, never blocks on the filesystem
+void io_push(io_msg_t *msg)
+{
+	if (msg == NULL){
+		fprintf(stderr,"Error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	msg->next = NULL;
+
+	ckerr(pthread_mutex_lock(&lock2));
+
+	if(io_tail == NULL){
+		io_head = msg;
+	}
+	else{
+		io_tail->next = msg;
+	}
+	io_tail = msg;
+
+	ckerr(pthread_cond_signal(&io_cond));
+	ckerr(pthread_mutex_unlock(&lock2));
+}
+
+
+void io_start()
+{
+	ckerr(pthread_cond_init(&io_cond, NULL));
+	ckerr(pthread_create(&io_thr, NULL, io_thread, NULL));
+}
+
+
+// drain the queue and stop io_thread
+void io_stop()
+{
+	ckerr(pthread_mutex_lock(&lock2));
+	io_quit = true;
+	ckerr(pthread_cond_signal(&io_cond));
+	ckerr(pthread_mutex_unlock(&lock2));
+
+	ckerr(pthread_join(io_thr, NULL));
+
+	ckerr(pthread_cond_destroy(&io_cond));
+}
+
+
 /* 
    Returns index j where:
    0<=j<k ==> f+j*d*23# is composite.
@@ -509,14 +498,28 @@ int validate_ap26(int k, int d, uint64_t f)
 }
 
 
+// queue a validated AP for the results file
+void QueueSolution(int AP_Length, int difference, uint64_t First_Term)
+{
+	io_msg_t *msg = (io_msg_t*)malloc(sizeof(io_msg_t));
+	msg->type = IO_SOLUTION;
+	msg->AP_Length = AP_Length;
+	msg->difference = difference;
+	msg->First_Term = First_Term;
+
+	io_push(msg);
+}
+
+
 // Bryan Little 9-28-2015
 // Bryan Little - added to CPU code 6-9-2016
 // Changed function to check ALL solutions for validity, not just solutions >= MINIMUM_AP_LENGTH_TO_REPORT
 // CPU does a prp base 2 check only. It will sometimes report an AP with a base 2 probable prime.
-void ReportSolution(int AP_Length, int difference, uint64_t First_Term, uint32_t & checksum)
+// valid is the result of validate_ap26 for this AP, computed by merge_solutions.
+void ReportSolution(int AP_Length, int difference, uint64_t First_Term, int valid, uint32_t & checksum)
 {
 
-	int i;
+	int i = valid;
 
 	/*	add each AP10+ first_term mod 1000 and that AP's length to checksum	*/
 	checksum += First_Term % 1000;
@@ -525,8 +528,6 @@ void ReportSolution(int AP_Length, int difference, uint64_t First_Term, uint32_t
 		checksum -= MAXINTV;
 	}
 
-	i = validate_ap26(AP_Length,difference,First_Term);
-
 	if (i < AP_Length){
 
 		if(boinc_is_standalone()){
@@ -542,45 +543,125 @@ void ReportSolution(int AP_Length, int difference, uint64_t First_Term, uint32_t
 
 		// Even though this AP is not valid, it may contain an AP that is.
 		/* Check leading terms */
-		ReportSolution(i,difference,First_Term,checksum);
+		ReportSolution(i,difference,First_Term,validate_ap26(i,difference,First_Term),checksum);
 
 		/* Check trailing terms */
-		ReportSolution(AP_Length-(i+1),difference,First_Term+(int64_t)(i+1)*difference*2*3*5*7*11*13*17*19*23,checksum);
+		int trail_len = AP_Length-(i+1);
+		uint64_t trail = First_Term+(int64_t)(i+1)*difference*2*3*5*7*11*13*17*19*23;
+		ReportSolution(trail_len,difference,trail,validate_ap26(trail_len,difference,trail),checksum);
 		return;
 	}
 	else if (AP_Length >= MINIMUM_AP_LENGTH_TO_REPORT){
-		
-		ckerr(pthread_mutex_lock(&lock2));
 
-		if (results_file == NULL)
-			results_file = my_fopen(RESULTS_FILENAME,"a");
+		AppendSolution(&k_sol, &k_nsol, &k_size, AP_Length, First_Term);
+	}
+	
+}
 
-		if(boinc_is_standalone()){
-			printf("Solution: %d %d %" PRId64 "\n",AP_Length,difference,First_Term);
-		}
 
-		if (results_file == NULL){
-			fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+typedef struct _val_data_t {
+	sol_t *sol;
+	int *valid;
+	int id, count, K, num_threads;
+} val_data_t;
+
+
+void *thr_func_validate(void *arg)
+{
+	val_data_t *data = (val_data_t *)arg;
+
+	for(int i = data->id; i < data->count; i += data->num_threads){
+		data->valid[i] = validate_ap26(data->sol[i].AP_Length, data->K, data->sol[i].First_Term);
+	}
+
+	pthread_exit(NULL);
+
+	return NULL;
+}
+
+
+static int sol_compare(const void *a, const void *b)
+{
+	const sol_t *x = (const sol_t *)a;
+	const sol_t *y = (const sol_t *)b;
+
+	if(x->First_Term != y->First_Term)
+		return (x->First_Term < y->First_Term) ? -1 : 1;
+
+	return x->AP_Length - y->AP_Length;
+}
+
+
+/* Merge the per thread solution buffers after K has been searched.
+   APs are sorted by first term so the results file is the same for any
+   thread count, then validated in parallel and reported in that order.
+   APs to report are left in k_sol.
+*/
+void merge_solutions(int K, int num_threads)
+{
+	int i, err;
+
+	k_nsol = 0;
+
+	int count = TakeSolutions(NULL, num_threads);
+
+	if(count == 0) return;
+
+	sol_t *sol = (sol_t*)malloc(count * sizeof(sol_t));
+	int *valid = (int*)malloc(count * sizeof(int));
+	if(sol == NULL || valid == NULL){
+		fprintf(stderr,"Error: solution merge allocation failed\n");
+		printf("Error: solution merge allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	TakeSolutions(sol, num_threads);
+
+	qsort(sol, count, sizeof(sol_t), sol_compare);
+
+	int vthreads = (count < num_threads) ? count : num_threads;
+	pthread_t threads[vthreads];
+	val_data_t thr_data[vthreads];
+
+	for(i = 0; i < vthreads; ++i){
+		thr_data[i].sol = sol;
+		thr_data[i].valid = valid;
+		thr_data[i].id = i;
+		thr_data[i].count = count;
+		thr_data[i].K = K;
+		thr_data[i].num_threads = vthreads;
+		err = pthread_create(&threads[i], NULL, thr_func_validate, &thr_data[i]);
+		if (err){
+			fprintf(stderr, "ERROR: pthread_create, code: %d\n", err);
 			exit(EXIT_FAILURE);
 		}
+	}
 
-		if (fprintf(results_file,"%d %d %" PRId64 "\n",AP_Length,difference,First_Term)<0){
-			fprintf(stderr,"Cannot write to %s !!!\n",RESULTS_FILENAME);
+	for(i = 0; i < vthreads; ++i){
+		err = pthread_join(threads[i], NULL);
+		if (err){
+			fprintf(stderr, "ERROR: pthread_join, code: %d\n", err);
 			exit(EXIT_FAILURE);
 		}
-		
-		ckerr(pthread_mutex_unlock(&lock2));
+	}
 
+	for(i = 0; i < count; ++i){
+		ReportSolution(sol[i].AP_Length, K, sol[i].First_Term, valid[i], cksum);
 	}
-	
+
+	totalaps += count;
+
+	free(sol);
+	free(valid);
 }
 
+
 /* Checkpoint 
    If force is nonzero then don't ask BOINC for permission.
+   The state is snapshotted here and written by io_thread.
 */
 void checkpoint(int SHIFT, int K, int force)
 {
-	double d;
 	time_t curr_time;
 
 	time(&curr_time);
@@ -590,38 +671,102 @@ void checkpoint(int SHIFT, int K, int force)
 
 		last_ckpt = curr_time;
 
-		if (results_file != NULL){
-			fclose(results_file);
-			results_file = NULL;
-		}
+		io_msg_t *msg = (io_msg_t*)malloc(sizeof(io_msg_t));
+		msg->type = IO_CHECKPOINT;
+		msg->SHIFT = SHIFT;
+		msg->K = K;
+		msg->cksum = cksum;
+		msg->totalaps = totalaps;
 
-		write_state(KMIN,KMAX,SHIFT,K);
+		io_push(msg);
+	}
 
-		if(boinc_is_standalone()){
-			printf("Checkpoint: KMIN:%d KMAX:%d SHIFT:%d K:%d\n",KMIN,KMAX,SHIFT,K);
+}
+
+/* Returns 1 iff K will be searched.
+ */
+int will_search(int K)
+{
+  	return (K%PRIME1 && K%PRIME2 && K%PRIME3 && K%PRIME4 &&
+          	K%PRIME5 && K%PRIME6 && K%PRIME7 && K%PRIME8);
+}
+
+
+#ifdef AP26_STATS
+/* Sum the per thread counters of the last K into k_stats and clear them
+   for the next K.
+*/
+void sum_stats(int num_threads)
+{
+	int i, j;
+
+	memset(&k_stats, 0, sizeof(stats_t));
+
+	for(i = 0; i < num_threads; ++i){
+		k_stats.passes += stats[i].passes;
+		k_stats.sito137 += stats[i].sito137;
+		k_stats.sito199 += stats[i].sito199;
+		k_stats.sito277 += stats[i].sito277;
+		k_stats.survivors += stats[i].survivors;
+		k_stats.div23 += stats[i].div23;
+		k_stats.cascade += stats[i].cascade;
+		k_stats.prp += stats[i].prp;
+		for(j = 0; j < STATS_APLEN; ++j){
+			k_stats.aplen[j] += stats[i].aplen[j];
 		}
+	}
+
+	memset(stats, 0, num_threads * sizeof(stats_t));
+}
+
 
-		boinc_checkpoint_completed();
+/* Sum the counters of K and append them to the stats file, one line per K.
+   Called after Search returns so the file write isn't part of the search.
+*/
+void collect_stats(int K, int SHIFT, int num_threads)
+{
+	int j;
 
-		handle_trickle_up();
+	sum_stats(num_threads);
+
+	FILE *out = my_fopen(STATS_FILENAME,"a");
+	if (out == NULL){
+		fprintf(stderr,"Cannot open %s !!!\n",STATS_FILENAME);
+		exit(EXIT_FAILURE);
+	}
 
+	fprintf(out, "K=%d SHIFT=%d passes=%" PRIu64 " after137=%" PRIu64 " after199=%" PRIu64 " after277=%" PRIu64
+		" check_n=%" PRIu64 " div23=%" PRIu64 " cascade=%" PRIu64 " prp=%" PRIu64 " aplen=",
+		K, SHIFT, k_stats.passes, k_stats.sito137, k_stats.sito199, k_stats.sito277,
+		k_stats.survivors, k_stats.div23, k_stats.cascade, k_stats.prp);
+	for(j = 0; j < STATS_APLEN; ++j){
+		fprintf(out, "%s%" PRIu64, j ? "," : "", k_stats.aplen[j]);
 	}
+	fprintf(out, "\n");
 
+	fclose(out);
 }
+#endif
 
-/* Returns 1 iff K will be searched.
+
+/* Search one K with the selected instruction set and merge its solutions.
  */
-static int will_search(int K)
+void Search(int K, int SHIFT, int K_COUNT, int K_DONE, int num_threads)
 {
-  	return (K%PRIME1 && K%PRIME2 && K%PRIME3 && K%PRIME4 &&
-          	K%PRIME5 && K%PRIME6 && K%PRIME7 && K%PRIME8);
+	SearchCPU(K, SHIFT, K_COUNT, K_DONE, num_threads);
+
+	merge_solutions(K, num_threads);
 }
 
 
 int main(int argc, char *argv[])
 {
-	int i, K, SHIFT, err;
+	int i, K, SHIFT;
 	int num_threads = 1;
+	int lease_secs = 3600;
+	char *coord_addr = NULL;
+	char *worker_addr = NULL;
+	char *ledger_path = NULL;
 
 	// Initialize BOINC
 	BOINC_OPTIONS options;
@@ -629,11 +774,11 @@ int main(int argc, char *argv[])
 	options.multi_thread = true; 
 	boinc_init_options(&options);
 		
-	n43_h = (uint64_t*)malloc(numn43s * sizeof(uint64_t));		
-	
-	ckerr(pthread_mutex_init(&lock1, NULL));
 	ckerr(pthread_mutex_init(&lock2, NULL));
-	ckerr(pthread_mutex_init(&lock3, NULL));
+
+#ifdef AP26_BENCH
+	return Bench(argc, argv);
+#endif
 
 	
 	fprintf(stderr, "AP26 CPU 10-shift search version %s by Bryan Little\n",VERS);
@@ -656,6 +801,10 @@ int main(int argc, char *argv[])
 		printf("Usage: %s KMIN KMAX SHIFT -cputype -t #\n",argv[0]);
 		printf("-cputype is used to force an instruction set. Valid types: -sse2 -sse41 -avx -avx2 -avx512. Default is highest available.\n");
 		printf("-t # or --nthreads # is optional number of threads to use. Default is 1. Max is 64.\n");
+		printf("-coordinator addr hands out K from KMIN to KMAX to workers. addr is host:port or unix:/path.\n");
+		printf("-worker addr searches K leased from a coordinator. KMIN KMAX SHIFT are ignored.\n");
+		printf("-lease # is the coordinator lease time in seconds before a K is handed out again. Default is 3600.\n");
+		printf("-ledger file shares KMIN to KMAX with other processes on this host using the same ledger file.\n");
 
 		exit(EXIT_FAILURE);
 	}
@@ -664,41 +813,7 @@ int main(int argc, char *argv[])
 	sscanf(argv[2],"%d",&KMAX);
 	sscanf(argv[3],"%d",&SHIFT);
 
-	int sse41 = __builtin_cpu_supports("sse4.1");
-	int avx = __builtin_cpu_supports("avx");
-	int avx2 = __builtin_cpu_supports("avx2");
-	int avx512 = __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
-
-	if(avx512){
-		if(boinc_is_standalone()){
-			printf("Detected avx512 CPU\n");
-		}
-		fprintf(stderr, "Detected avx512 CPU\n");
-	}
-	else if(avx2){
-		if(boinc_is_standalone()){
-			printf("Detected avx2 CPU\n");
-		}
-		fprintf(stderr, "Detected avx2 CPU\n");
-	}
-	else if(avx){
-		if(boinc_is_standalone()){
-			printf("Detected avx CPU\n");
-		}
-		fprintf(stderr, "Detected avx CPU\n");
-	}
-	else if(sse41){
-		if(boinc_is_standalone()){
-			printf("Detected sse4.1 CPU\n");
-		}
-		fprintf(stderr, "Detected sse4.1 CPU\n");		
-	}
-	else{
-		if(boinc_is_standalone()){
-			printf("Assumed sse2 CPU\n");
-		}
-		fprintf(stderr, "Assumed sse2 CPU\n");
-	}
+	detect_isa();
 
 	if(argc > 4){
 		for(int xv=4;xv<argc;xv++){
@@ -827,7 +942,84 @@ int main(int argc, char *argv[])
 				avx2 = 0;
 				avx512 = 1;
 			}
+			else if( strcmp(argv[xv], "-coordinator") == 0 && xv+1 < argc ){
+				coord_addr = argv[xv+1];
+			}
+			else if( strcmp(argv[xv], "-worker") == 0 && xv+1 < argc ){
+				worker_addr = argv[xv+1];
+			}
+			else if( strcmp(argv[xv], "-ledger") == 0 && xv+1 < argc ){
+				ledger_path = argv[xv+1];
+			}
+			else if( strcmp(argv[xv], "-lease") == 0 && xv+1 < argc ){
+				sscanf(argv[xv+1],"%d",&lease_secs);
+				if(lease_secs < 1){
+					if(boinc_is_standalone()){
+						printf("ERROR: lease time must be at least 1 second.\n");
+					}
+					fprintf(stderr, "ERROR: lease time must be at least 1 second.\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+	}
+
+
+	// per thread solution buffers
+	alloc_thread_bufs(num_threads);
+
+
+	/* Worker mode, K and SHIFT come from the coordinator */
+	if(worker_addr != NULL){
+		int worker_fd = WorkerConnect(worker_addr);
+
+		while(WorkerGetLease(worker_fd, &K, &SHIFT)){
+			cksum = 0;
+			totalaps = 0;
+			Search(K, SHIFT, 1, 0, num_threads);
+#ifdef AP26_STATS
+			collect_stats(K, SHIFT, num_threads);
+#endif
+			WorkerSendResult(worker_fd, K, cksum, totalaps, k_sol, k_nsol);
+		}
+
+		fprintf(stderr,"Worker finished, no more K to search\n");
+		if(boinc_is_standalone()){
+			printf("Worker finished, no more K to search\n");
+		}
+		boinc_finish(EXIT_SUCCESS);
+		return EXIT_SUCCESS;
+	}
+
+
+	/* Ledger mode, K are claimed from a ledger shared with other processes */
+	if(ledger_path != NULL){
+		LedgerOpen(ledger_path, KMIN, KMAX, SHIFT);
+
+		while(LedgerClaim(&K)){
+			cksum = 0;
+			totalaps = 0;
+			Search(K, SHIFT, 1, 0, num_threads);
+#ifdef AP26_STATS
+			collect_stats(K, SHIFT, num_threads);
+#endif
+			LedgerComplete(K, cksum, totalaps, k_sol, k_nsol);
+		}
+
+		if(LedgerFinish()){
+			fprintf(stderr,"Workunit complete.  Number of AP10+ found %u\n", totalaps);
+			if(boinc_is_standalone()){
+				printf("Workunit complete.\n");
+			}
 		}
+		else{
+			fprintf(stderr,"No more K to claim from the ledger\n");
+			if(boinc_is_standalone()){
+				printf("No more K to claim from the ledger\n");
+			}
+		}
+		boinc_finish(EXIT_SUCCESS);
+		return EXIT_SUCCESS;
 	}
 
 
@@ -880,26 +1072,30 @@ int main(int argc, char *argv[])
 	}
 
 
+	// start the I/O thread
+	io_start();
+
+
+	/* Coordinator mode, workers search the K and results are committed in order */
+	if(coord_addr != NULL){
+		Coordinator(coord_addr, K, KMAX, SHIFT, K_COUNT, K_DONE, lease_secs);
+		K = KMAX+1;
+	}
+
+
 	/* Top-level loop */
 	for (; K <= KMAX; ++K){
 		if (will_search(K)){
 
 			checkpoint(SHIFT,K,0);
 
-			if(avx512){
-				Search_avx512(K, SHIFT, K_COUNT, K_DONE, num_threads);
-			}
-			else if(avx2){
-				Search_avx2(K, SHIFT, K_COUNT, K_DONE, num_threads);
-			}
-			else if(avx){
-				Search_avx(K, SHIFT, K_COUNT, K_DONE, num_threads);
-			}
-			else if(sse41){
-				Search_sse41(K, SHIFT, K_COUNT, K_DONE, num_threads);
-			}
-			else{
-				Search_sse2(K, SHIFT, K_COUNT, K_DONE, num_threads);
+			Search(K, SHIFT, K_COUNT, K_DONE, num_threads);
+#ifdef AP26_STATS
+			collect_stats(K, SHIFT, num_threads);
+#endif
+
+			for(i = 0; i < k_nsol; ++i){
+				QueueSolution(k_sol[i].AP_Length, K, k_sol[i].First_Term);
 			}
 
 		 	K_DONE++;
@@ -910,15 +1106,15 @@ int main(int argc, char *argv[])
 	boinc_begin_critical_section();
 	boinc_fraction_done(1.0);
 	checkpoint(SHIFT,K,1);
+	io_stop();
 	write_cksum();
 	fprintf(stderr,"Workunit complete.  Number of AP10+ found %u\n", totalaps);
 	boinc_end_critical_section();
 
-	free(n43_h);
+	free_thread_bufs(num_threads);
+	free(k_sol);
 	
-	ckerr(pthread_mutex_destroy(&lock1));
 	ckerr(pthread_mutex_destroy(&lock2));
-	ckerr(pthread_mutex_destroy(&lock3));
 
 
 	boinc_finish(EXIT_SUCCESS);
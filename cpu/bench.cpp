@@ -0,0 +1,426 @@
+/* bench.cpp --
+
+	Standalone benchmark, built with make -f Makefile-Linux bench.
+	Searches the reference ranges of the test_*.txt files with each
+	instruction set and thread count, checks the results against the
+	reference files and writes the timings to AP26-bench.json.
+	Timings are only reported for runs that match their reference.
+	-micro runs the component micro-benchmarks in microbench.cpp instead.
+
+*/
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <thread>
+
+#include "mainconst.h"
+#include "microbench.h"
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+#define MAXINTV 2000000000
+
+#define BENCH_FILENAME "AP26-bench.json"
+#define MICRO_FILENAME "AP26-micro.json"
+#define MAX_BENCH_THREADS 64
+#define MAX_REF_LINES 64
+
+// n59 values per K, 10840 n43 * 19 * 23 * 29 * 35, each covers all 10 shifts
+#define N59_PER_K (UINT64_C(10840)*19*23*29*35)
+
+
+typedef struct _sample_t {
+	int KMIN, KMAX, SHIFT;
+} sample_t;
+
+// the ranges of the reference files
+static const sample_t samples[] = {
+	{ 366382, 366387, 0 },
+	{ 44121552, 44121558, 0 },
+	{ 47715106, 47715111, 0 },
+	{ 81292136, 81292143, 640 }
+};
+#define NUM_SAMPLES (int)(sizeof(samples)/sizeof(samples[0]))
+
+#define NUM_ISA 5
+static const char *isa_names[NUM_ISA] = { "sse2", "sse41", "avx", "avx2", "avx512" };
+
+
+static int isa_supported(int isa)
+{
+	switch(isa){
+		case 0: return 1;
+		case 1: return __builtin_cpu_supports("sse4.1");
+		case 2: return __builtin_cpu_supports("avx");
+		case 3: return __builtin_cpu_supports("avx2");
+		case 4: return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+	}
+	return 0;
+}
+
+
+// set the flags Search dispatches on
+static void set_isa(int isa)
+{
+	sse41 = (isa == 1);
+	avx = (isa == 2);
+	avx2 = (isa == 3);
+	avx512 = (isa == 4);
+}
+
+
+static double now_sec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static int line_compare(const void *a, const void *b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+
+/* Read a reference file, solution lines and the checksum line.
+   Returns the number of solution lines, -1 if the file can't be read.
+*/
+static int read_reference(const char *filename, char lines[][64], uint64_t *checksum)
+{
+	char buf[128];
+	int n = 0;
+
+	FILE *in = fopen(filename, "r");
+	if(in == NULL){
+		return -1;
+	}
+
+	*checksum = 0;
+
+	while(fgets(buf, sizeof(buf), in) != NULL){
+		buf[strcspn(buf, "\r\n")] = 0;
+		if(strchr(buf, ' ') != NULL){
+			if(n == MAX_REF_LINES) break;
+			size_t len = strlen(buf);
+			if(len > 63) len = 63;
+			memcpy(lines[n], buf, len);
+			lines[n][len] = 0;
+			++n;
+		}
+		else if(buf[0]){
+			sscanf(buf, "%" SCNx64, checksum);
+		}
+	}
+
+	fclose(in);
+
+	qsort(lines, n, 64, line_compare);
+
+	return n;
+}
+
+
+// the model name line of /proc/cpuinfo, without characters that need escaping in JSON
+static void cpu_model(char *model, int size)
+{
+	char buf[256];
+
+	snprintf(model, size, "unknown");
+
+	FILE *in = fopen("/proc/cpuinfo", "r");
+	if(in == NULL) return;
+
+	while(fgets(buf, sizeof(buf), in) != NULL){
+		if(strncmp(buf, "model name", 10) == 0){
+			char *p = strchr(buf, ':');
+			if(p == NULL) break;
+			p++;
+			while(*p == ' ' || *p == '\t') p++;
+			int j = 0;
+			for(; *p && *p != '\n' && j < size-1; p++){
+				if(*p != '"' && *p != '\\'){
+					model[j++] = *p;
+				}
+			}
+			model[j] = 0;
+			break;
+		}
+	}
+
+	fclose(in);
+}
+
+
+// comma separated list of numbers, returns the count
+static int parse_list(char *arg, int *list, int max)
+{
+	int n = 0;
+
+	for(char *tok = strtok(arg, ","); tok != NULL && n < max; tok = strtok(NULL, ",")){
+		list[n++] = atoi(tok);
+	}
+
+	return n;
+}
+
+
+int Bench(int argc, char *argv[])
+{
+	int i, s, t, isa;
+	int use_isa[NUM_ISA];
+	int threads[MAX_BENCH_THREADS];
+	int use_sample[NUM_SAMPLES];
+	int nthreads = 0;
+	int max_threads = 1;
+	int failed = 0;
+	int first = 1;
+	int micro = 0;
+	const char *out_name = NULL;
+	char model[128];
+
+	printf("AP26 CPU benchmark version %s\n",VERS);
+	printf("Compiled " __DATE__ " with GCC " __VERSION__ "\n");
+
+	uint32_t maxthreads = std::thread::hardware_concurrency();
+	if(maxthreads == 0){
+		maxthreads = 1;
+	}
+	if(maxthreads > MAX_BENCH_THREADS){
+		maxthreads = MAX_BENCH_THREADS;
+	}
+
+	for(isa = 0; isa < NUM_ISA; ++isa){
+		use_isa[isa] = isa_supported(isa);
+	}
+	for(s = 0; s < NUM_SAMPLES; ++s){
+		use_sample[s] = 1;
+	}
+
+	for(i = 1; i < argc; ++i){
+		if( strcmp(argv[i], "-isa") == 0 && i+1 < argc ){
+			for(isa = 0; isa < NUM_ISA; ++isa){
+				use_isa[isa] = 0;
+			}
+			for(char *tok = strtok(argv[++i], ","); tok != NULL; tok = strtok(NULL, ",")){
+				for(isa = 0; isa < NUM_ISA; ++isa){
+					if(strcmp(tok, isa_names[isa]) == 0) break;
+				}
+				if(isa == NUM_ISA){
+					printf("ERROR: unknown instruction set %s\n", tok);
+					fprintf(stderr, "ERROR: unknown instruction set %s\n", tok);
+					exit(EXIT_FAILURE);
+				}
+				if(!isa_supported(isa)){
+					printf("CPU does not support %s, skipped\n", tok);
+					continue;
+				}
+				use_isa[isa] = 1;
+			}
+		}
+		else if( strcmp(argv[i], "-t") == 0 && i+1 < argc ){
+			nthreads = parse_list(argv[++i], threads, MAX_BENCH_THREADS);
+			for(t = 0; t < nthreads; ++t){
+				if(threads[t] < 1 || threads[t] > (int)maxthreads){
+					printf("ERROR: thread counts must be from 1 to %u\n", maxthreads);
+					fprintf(stderr, "ERROR: thread counts must be from 1 to %u\n", maxthreads);
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+		else if( strcmp(argv[i], "-samples") == 0 && i+1 < argc ){
+			int list[NUM_SAMPLES];
+			int n = parse_list(argv[++i], list, NUM_SAMPLES);
+			for(s = 0; s < NUM_SAMPLES; ++s){
+				use_sample[s] = 0;
+			}
+			for(s = 0; s < n; ++s){
+				if(list[s] < 0 || list[s] >= NUM_SAMPLES){
+					printf("ERROR: samples are numbered 0 to %d\n", NUM_SAMPLES-1);
+					fprintf(stderr, "ERROR: samples are numbered 0 to %d\n", NUM_SAMPLES-1);
+					exit(EXIT_FAILURE);
+				}
+				use_sample[list[s]] = 1;
+			}
+		}
+		else if( strcmp(argv[i], "-o") == 0 && i+1 < argc ){
+			out_name = argv[++i];
+		}
+		else if( strcmp(argv[i], "-micro") == 0 ){
+			micro = 1;
+		}
+		else{
+			printf("Usage: %s [-isa list] [-t list] [-samples list] [-o file] [-micro]\n",argv[0]);
+			printf("-isa sse2,sse41,avx,avx2,avx512 selects the instruction sets. Default is all the CPU supports.\n");
+			printf("-t 1,2,4 selects the thread counts. Default is 1 and the number of logical processors.\n");
+			printf("-samples 0,1,2,3 selects the reference ranges:\n");
+			for(s = 0; s < NUM_SAMPLES; ++s){
+				printf("   %d: test_%d_%d_%d.txt\n", s, samples[s].KMIN, samples[s].KMAX, samples[s].SHIFT);
+			}
+			printf("-o file is the JSON output file. Default is %s, or %s with -micro.\n", BENCH_FILENAME, MICRO_FILENAME);
+			printf("-micro times the search primitives with synthetic inputs instead. -t and -samples are ignored.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(micro){
+		return Microbench(NUM_ISA, use_isa, isa_names, out_name ? out_name : MICRO_FILENAME);
+	}
+
+	if(out_name == NULL){
+		out_name = BENCH_FILENAME;
+	}
+
+	if(nthreads == 0){
+		threads[nthreads++] = 1;
+		if(maxthreads > 1){
+			threads[nthreads++] = maxthreads;
+		}
+	}
+
+	for(t = 0; t < nthreads; ++t){
+		if(threads[t] > max_threads){
+			max_threads = threads[t];
+		}
+	}
+
+	alloc_thread_bufs(max_threads);
+
+	cpu_model(model, sizeof(model));
+	printf("CPU: %s, %u logical processors\n", model, maxthreads);
+
+	FILE *out = fopen(out_name, "w");
+	if(out == NULL){
+		printf("ERROR: cannot open %s\n", out_name);
+		fprintf(stderr, "ERROR: cannot open %s\n", out_name);
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"version\": \"%s\",\n", VERS);
+	fprintf(out, "  \"cpu\": \"%s\",\n", model);
+	fprintf(out, "  \"logical_processors\": %u,\n", maxthreads);
+	fprintf(out, "  \"results\": [");
+
+	for(s = 0; s < NUM_SAMPLES; ++s){
+		if(!use_sample[s]) continue;
+
+		const sample_t *sp = &samples[s];
+		char filename[64];
+		char ref[MAX_REF_LINES][64];
+		uint64_t ref_checksum;
+
+		sprintf(filename, "test_%d_%d_%d.txt", sp->KMIN, sp->KMAX, sp->SHIFT);
+		int nref = read_reference(filename, ref, &ref_checksum);
+		if(nref < 0){
+			printf("ERROR: cannot read reference file %s\n", filename);
+			fprintf(stderr, "ERROR: cannot read reference file %s\n", filename);
+			exit(EXIT_FAILURE);
+		}
+
+		int nk = 0;
+		for(int K = sp->KMIN; K <= sp->KMAX; ++K){
+			if(will_search(K)) nk++;
+		}
+
+		uint64_t minmax = sp->KMIN + sp->KMAX;
+		while(minmax > MAXINTV){
+			minmax -= MAXINTV;
+		}
+
+		for(isa = 0; isa < NUM_ISA; ++isa){
+			if(!use_isa[isa]) continue;
+
+			for(t = 0; t < nthreads; ++t){
+				int nt = threads[t];
+				char lines[MAX_REF_LINES][64];
+				int nlines = 0;
+
+				printf("%s, %d threads, %s\n", isa_names[isa], nt, filename);
+
+				set_isa(isa);
+#ifdef AP26_STATS
+				uint64_t survivors = 0, prp = 0;
+#endif
+
+				cksum = 0;
+				totalaps = 0;
+
+				double start = now_sec();
+				int k_done = 0;
+
+				for(int K = sp->KMIN; K <= sp->KMAX; ++K){
+					if(!will_search(K)) continue;
+
+					Search(K, sp->SHIFT, nk, k_done, nt);
+					k_done++;
+
+#ifdef AP26_STATS
+					sum_stats(nt);
+					survivors += k_stats.survivors;
+					prp += k_stats.prp;
+#endif
+
+					for(i = 0; i < k_nsol && nlines < MAX_REF_LINES; ++i){
+						sprintf(lines[nlines++], "%d %d %" PRIu64, k_sol[i].AP_Length, K, k_sol[i].First_Term);
+					}
+				}
+
+				double secs = now_sec() - start;
+
+				qsort(lines, nlines, 64, line_compare);
+
+				uint64_t checksum = (minmax << 32) | cksum;
+				int correct = (checksum == ref_checksum && nlines == nref);
+				for(i = 0; correct && i < nlines; ++i){
+					if(strcmp(lines[i], ref[i]) != 0) correct = 0;
+				}
+
+				fprintf(out, "%s\n    {\"isa\": \"%s\", \"threads\": %d, \"kmin\": %d, \"kmax\": %d, \"shift\": %d, \"k\": %d, \"correct\": %s",
+					first ? "" : ",", isa_names[isa], nt, sp->KMIN, sp->KMAX, sp->SHIFT, nk, correct ? "true" : "false");
+				first = 0;
+
+				if(correct){
+					fprintf(out, ", \"seconds\": %.3f, \"sec_per_k\": %.3f, \"n59_per_sec\": %.0f",
+						secs, secs / nk, (double)(N59_PER_K * nk) / secs);
+#ifdef AP26_STATS
+					fprintf(out, ", \"survivors\": %" PRIu64 ", \"survivors_per_sec\": %.0f, \"prp\": %" PRIu64 ", \"prp_per_sec\": %.0f",
+						survivors, survivors / secs, prp, prp / secs);
+#endif
+					printf("%s, %d threads, %s: %.3f sec per K, %.4g n59/s", isa_names[isa], nt, filename, secs / nk, (double)(N59_PER_K * nk) / secs);
+#ifdef AP26_STATS
+					printf(", %.4g survivors/s, %.4g PRP/s", survivors / secs, prp / secs);
+#endif
+					printf("\n");
+				}
+				else{
+					failed++;
+					printf("ERROR: %s, %d threads, results do not match %s\n", isa_names[isa], nt, filename);
+					fprintf(stderr, "ERROR: %s, %d threads, results do not match %s\n", isa_names[isa], nt, filename);
+				}
+
+				fprintf(out, "}");
+				fflush(out);
+			}
+		}
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	fclose(out);
+
+	printf("Results written to %s\n", out_name);
+
+	if(failed){
+		printf("%d runs did not match their reference\n", failed);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+// boinc_api.h
+// minimal stand-in for the BOINC API, used by the bench target only.
+// the app always runs standalone, see boinc_stub.cpp
+
+#ifndef BOINC_STUB_API_H
+#define BOINC_STUB_API_H
+
+#include <cstdio>
+
+typedef struct BOINC_OPTIONS {
+	bool multi_thread;
+	bool normal_thread_priority;
+} BOINC_OPTIONS;
+
+typedef struct APP_INIT_DATA {
+	double starting_elapsed_time;
+} APP_INIT_DATA;
+
+extern void boinc_options_defaults(BOINC_OPTIONS &options);
+extern int boinc_init_options(BOINC_OPTIONS *options);
+extern int boinc_is_standalone(void);
+extern int boinc_finish(int status);
+extern int boinc_fraction_done(double fraction);
+extern double boinc_get_fraction_done(void);
+extern int boinc_checkpoint_completed(void);
+extern int boinc_begin_critical_section(void);
+extern int boinc_end_critical_section(void);
+extern int boinc_wu_cpu_time(double &cpu);
+extern double boinc_elapsed_time(void);
+extern int boinc_get_init_data(APP_INIT_DATA &data);
+extern int boinc_send_trickle_up(char *variety, char *text);
+extern int boinc_resolve_filename(const char *virtual_name, char *physical_name, int len);
+
+#endif
@@ -0,0 +1,107 @@
+/* boinc_stub.cpp --
+
+	Stand-in for the BOINC libraries so the bench target builds without a
+	BOINC tree.  The app always runs standalone, file names are used as
+	given and progress reports are ignored.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "boinc_api.h"
+#include "filesys.h"
+
+
+static double fraction_done = 0.0;
+static time_t start_time;
+
+
+void boinc_options_defaults(BOINC_OPTIONS &options)
+{
+	memset(&options, 0, sizeof(options));
+}
+
+int boinc_init_options(BOINC_OPTIONS *)
+{
+	time(&start_time);
+	return 0;
+}
+
+int boinc_is_standalone(void)
+{
+	return 1;
+}
+
+int boinc_finish(int status)
+{
+	fflush(NULL);
+	exit(status);
+	return status;
+}
+
+int boinc_fraction_done(double fraction)
+{
+	fraction_done = fraction;
+	return 0;
+}
+
+double boinc_get_fraction_done(void)
+{
+	return fraction_done;
+}
+
+int boinc_checkpoint_completed(void)
+{
+	return 0;
+}
+
+int boinc_begin_critical_section(void)
+{
+	return 0;
+}
+
+int boinc_end_critical_section(void)
+{
+	return 0;
+}
+
+int boinc_wu_cpu_time(double &cpu)
+{
+	cpu = (double)clock() / CLOCKS_PER_SEC;
+	return 0;
+}
+
+double boinc_elapsed_time(void)
+{
+	return difftime(time(NULL), start_time);
+}
+
+int boinc_get_init_data(APP_INIT_DATA &data)
+{
+	data.starting_elapsed_time = 0.0;
+	return 0;
+}
+
+int boinc_send_trickle_up(char *, char *)
+{
+	return 0;
+}
+
+int boinc_resolve_filename(const char *virtual_name, char *physical_name, int len)
+{
+	snprintf(physical_name, len, "%s", virtual_name);
+	return 0;
+}
+
+FILE *boinc_fopen(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+int boinc_rename(const char *old_path, const char *new_path)
+{
+	return rename(old_path, new_path);
+}
@@ -0,0 +1,12 @@
+// filesys.h
+// minimal stand-in for the BOINC file functions, used by the bench target only
+
+#ifndef BOINC_STUB_FILESYS_H
+#define BOINC_STUB_FILESYS_H
+
+#include <cstdio>
+
+extern FILE *boinc_fopen(const char *path, const char *mode);
+extern int boinc_rename(const char *old_path, const char *new_path);
+
+#endif
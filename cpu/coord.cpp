@@ -0,0 +1,506 @@
+/* coord.cpp --
+
+	Coordinator and worker modes.
+
+	The coordinator owns the K range from the command line and leases one K
+	at a time to worker processes over TCP (host:port) or a Unix socket
+	(unix:/path).  Results are committed in K order so the results file,
+	checksum and checkpoints are the same as a single process run.
+
+	Protocol, one line per message:
+		worker:		GET
+		coordinator:	LEASE K SHIFT | WAIT | DONE
+		worker:		SOL AP_Length First_Term	(zero or more)
+				RESULT K cksum aps
+*/
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "boinc_api.h"
+
+#include "mainconst.h"
+
+#define MAXINTV 2000000000
+
+#ifndef _WIN32
+
+// one entry per K that will be searched
+#define KL_PENDING	0
+#define KL_LEASED	1
+#define KL_DONE		2
+
+typedef struct _klease_t {
+	int K, state;
+	time_t issued;
+	uint32_t cksum, aps;
+	sol_t *sol;
+	int nsol;
+} klease_t;
+
+typedef struct _client_t {
+	int fd;
+	int lease;		// index into leases, -1 if none
+	char buf[1024];
+	int used;
+	sol_t *sol;		// solutions received for the current RESULT
+	int nsol, size;
+} client_t;
+
+/* addr is unix:/path or host:port.  An empty host listens on all interfaces.
+   Returns a socket that is bound (listen) or connected, exits on error.
+*/
+static int net_open(const char *addr, int listening)
+{
+	int fd;
+
+	if(strncmp(addr, "unix:", 5) == 0){
+		struct sockaddr_un sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if(strlen(addr+5) >= sizeof(sa.sun_path)){
+			fprintf(stderr,"Error: socket path too long: %s\n", addr+5);
+			printf("Error: socket path too long: %s\n", addr+5);
+			exit(EXIT_FAILURE);
+		}
+		strcpy(sa.sun_path, addr+5);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd >= 0){
+			if(listening){
+				unlink(sa.sun_path);
+				if(bind(fd, (struct sockaddr*)&sa, sizeof(sa)) || listen(fd, 64)){
+					close(fd);
+					fd = -1;
+				}
+			}
+			else if(connect(fd, (struct sockaddr*)&sa, sizeof(sa))){
+				close(fd);
+				fd = -1;
+			}
+		}
+	}
+	else{
+		char host[256];
+		const char *port = strrchr(addr, ':');
+		struct addrinfo hints, *res, *ai;
+
+		if(port == NULL || port - addr >= (int)sizeof(host)){
+			fprintf(stderr,"Error: address must be host:port or unix:/path, got %s\n", addr);
+			printf("Error: address must be host:port or unix:/path, got %s\n", addr);
+			exit(EXIT_FAILURE);
+		}
+		memcpy(host, addr, port - addr);
+		host[port - addr] = 0;
+		port++;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if(listening) hints.ai_flags = AI_PASSIVE;
+
+		if(getaddrinfo(host[0] ? host : NULL, port, &hints, &res)){
+			fprintf(stderr,"Error: cannot resolve %s\n", addr);
+			printf("Error: cannot resolve %s\n", addr);
+			exit(EXIT_FAILURE);
+		}
+
+		fd = -1;
+		for(ai = res; ai != NULL && fd < 0; ai = ai->ai_next){
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if(fd < 0) continue;
+			if(listening){
+				int one = 1;
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+				if(bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 64)){
+					close(fd);
+					fd = -1;
+				}
+			}
+			else if(connect(fd, ai->ai_addr, ai->ai_addrlen)){
+				close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(res);
+	}
+
+	if(fd < 0){
+		fprintf(stderr,"Error: cannot %s %s\n", listening ? "listen on" : "connect to", addr);
+		printf("Error: cannot %s %s\n", listening ? "listen on" : "connect to", addr);
+		exit(EXIT_FAILURE);
+	}
+
+	return fd;
+}
+
+
+// returns 0 if the peer is gone
+static int net_send(int fd, const char *msg)
+{
+	size_t len = strlen(msg);
+
+	while(len){
+		ssize_t n = write(fd, msg, len);
+		if(n <= 0) return 0;
+		msg += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+
+/* Coordinator */
+
+static int find_lease(klease_t *leases, int count, int K)
+{
+	int lo = 0, hi = count - 1;
+
+	while(lo <= hi){
+		int mid = (lo + hi) / 2;
+		if(leases[mid].K == K) return mid;
+		if(leases[mid].K < K) lo = mid + 1;
+		else hi = mid - 1;
+	}
+
+	return -1;
+}
+
+
+static void drop_client(client_t *c, klease_t *leases)
+{
+	if(c->lease >= 0 && leases[c->lease].state == KL_LEASED){
+		leases[c->lease].state = KL_PENDING;
+		if(boinc_is_standalone()){
+			printf("Worker lost, K %d returned to the pool\n", leases[c->lease].K);
+		}
+	}
+
+	close(c->fd);
+	free(c->sol);
+	c->fd = -1;
+	c->sol = NULL;
+	c->nsol = c->size = 0;
+	c->used = 0;
+	c->lease = -1;
+}
+
+
+/* Handle one line from a worker.  Returns 0 if the worker should be dropped.
+*/
+static int client_line(client_t *c, char *line, klease_t *leases, int count, int SHIFT)
+{
+	char msg[64];
+	int K, AP_Length;
+	uint32_t ck, aps;
+	uint64_t First_Term;
+
+	if(strcmp(line, "GET") == 0){
+		int i;
+
+		for(i = 0; i < count && leases[i].state != KL_PENDING; ++i);
+
+		if(i < count){
+			leases[i].state = KL_LEASED;
+			leases[i].issued = time(NULL);
+			c->lease = i;
+			sprintf(msg, "LEASE %d %d\n", leases[i].K, SHIFT);
+		}
+		else{
+			for(i = 0; i < count && leases[i].state == KL_DONE; ++i);
+			sprintf(msg, (i < count) ? "WAIT\n" : "DONE\n");
+		}
+
+		return net_send(c->fd, msg);
+	}
+	else if(sscanf(line, "SOL %d %" SCNu64, &AP_Length, &First_Term) == 2){
+		AppendSolution(&c->sol, &c->nsol, &c->size, AP_Length, First_Term);
+	}
+	else if(sscanf(line, "RESULT %d %u %u", &K, &ck, &aps) == 3){
+		int i = find_lease(leases, count, K);
+
+		if(i < 0){
+			fprintf(stderr,"Error: worker returned K %d which is not in this search\n", K);
+			return 0;
+		}
+
+		// first result for a K wins, late results from expired leases are dropped
+		if(leases[i].state != KL_DONE){
+			leases[i].state = KL_DONE;
+			leases[i].cksum = ck;
+			leases[i].aps = aps;
+			leases[i].sol = c->sol;
+			leases[i].nsol = c->nsol;
+			c->sol = NULL;
+			c->size = 0;
+		}
+		c->nsol = 0;
+		if(c->lease == i) c->lease = -1;
+	}
+	else{
+		fprintf(stderr,"Error: bad message from worker: %s\n", line);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void Coordinator(const char *addr, int K, int KMAX, int SHIFT, int K_COUNT, int K_DONE, int lease_secs)
+{
+	int i, count = 0, commit = 0, nclients = 0;
+	client_t *clients = NULL;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i = K; i <= KMAX; ++i){
+		if(will_search(i)) count++;
+	}
+
+	klease_t *leases = (klease_t*)calloc(count ? count : 1, sizeof(klease_t));
+	struct pollfd *pfd = (struct pollfd*)malloc(sizeof(struct pollfd));
+	if(leases == NULL || pfd == NULL){
+		fprintf(stderr,"Error: coordinator allocation failed\n");
+		printf("Error: coordinator allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(i = K, count = 0; i <= KMAX; ++i){
+		if(will_search(i)) leases[count++].K = i;
+	}
+
+	int lfd = net_open(addr, 1);
+
+	fprintf(stderr,"Coordinator listening on %s, %d K to search\n", addr, count);
+	if(boinc_is_standalone()){
+		printf("Coordinator listening on %s, %d K to search\n", addr, count);
+	}
+
+	while(commit < count){
+
+		pfd = (struct pollfd*)realloc(pfd, (nclients + 1) * sizeof(struct pollfd));
+		if(pfd == NULL){
+			fprintf(stderr,"Error: coordinator allocation failed\n");
+			exit(EXIT_FAILURE);
+		}
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		for(i = 0; i < nclients; ++i){
+			pfd[i+1].fd = clients[i].fd;
+			pfd[i+1].events = POLLIN;
+		}
+
+		poll(pfd, nclients + 1, 1000);
+
+		for(i = 0; i < nclients; ++i){
+			if(clients[i].fd < 0 || !(pfd[i+1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+			client_t *c = &clients[i];
+			ssize_t n = read(c->fd, c->buf + c->used, sizeof(c->buf) - 1 - c->used);
+			if(n <= 0){
+				drop_client(c, leases);
+				continue;
+			}
+			c->used += n;
+			c->buf[c->used] = 0;
+
+			char *line = c->buf, *nl;
+			int ok = 1;
+			while(ok && (nl = strchr(line, '\n')) != NULL){
+				*nl = 0;
+				ok = client_line(c, line, leases, count, SHIFT);
+				line = nl + 1;
+			}
+			if(!ok){
+				drop_client(c, leases);
+				continue;
+			}
+			c->used -= line - c->buf;
+			memmove(c->buf, line, c->used);
+			if(c->used == sizeof(c->buf) - 1){
+				fprintf(stderr,"Error: line too long from worker\n");
+				drop_client(c, leases);
+			}
+		}
+
+		// compact the client list
+		int j = 0;
+		for(i = 0; i < nclients; ++i){
+			if(clients[i].fd >= 0) clients[j++] = clients[i];
+		}
+		nclients = j;
+
+		if(pfd[0].revents & POLLIN){
+			int fd = accept(lfd, NULL, NULL);
+			if(fd >= 0){
+				clients = (client_t*)realloc(clients, (nclients + 1) * sizeof(client_t));
+				if(clients == NULL){
+					fprintf(stderr,"Error: coordinator allocation failed\n");
+					exit(EXIT_FAILURE);
+				}
+				memset(&clients[nclients], 0, sizeof(client_t));
+				clients[nclients].fd = fd;
+				clients[nclients].lease = -1;
+				nclients++;
+			}
+		}
+
+		// expire leases of hung or unreachable workers
+		time_t now = time(NULL);
+		for(i = commit; i < count; ++i){
+			if(leases[i].state == KL_LEASED && now - leases[i].issued > lease_secs){
+				leases[i].state = KL_PENDING;
+				// the K can go to another worker, so a later disconnect of
+				// this one must not return it to the pool again
+				for(j = 0; j < nclients; ++j){
+					if(clients[j].lease == i) clients[j].lease = -1;
+				}
+				fprintf(stderr,"Lease on K %d expired\n", leases[i].K);
+				if(boinc_is_standalone()){
+					printf("Lease on K %d expired\n", leases[i].K);
+				}
+			}
+		}
+
+		// commit finished K in order
+		int committed = commit;
+		while(commit < count && leases[commit].state == KL_DONE){
+			klease_t *l = &leases[commit];
+
+			for(j = 0; j < l->nsol; ++j){
+				QueueSolution(l->sol[j].AP_Length, l->K, l->sol[j].First_Term);
+			}
+			free(l->sol);
+			l->sol = NULL;
+
+			uint64_t total = cksum;
+			total += l->cksum;
+			if(total > MAXINTV){
+				total -= MAXINTV;
+			}
+			cksum = total;
+			totalaps += l->aps;
+
+			commit++;
+			K_DONE++;
+		}
+
+		if(commit > committed){
+			Progress( (double)K_DONE / (double)K_COUNT );
+			checkpoint(SHIFT, (commit < count) ? leases[commit].K : KMAX+1, 0);
+		}
+	}
+
+	for(i = 0; i < nclients; ++i){
+		net_send(clients[i].fd, "DONE\n");
+		close(clients[i].fd);
+		free(clients[i].sol);
+	}
+
+	close(lfd);
+	if(strncmp(addr, "unix:", 5) == 0){
+		unlink(addr+5);
+	}
+
+	free(clients);
+	free(pfd);
+	free(leases);
+}
+
+
+/* Worker */
+
+int WorkerConnect(const char *addr)
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	int fd = net_open(addr, 0);
+
+	fprintf(stderr,"Worker connected to %s\n", addr);
+	if(boinc_is_standalone()){
+		printf("Worker connected to %s\n", addr);
+	}
+
+	return fd;
+}
+
+
+/* Ask the coordinator for a K.  Returns 0 when there is no more work.
+*/
+int WorkerGetLease(int fd, int *K, int *SHIFT)
+{
+	char line[128];
+
+	for(;;){
+		if(!net_send(fd, "GET\n")) return 0;
+
+		// read one line, the coordinator sends nothing else unprompted
+		int len = 0;
+		while(len < (int)sizeof(line) - 1){
+			if(read(fd, &line[len], 1) != 1) return 0;
+			if(line[len] == '\n') break;
+			len++;
+		}
+		line[len] = 0;
+
+		if(sscanf(line, "LEASE %d %d", K, SHIFT) == 2){
+			return 1;
+		}
+		else if(strcmp(line, "WAIT") == 0){
+			// all K are leased, one may still expire
+			sleep(5);
+		}
+		else{
+			return 0;
+		}
+	}
+}
+
+
+void WorkerSendResult(int fd, int K, uint32_t k_cksum, uint32_t k_aps, sol_t *sol, int nsol)
+{
+	char msg[128];
+	int ok = 1;
+
+	for(int i = 0; i < nsol && ok; ++i){
+		sprintf(msg, "SOL %d %" PRIu64 "\n", sol[i].AP_Length, sol[i].First_Term);
+		ok = net_send(fd, msg);
+	}
+
+	sprintf(msg, "RESULT %d %u %u\n", K, k_cksum, k_aps);
+	if(!ok || !net_send(fd, msg)){
+		fprintf(stderr,"Error: lost connection to coordinator\n");
+		printf("Error: lost connection to coordinator\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+#else
+
+static void no_sockets()
+{
+	fprintf(stderr,"Error: coordinator and worker modes are not supported on Windows\n");
+	printf("Error: coordinator and worker modes are not supported on Windows\n");
+	exit(EXIT_FAILURE);
+}
+
+void Coordinator(const char *addr, int K, int KMAX, int SHIFT, int K_COUNT, int K_DONE, int lease_secs){ no_sockets(); }
+int WorkerConnect(const char *addr){ no_sockets(); return -1; }
+int WorkerGetLease(int fd, int *K, int *SHIFT){ return 0; }
+void WorkerSendResult(int fd, int K, uint32_t k_cksum, uint32_t k_aps, sol_t *sol, int nsol){}
+
+#endif
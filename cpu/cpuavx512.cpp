@@ -189,14 +189,16 @@ __m512i xxOKOK277[277];
   }
   
   
-void check_n(uint64_t n, uint64_t STEP, int K, uint32_t & checksum, uint32_t & apcount){
+void check_n(uint64_t n, uint64_t STEP, int id){
+
+	STAT_ADD(id, survivors, 1);
 
 	if(n%7)
 	if(n%11)
 	if(n%13)
 	if(n%17)
 	if(n%19)
-	if(n%23)
+	if(STAT_PASS(id, div23, n%23))
 	if(OK281[n%281])
 	if(OK283[n%283])
 	if(OK293[n%293])
@@ -238,10 +240,11 @@ void check_n(uint64_t n, uint64_t STEP, int K, uint32_t & checksum, uint32_t & a
 	if(OK521[n%521])
 	if(OK523[n%523])
 	if(OK541[n%541]){
+		STAT_ADD(id, cascade, 1);
 		int k = 0;
 		uint64_t m = n + STEP * 5;
 					
-		while(PrimeQ(m)){
+		while(STAT_PRIMEQ(id, m)){
 			k++;
 			m += STEP;
 		}
@@ -249,18 +252,19 @@ void check_n(uint64_t n, uint64_t STEP, int K, uint32_t & checksum, uint32_t & a
 		if(k>=10){
 			m = n + STEP * 4;
 			uint64_t mstart = m;
-			while(PrimeQ(m)){
+			while(STAT_PRIMEQ(id, m)){
 				k++;
 				m -= STEP;
 				if(m > mstart) break;	// m < 0
 			}
 		}
 
+		STAT_APLEN(id, k);
+
 		if(k>=10){
 			uint64_t first_term = m + STEP;
 
-			ReportSolution(k, K, first_term, checksum);
-			++apcount;
+			RecordSolution(id, k, first_term);
 		}
 	}
 	
@@ -271,17 +275,15 @@ void *thr_func_avx512(void *arg) {
 
 	thread_data_t *data = (thread_data_t *)arg;
 	int i43, i47, i53, i59;
-	uint64_t n, n43, n47, n53, n59;
+	uint64_t n43, n47, n53, n59;
 	time_t boinc_last, boinc_curr;
-	double cc, dd;
+	double cc = 0, dd = 0;
 	uint64_t sito[8] __attribute__ ((aligned (64)));
 	uint64_t sitosm[2] __attribute__ ((aligned (16)));
  	int16_t rems[16] __attribute__ ((aligned (32)));
 	const __m256i ZERO256 = _mm256_setzero_si256();
 	const __m512i ZERO512 = _mm512_setzero_si512();
 	__mmask16 m;
-	uint32_t checksum = 0;
-	uint32_t apcount = 0;
 
 	if(data->id == 0){
 		time(&boinc_last);
@@ -292,14 +294,14 @@ void *thr_func_avx512(void *arg) {
 	ckerr(pthread_mutex_lock(&lock1));
 	int start = current_n43;
 	int stop = start + thread_range;
-	if(stop > numn43s) stop = numn43s;
+	if(stop > n43_stop) stop = n43_stop;
 	current_n43 = stop;
 	ckerr(pthread_mutex_unlock(&lock1));
 
-	while(start < numn43s){
+	while(start < n43_stop){
 		for(;start<stop;++start){
 			
-			if(data->id == 0){
+			if(data->id == 0 && search_report){
 				time (&boinc_curr);
 				if( ((int)boinc_curr - (int)boinc_last) > 5 ){
 					double prog = (cc + (double)start ) * dd;
@@ -340,6 +342,7 @@ void *thr_func_avx512(void *arg) {
 							}								
 
 							// check the first 8 SHIFTs
+							STAT_ADD(data->id, passes, 1);
 							__m512i dsito = _mm512_and_epi64( xxOKOK61[rems[0]], xxOKOK67[rems[1]] );
 							dsito = _mm512_and_epi64( dsito, xxOKOK71[rems[2]] );
 							dsito = _mm512_and_epi64( dsito, xxOKOK73[rems[3]] );
@@ -356,6 +359,7 @@ void *thr_func_avx512(void *arg) {
 							dsito = _mm512_and_epi64( dsito, xxOKOK131[rems[14]] );
 							dsito = _mm512_and_epi64( dsito, xxOKOK137[rems[15]] );
 							if( continue_sito(dsito) ){
+								STAT_ADD(data->id, sito137, 1);
 								dsito = _mm512_and_epi64( dsito, xxOKOK139[REM(n59,139,8)] );
 								dsito = _mm512_and_epi64( dsito, xxOKOK149[REM(n59,149,8)] );
 								dsito = _mm512_and_epi64( dsito, xxOKOK151[REM(n59,151,8)] );
@@ -370,6 +374,7 @@ void *thr_func_avx512(void *arg) {
 								dsito = _mm512_and_epi64( dsito, xxOKOK197[REM(n59,197,8)] );
 								dsito = _mm512_and_epi64( dsito, xxOKOK199[REM(n59,199,8)] );
 							if( continue_sito(dsito) ){
+								STAT_ADD(data->id, sito199, 1);
 								dsito = _mm512_and_epi64( dsito, xxOKOK211[REM(n59,211,8)] );
 								dsito = _mm512_and_epi64( dsito, xxOKOK223[REM(n59,223,8)] );
 								dsito = _mm512_and_epi64( dsito, xxOKOK227[REM(n59,227,8)] );
@@ -384,18 +389,20 @@ void *thr_func_avx512(void *arg) {
 								dsito = _mm512_and_epi64( dsito, xxOKOK271[REM(n59,271,9)] );
 								dsito = _mm512_and_epi64( dsito, xxOKOK277[REM(n59,277,9)] );
 							if( continue_sito(dsito) ){
+								STAT_ADD(data->id, sito277, 1);
 								_mm512_store_epi64(sito, dsito);
 								for(int ii=0;ii<8;++ii){
 									while(sito[ii]){
 										int setbit = 63 - __builtin_clzll(sito[ii]);
 										uint64_t n = n59+( setbit + data->SHIFT + (64*ii) )*MOD;
-										check_n(n, data->STEP, data->K, checksum, apcount);																											
+										check_n(n, data->STEP, data->id);																											
 										sito[ii] ^= ((uint64_t)1) << setbit; // toggle bit off
 									}
 								}
 							}}}
 							
 							// check the last two SHIFTs
+							STAT_ADD(data->id, passes, 1);
 							__m128i isito = _mm_and_si128( ixOKOK61[rems[0]], ixOKOK67[rems[1]] );
 							isito = _mm_and_si128( isito, ixOKOK71[rems[2]] );
 							isito = _mm_and_si128( isito, ixOKOK73[rems[3]] );
@@ -412,6 +419,7 @@ void *thr_func_avx512(void *arg) {
 							isito = _mm_and_si128( isito, ixOKOK131[rems[14]] );
 							isito = _mm_and_si128( isito, ixOKOK137[rems[15]] );
 							if( continue_sito_128(isito) ){
+								STAT_ADD(data->id, sito137, 1);
 								isito = _mm_and_si128( isito, ixOKOK139[REM(n59,139,8)] );
 								isito = _mm_and_si128( isito, ixOKOK149[REM(n59,149,8)] );
 								isito = _mm_and_si128( isito, ixOKOK151[REM(n59,151,8)] );
@@ -426,6 +434,7 @@ void *thr_func_avx512(void *arg) {
 								isito = _mm_and_si128( isito, ixOKOK197[REM(n59,197,8)] );
 								isito = _mm_and_si128( isito, ixOKOK199[REM(n59,199,8)] );
 							if( continue_sito_128(isito) ){
+								STAT_ADD(data->id, sito199, 1);
 								isito = _mm_and_si128( isito, ixOKOK211[REM(n59,211,8)] );
 								isito = _mm_and_si128( isito, ixOKOK223[REM(n59,223,8)] );
 								isito = _mm_and_si128( isito, ixOKOK227[REM(n59,227,8)] );
@@ -440,18 +449,19 @@ void *thr_func_avx512(void *arg) {
 								isito = _mm_and_si128( isito, ixOKOK271[REM(n59,271,9)] );
 								isito = _mm_and_si128( isito, ixOKOK277[REM(n59,277,9)] );
 							if( continue_sito_128(isito) ){
+								STAT_ADD(data->id, sito277, 1);
 								_mm_store_si128( (__m128i*)sitosm, isito );
 								
 								while(sitosm[0]){
 									int setbit = 63 - __builtin_clzll(sitosm[0]);
 									uint64_t n = n59+( setbit + data->SHIFT + 512 )*MOD;
-									check_n(n, data->STEP, data->K, checksum, apcount);																											
+									check_n(n, data->STEP, data->id);																											
 									sitosm[0] ^= ((uint64_t)1) << setbit; // toggle bit off
 								}
 								while(sitosm[1]){
 									int setbit = 63 - __builtin_clzll(sitosm[1]);
 									uint64_t n = n59+( setbit + data->SHIFT + 576 )*MOD;
-									check_n(n, data->STEP, data->K, checksum, apcount);																											
+									check_n(n, data->STEP, data->id);																											
 									sitosm[1] ^= ((uint64_t)1) << setbit; // toggle bit off
 								}								
 
@@ -489,22 +499,11 @@ void *thr_func_avx512(void *arg) {
 		ckerr(pthread_mutex_lock(&lock1));
 		start = current_n43;
 		stop = start + thread_range;
-		if(stop > numn43s) stop = numn43s;
+		if(stop > n43_stop) stop = n43_stop;
 		current_n43 = stop;
 		ckerr(pthread_mutex_unlock(&lock1));
 	}
 	
-	// add this threads checksum and ap count to total
-	ckerr(pthread_mutex_lock(&lock3));
-	uint64_t total = cksum;
-	total += checksum;
-	if(total > MAXINTV){
-		total -= MAXINTV;
-	}
-	cksum = total;
-	totalaps += apcount;
-	ckerr(pthread_mutex_unlock(&lock3));	
-
 	pthread_exit(NULL);
 
 	return NULL;
@@ -742,7 +741,7 @@ void Search_avx512(int K, int SHIFT, int K_COUNT, int K_DONE, int threads)
 	thread_data_t thr_data[threads];
 
 	// initialize shared data
-	current_n43 = 0;
+	current_n43 = n43_start;
 
 	// create threads
 	for (k = 0; k < threads; ++k) {
@@ -773,7 +772,7 @@ void Search_avx512(int K, int SHIFT, int K_COUNT, int K_DONE, int threads)
 	}
 
 
-	if(boinc_standalone()){
+	if(boinc_standalone() && search_report){
 		time(&finish_time);
 		printf("Computation of K: %d complete in %d seconds\n", K, (int)finish_time - (int)start_time);
 	}
@@ -781,3 +780,61 @@ void Search_avx512(int K, int SHIFT, int K_COUNT, int K_DONE, int threads)
 
 
 }
+
+
+#ifdef AP26_BENCH
+
+#define MICRO_OKOK(_P,_S) MAKE_OKOK(_P) MAKE_OKOKix(_P)
+#define MICRO_AND(_P,_S) \
+  dsito = _mm512_and_epi64( dsito, xxOKOK##_P[REM(n59,_P,_S)] ); \
+  isito = _mm_and_si128( isito, ixOKOK##_P[REM(n59,_P,_S)] );
+
+/* Times MAKE_OK, MAKE_OKOK and n59s through the AND chain, see microbench.cpp.
+   Leaves the OK and OKOK tables set up for K and SHIFT.
+*/
+void Micro_avx512(int K, int SHIFT, micro_t *m)
+{
+	int j, jj, r;
+	uint64_t STEP = K*PRIM23;
+	uint64_t S59 = (PRES8*(K%17835)+((PRES8*17835)%MOD)*(K/17835))%MOD;
+	uint64_t n59 = S59;
+	uint64_t sOKOK[8] __attribute__ ((aligned (64)));
+	uint64_t tOKOK[2] __attribute__ ((aligned (16)));
+	uint64_t t;
+
+	t = __rdtsc();
+	for(r = 0; r < MICRO_TABLE_REPS; ++r){
+		OK_PRIMES(MAKE_OK)
+	}
+	m->make_ok = (double)(__rdtsc() - t) / (MICRO_TABLE_REPS * NUM_OK_PRIMES);
+
+	t = __rdtsc();
+	for(r = 0; r < MICRO_TABLE_REPS; ++r){
+		OKOK_PRIMES(MICRO_OKOK)
+	}
+	m->make_okok = (double)(__rdtsc() - t) / (MICRO_TABLE_REPS * NUM_OKOK_PRIMES);
+
+	__m512i acc = _mm512_setzero_si512();
+	__m128i iacc = _mm_setzero_si128();
+	t = __rdtsc();
+	for(r = 0; r < MICRO_N59; ++r){
+		__m512i dsito = _mm512_set1_epi32(-1);
+		__m128i isito = _mm_set1_epi32(-1);
+		OKOK_PRIMES(MICRO_AND)
+		acc = _mm512_or_si512(acc, dsito);
+		iacc = _mm_or_si128(iacc, isito);
+		n59 += S59;
+		if(n59>=MOD) n59-=MOD;
+	}
+	m->sito = (double)(__rdtsc() - t) / MICRO_N59;
+	m->sito_shifts = 640;
+
+	_mm512_store_epi64( sOKOK, acc );
+	_mm_store_si128( (__m128i*)tOKOK, iacc );
+	for(j = 0; j < 8; ++j){
+		micro_sink += sOKOK[j];
+	}
+	micro_sink += tOKOK[0] ^ tOKOK[1];
+}
+
+#endif
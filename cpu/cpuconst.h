@@ -1,7 +1,5 @@
 // cpuconst.h
 
-extern uint64_t *n43_h;
-
 extern __m128i svec1, svec2, mvec1, mvec2, numvec1_1, numvec2_1, numvec1_2, numvec2_2;
 extern __m256i svec, mvec, numvec1, numvec2;
 
@@ -184,15 +182,14 @@ extern pthread_mutex_t lock1;
 /////////////////////////////
 
 ///////////////////////////////////
-// lock used for writing results to file
+// lock used for the I/O thread queue
 extern pthread_mutex_t lock2;
 ///////////////////////////////////
 
 ///////////////////////////////////
-// lock used for checksum and ap count
+// checksum and ap count, only updated by main between K
 extern uint32_t totalaps;
 extern uint32_t cksum;
-extern pthread_mutex_t lock3;
 ///////////////////////////////////
 
 
@@ -202,12 +199,9 @@ typedef struct _thread_data_t {
 } thread_data_t;
 
 
-// located in AP26.cpp
-extern void Progress(double prog);
-extern void ReportSolution(int AP_Length, int difference, uint64_t First_Term, uint32_t & checksum);
-extern bool PrimeQ(uint64_t N);
-extern int boinc_standalone(void);
-extern void ckerr(int err);
+#include "search.h"
+#include "stats.h"
+#include "microbench.h"
 
 
 #define thread_range 50
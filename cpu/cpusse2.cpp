@@ -38,15 +38,13 @@
 void *thr_func_sse2(void *arg) {
 	thread_data_t *data = (thread_data_t *)arg;
 	int i43, i47, i53, i59;
-	uint64_t n, n43, n47, n53, n59;
+	uint64_t n43, n47, n53, n59;
 	time_t boinc_last, boinc_curr;
-	double cc, dd;
+	double cc = 0, dd = 0;
 	uint64_t sito[2] __attribute__ ((aligned (16)));
  	int16_t rems[8] __attribute__ ((aligned (16)));
 	int16_t rrems[8] __attribute__ ((aligned (16)));
 	const __m128i ZERO128 = _mm_setzero_si128();
-	uint32_t checksum = 0;
-	uint32_t apcount = 0;	
 
 	if(data->id == 0){
 		time(&boinc_last);
@@ -57,14 +55,14 @@ void *thr_func_sse2(void *arg) {
 	ckerr(pthread_mutex_lock(&lock1));
 	int start = current_n43;
 	int stop = start + thread_range;
-	if(stop > numn43s) stop = numn43s;
+	if(stop > n43_stop) stop = n43_stop;
 	current_n43 = stop;
 	ckerr(pthread_mutex_unlock(&lock1));
 
-	while(start < numn43s){
+	while(start < n43_stop){
 		for(;start<stop;++start){
 			
-			if(data->id == 0){
+			if(data->id == 0 && search_report){
 				time (&boinc_curr);
 				if( ((int)boinc_curr - (int)boinc_last) > 5 ){
 					double prog = (cc + (double)start ) * dd;
@@ -106,6 +104,7 @@ void *thr_func_sse2(void *arg) {
 								_mm_store_si128( (__m128i*)rrems, r_numvec2);
 							}								
 
+							STAT_ADD(data->id, passes, 1);
 							__m128i isito = _mm_and_si128( ixOKOK61[rems[0]], ixOKOK67[rems[1]] );
 							isito = _mm_and_si128( isito, ixOKOK71[rems[2]] );
 							isito = _mm_and_si128( isito, ixOKOK73[rems[3]] );
@@ -123,6 +122,7 @@ void *thr_func_sse2(void *arg) {
 							isito = _mm_and_si128( isito, ixOKOK137[rrems[7]] );
 							_mm_store_si128( (__m128i*)sito, isito );
 							if( sito[0] || sito[1] ){
+								STAT_ADD(data->id, sito137, 1);
 								isito = _mm_and_si128( isito, ixOKOK139[REM(n59,139,8)] );
 								isito = _mm_and_si128( isito, ixOKOK149[REM(n59,149,8)] );
 								isito = _mm_and_si128( isito, ixOKOK151[REM(n59,151,8)] );
@@ -138,6 +138,7 @@ void *thr_func_sse2(void *arg) {
 								isito = _mm_and_si128( isito, ixOKOK199[REM(n59,199,8)] );
 								_mm_store_si128( (__m128i*)sito, isito );
 							if( sito[0] || sito[1] ){
+								STAT_ADD(data->id, sito199, 1);
 								isito = _mm_and_si128( isito, ixOKOK211[REM(n59,211,8)] );
 								isito = _mm_and_si128( isito, ixOKOK223[REM(n59,223,8)] );
 								isito = _mm_and_si128( isito, ixOKOK227[REM(n59,227,8)] );
@@ -153,17 +154,19 @@ void *thr_func_sse2(void *arg) {
 								isito = _mm_and_si128( isito, ixOKOK277[REM(n59,277,9)] );
 								_mm_store_si128( (__m128i*)sito, isito );
 							if( sito[0] || sito[1] ){
+								STAT_ADD(data->id, sito277, 1);
 								for(int ii=0;ii<2;++ii){
 									while(sito[ii]){
 										int setbit = 63 - __builtin_clzll(sito[ii]);
 										uint64_t n = n59+( setbit + data->SHIFT + (64*ii) )*MOD;
+										STAT_ADD(data->id, survivors, 1);
 
 										if(n%7)
 										if(n%11)
 										if(n%13)
 										if(n%17)
 										if(n%19)
-										if(n%23)
+										if(STAT_PASS(data->id, div23, n%23))
 										if(OK281[n%281])
 										if(OK283[n%283])
 										if(OK293[n%293])
@@ -205,9 +208,10 @@ void *thr_func_sse2(void *arg) {
 										if(OK521[n%521])
 										if(OK523[n%523])
 										if(OK541[n%541]){
+											STAT_ADD(data->id, cascade, 1);
 											int k = 0;
 											uint64_t m = n + data->STEP * 5;
-											while(PrimeQ(m)){
+											while(STAT_PRIMEQ(data->id, m)){
 												k++;
 												m += data->STEP;
 											}
@@ -215,18 +219,19 @@ void *thr_func_sse2(void *arg) {
 											if(k>=10){
 												m = n + data->STEP * 4;
 												uint64_t mstart = m;
-												while(PrimeQ(m)){
+												while(STAT_PRIMEQ(data->id, m)){
 													k++;
 													m -= data->STEP;
 													if(m > mstart) break;
 												}
 											}
 
+											STAT_APLEN(data->id, k);
+
 											if(k>=10){
 												uint64_t first_term = m + data->STEP;
 
-												ReportSolution(k, data->K, first_term, checksum);
-												++apcount;
+												RecordSolution(data->id, k, first_term);
 											}
 										}
 																								
@@ -272,23 +277,12 @@ void *thr_func_sse2(void *arg) {
 		ckerr(pthread_mutex_lock(&lock1));
 		start = current_n43;
 		stop = start + thread_range;
-		if(stop > numn43s) stop = numn43s;
+		if(stop > n43_stop) stop = n43_stop;
 		current_n43 = stop;
 		ckerr(pthread_mutex_unlock(&lock1));
 	}
 	
 	
-	// add this threads checksum and ap count to total
-	ckerr(pthread_mutex_lock(&lock3));
-	uint64_t total = cksum;
-	total += checksum;
-	if(total > MAXINTV){
-		total -= MAXINTV;
-	}
-	cksum = total;
-	totalaps += apcount;
-	ckerr(pthread_mutex_unlock(&lock3));		
-
 	pthread_exit(NULL);
 
 	return NULL;
@@ -501,7 +495,7 @@ void Search_sse2(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads)
 		thread_data_t thr_data[threads];
 
 		// initialize shared data
-		current_n43 = 0;
+		current_n43 = n43_start;
 
 		// create threads
 		for (k = 0; k < threads; ++k) {
@@ -536,10 +530,59 @@ void Search_sse2(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads)
 		
 	}
 
-	if(boinc_standalone()){
+	if(boinc_standalone() && search_report){
 		time(&finish_time);
 		printf("Computation of K: %d complete in %d seconds\n", K, (int)finish_time - (int)start_time);
 	}
 
 
 }
+
+
+#ifdef AP26_BENCH
+
+#define MICRO_OKOK(_P,_S) MAKE_OKOK(_P)
+#define MICRO_AND(_P,_S) isito = _mm_and_si128( isito, ixOKOK##_P[REM(n59,_P,_S)] );
+
+/* Times MAKE_OK, MAKE_OKOK and n59s through the AND chain, see microbench.cpp.
+   Leaves the OK and OKOK tables set up for K and SHIFT.
+*/
+void Micro_sse2(int K, int SHIFT, micro_t *m)
+{
+	int j, jj, r;
+	int maxshift = SHIFT+640;
+	uint64_t STEP = K*PRIM23;
+	uint64_t S59 = (PRES8*(K%17835)+((PRES8*17835)%MOD)*(K/17835))%MOD;
+	uint64_t n59 = S59;
+	uint64_t sOKOK[2] __attribute__ ((aligned (16)));
+	uint64_t t;
+
+	t = __rdtsc();
+	for(r = 0; r < MICRO_TABLE_REPS; ++r){
+		OK_PRIMES(MAKE_OK)
+	}
+	m->make_ok = (double)(__rdtsc() - t) / (MICRO_TABLE_REPS * NUM_OK_PRIMES);
+
+	t = __rdtsc();
+	for(r = 0; r < MICRO_TABLE_REPS; ++r){
+		OKOK_PRIMES(MICRO_OKOK)
+	}
+	m->make_okok = (double)(__rdtsc() - t) / (MICRO_TABLE_REPS * NUM_OKOK_PRIMES);
+
+	__m128i acc = _mm_setzero_si128();
+	t = __rdtsc();
+	for(r = 0; r < MICRO_N59; ++r){
+		__m128i isito = _mm_set1_epi32(-1);
+		OKOK_PRIMES(MICRO_AND)
+		acc = _mm_or_si128(acc, isito);
+		n59 += S59;
+		if(n59>=MOD) n59-=MOD;
+	}
+	m->sito = (double)(__rdtsc() - t) / MICRO_N59;
+	m->sito_shifts = 128;
+
+	_mm_store_si128( (__m128i*)sOKOK, acc );
+	micro_sink += sOKOK[0] ^ sOKOK[1];
+}
+
+#endif
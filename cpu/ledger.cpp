@@ -0,0 +1,484 @@
+/* ledger.cpp --
+
+	Shared ledger mode.
+
+	Several processes on one host search the same KMIN..KMAX range by
+	claiming K from a memory mapped ledger file.  Each K has an owner word
+	(pid << 2 | state) that is claimed with compare and swap, plus the
+	checksum and AP count of that K once it is done.  A K claimed by a
+	process that no longer exists is claimed again.
+
+	The CPU and OpenCL apps can share one ledger, so a GPU and the CPU
+	cores split a range by whole K at the rate each one finishes them.
+	Near the end a process leaves the last K to faster processes when
+	they would finish them sooner.
+
+	Solutions are appended to the results file under flock on the ledger.
+	The process that completes the last K sorts the results file into K
+	order and writes the checksum, so the output is the same as one
+	process searching the whole range.
+*/
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "boinc_api.h"
+#include "filesys.h"
+
+#include "ledger.h"
+
+#define MAXINTV 2000000000
+
+#ifndef _WIN32
+
+#define LEDGER_MAGIC	0x41503236	// AP26
+
+#define LK_FREE		0
+#define LK_CLAIMED	1
+#define LK_DONE		2
+
+typedef struct _ledger_hdr_t {
+	uint32_t magic;
+	int32_t KMIN, KMAX, SHIFT;
+	int32_t count;
+	uint32_t finalized;
+} ledger_hdr_t;
+
+typedef struct _ledger_ent_t {
+	uint64_t owner;		// pid << 2 | state
+	uint64_t claimed;	// time of claim
+	int32_t K;
+	uint32_t cksum, aps;
+	uint32_t secs;		// time taken once done
+	uint32_t nsol;		// solution lines written for the K
+	uint32_t pad;
+} ledger_ent_t;
+
+static int ledger_fd = -1;
+static size_t ledger_size;
+static ledger_hdr_t *ledger_hdr;
+static ledger_ent_t *ledger_ent;
+
+
+static void ledger_lock(int op)
+{
+	while(flock(ledger_fd, op)){
+		if(errno != EINTR){
+			fprintf(stderr,"Error: ledger flock failed\n");
+			printf("Error: ledger flock failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+
+static int pid_alive(int pid)
+{
+	return (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+
+void LedgerOpen(const char *path, int KMIN, int KMAX, int SHIFT)
+{
+	struct stat st;
+	int i, count = 0;
+
+	for(i = KMIN; i <= KMAX; ++i){
+		if(will_search(i)) count++;
+	}
+
+	ledger_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(ledger_fd < 0){
+		fprintf(stderr,"Error: cannot open ledger %s\n", path);
+		printf("Error: cannot open ledger %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	ledger_lock(LOCK_EX);
+
+	if(fstat(ledger_fd, &st)){
+		fprintf(stderr,"Error: cannot stat ledger %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	ledger_size = sizeof(ledger_hdr_t) + count * sizeof(ledger_ent_t);
+	int created = (st.st_size == 0);
+
+	if(created){
+		if(ftruncate(ledger_fd, ledger_size)){
+			fprintf(stderr,"Error: cannot size ledger %s\n", path);
+			printf("Error: cannot size ledger %s\n", path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if((size_t)st.st_size != ledger_size){
+		fprintf(stderr,"Error: ledger %s is for a different search\n", path);
+		printf("Error: ledger %s is for a different search\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	void *map = mmap(NULL, ledger_size, PROT_READ | PROT_WRITE, MAP_SHARED, ledger_fd, 0);
+	if(map == MAP_FAILED){
+		fprintf(stderr,"Error: cannot map ledger %s\n", path);
+		printf("Error: cannot map ledger %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	ledger_hdr = (ledger_hdr_t*)map;
+	ledger_ent = (ledger_ent_t*)((char*)map + sizeof(ledger_hdr_t));
+
+	if(created){
+		ledger_hdr->KMIN = KMIN;
+		ledger_hdr->KMAX = KMAX;
+		ledger_hdr->SHIFT = SHIFT;
+		ledger_hdr->count = count;
+		for(i = KMIN, count = 0; i <= KMAX; ++i){
+			if(will_search(i)) ledger_ent[count++].K = i;
+		}
+		ledger_hdr->magic = LEDGER_MAGIC;
+
+		// new search, clear result file
+		FILE *temp_file = my_fopen(RESULTS_FILENAME,"w");
+		if (temp_file == NULL){
+			fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+			exit(EXIT_FAILURE);
+		}
+		fclose(temp_file);
+	}
+	else if(ledger_hdr->magic != LEDGER_MAGIC || ledger_hdr->KMIN != KMIN ||
+		ledger_hdr->KMAX != KMAX || ledger_hdr->SHIFT != SHIFT){
+		fprintf(stderr,"Error: ledger %s is for a different search\n", path);
+		printf("Error: ledger %s is for a different search\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	ledger_lock(LOCK_UN);
+
+	fprintf(stderr,"%s ledger %s, %d K to search\n", created ? "Created" : "Joined", path, count);
+	if(boinc_is_standalone()){
+		printf("%s ledger %s, %d K to search\n", created ? "Created" : "Joined", path, count);
+	}
+}
+
+
+/* Average seconds per K for pid, 0 if it has not finished one yet.
+*/
+static double ledger_rate(uint64_t pid)
+{
+	double secs = 0.0;
+	int done = 0;
+
+	for(int i = 0; i < ledger_hdr->count; ++i){
+		uint64_t owner = __atomic_load_n(&ledger_ent[i].owner, __ATOMIC_ACQUIRE);
+		if((owner & 3) == LK_DONE && (owner >> 2) == pid){
+			secs += ledger_ent[i].secs;
+			done++;
+		}
+	}
+
+	return done ? secs / done : 0.0;
+}
+
+
+/* Count how many more K the other live processes would finish, after their
+   current one, in the time this process takes to finish one at my_rate.
+*/
+static int ledger_faster(uint64_t pid, double my_rate)
+{
+	int faster = 0;
+	uint64_t now = (uint64_t)time(NULL);
+
+	for(int i = 0; i < ledger_hdr->count; ++i){
+		ledger_ent_t *e = &ledger_ent[i];
+		uint64_t owner = __atomic_load_n(&e->owner, __ATOMIC_ACQUIRE);
+
+		if((owner & 3) != LK_CLAIMED || (owner >> 2) == pid || !pid_alive((int)(owner >> 2))) continue;
+
+		double rate = ledger_rate(owner >> 2);
+		if(rate <= 0.0) continue;
+
+		double left = rate - (double)(now - e->claimed);
+		if(left < 0.0) left = 0.0;
+
+		if(left + rate < my_rate) faster += (int)((my_rate - left) / rate);
+	}
+
+	return faster;
+}
+
+
+/* Claim the lowest K that is free or held by a dead process.
+   Returns 0 if every K is done or claimed by a live process, or if the K
+   that are left would be finished sooner by faster processes.
+*/
+int LedgerClaim(int *K)
+{
+	uint64_t pid = (uint64_t)getpid();
+	int i, left = 0;
+
+	for(i = 0; i < ledger_hdr->count; ++i){
+		uint64_t owner = __atomic_load_n(&ledger_ent[i].owner, __ATOMIC_ACQUIRE);
+		if((owner & 3) == LK_FREE || ((owner & 3) == LK_CLAIMED && !pid_alive((int)(owner >> 2)))) left++;
+	}
+
+	if(left == 0) return 0;
+
+	double my_rate = ledger_rate(pid);
+	if(my_rate > 0.0 && left <= ledger_faster(pid, my_rate)){
+		fprintf(stderr,"Leaving the last %d K to faster processes\n", left);
+		if(boinc_is_standalone()){
+			printf("Leaving the last %d K to faster processes\n", left);
+		}
+		return 0;
+	}
+
+	for(i = 0; i < ledger_hdr->count; ++i){
+		ledger_ent_t *e = &ledger_ent[i];
+		uint64_t owner = __atomic_load_n(&e->owner, __ATOMIC_ACQUIRE);
+		int state = owner & 3;
+		int dead = (state == LK_CLAIMED && !pid_alive((int)(owner >> 2)));
+
+		if(state != LK_FREE && !dead) continue;
+
+		if(__atomic_compare_exchange_n(&e->owner, &owner, (pid << 2) | LK_CLAIMED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+			e->claimed = (uint64_t)time(NULL);
+			*K = e->K;
+
+			if(dead){
+				fprintf(stderr,"Reclaimed K %d from process %d\n", e->K, (int)(owner >> 2));
+				if(boinc_is_standalone()){
+					printf("Reclaimed K %d from process %d\n", e->K, (int)(owner >> 2));
+				}
+			}
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Append the K's solutions to the results file and mark it done.
+*/
+void LedgerComplete(int K, uint32_t k_cksum, uint32_t k_aps, sol_t *sol, int nsol)
+{
+	ledger_ent_t *e = NULL;
+	uint64_t mine = ((uint64_t)getpid() << 2) | LK_CLAIMED;
+
+	// the OpenCL app completes a K while it searches the next one, so a process can hold two
+	for(int i = 0; i < ledger_hdr->count; ++i){
+		if(ledger_ent[i].K == K && __atomic_load_n(&ledger_ent[i].owner, __ATOMIC_ACQUIRE) == mine){
+			e = &ledger_ent[i];
+			break;
+		}
+	}
+	if(e == NULL){
+		fprintf(stderr,"Error: K %d is not claimed by this process in the ledger\n", K);
+		printf("Error: K %d is not claimed by this process in the ledger\n", K);
+		exit(EXIT_FAILURE);
+	}
+
+	ledger_lock(LOCK_EX);
+
+	if(nsol){
+		FILE *res_file = my_fopen(RESULTS_FILENAME,"a");
+
+		if (res_file == NULL){
+			fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+			exit(EXIT_FAILURE);
+		}
+
+		for(int i = 0; i < nsol; ++i){
+			if(boinc_is_standalone()){
+				printf("Solution: %d %d %" PRId64 "\n",sol[i].AP_Length,K,sol[i].First_Term);
+			}
+			if (fprintf(res_file,"%d %d %" PRId64 "\n",sol[i].AP_Length,K,sol[i].First_Term)<0){
+				fprintf(stderr,"Cannot write to %s !!!\n",RESULTS_FILENAME);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		fclose(res_file);
+	}
+
+	e->cksum = k_cksum;
+	e->aps = k_aps;
+	e->secs = (uint32_t)((uint64_t)time(NULL) - e->claimed);
+	e->nsol = nsol;
+	__atomic_store_n(&e->owner, ((uint64_t)getpid() << 2) | LK_DONE, __ATOMIC_RELEASE);
+	ledger_lock(LOCK_UN);
+}
+
+
+typedef struct _ledger_sol_t {
+	uint64_t First_Term;
+	int K, AP_Length;
+	int line;		// position in the results file
+} ledger_sol_t;
+
+
+static int ledger_sol_compare(const void *a, const void *b)
+{
+	const ledger_sol_t *x = (const ledger_sol_t *)a;
+	const ledger_sol_t *y = (const ledger_sol_t *)b;
+
+	if(x->K != y->K)
+		return x->K - y->K;
+
+	return x->line - y->line;
+}
+
+
+// solution lines written by the process that completed K
+static int ledger_nsol(int K)
+{
+	int lo = 0, hi = ledger_hdr->count - 1;
+
+	while(lo <= hi){
+		int mid = (lo + hi) / 2;
+		if(ledger_ent[mid].K == K) return ledger_ent[mid].nsol;
+		if(ledger_ent[mid].K < K) lo = mid + 1;
+		else hi = mid - 1;
+	}
+
+	return 0;
+}
+
+
+/* Sort the results file into K order.  Each K's solutions keep the order
+   they were written in, so the file is the same as one process searching
+   the whole range.  A process that died after writing its solutions but
+   before marking the K done leaves an earlier copy of them, only the last
+   nsol lines of each K, written by the process that completed it, are kept.
+*/
+static void sort_results()
+{
+	char name[512], tmp[512 + 4];
+	ledger_sol_t *sol = NULL;
+	int count = 0, size = 0;
+	ledger_sol_t s;
+
+	boinc_resolve_filename(RESULTS_FILENAME, name, sizeof(name));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+	FILE *in = boinc_fopen(name, "r");
+	if(in == NULL){
+		fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+		exit(EXIT_FAILURE);
+	}
+
+	while(fscanf(in, "%d %d %" SCNd64, &s.AP_Length, &s.K, (int64_t*)&s.First_Term) == 3){
+		if(count == size){
+			size = (size) ? size * 2 : 64;
+			sol = (ledger_sol_t*)realloc(sol, size * sizeof(ledger_sol_t));
+			if(sol == NULL){
+				fprintf(stderr,"Error: solution buffer allocation failed\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		s.line = count;
+		sol[count++] = s;
+	}
+	fclose(in);
+
+	qsort(sol, count, sizeof(ledger_sol_t), ledger_sol_compare);
+
+	FILE *out = boinc_fopen(tmp, "w");
+	if(out == NULL){
+		fprintf(stderr,"Cannot open %s !!!\n",tmp);
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0, first = 0; i < count; ++i){
+		if(i == 0 || sol[i].K != sol[i-1].K){
+			int n = 0;
+			while(i + n < count && sol[i + n].K == sol[i].K) ++n;
+			first = i + n - ledger_nsol(sol[i].K);
+		}
+		if(i < first) continue;
+		if (fprintf(out,"%d %d %" PRId64 "\n",sol[i].AP_Length,sol[i].K,sol[i].First_Term)<0){
+			fprintf(stderr,"Cannot write to %s !!!\n",tmp);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(fclose(out) || boinc_rename(tmp, name)){
+		fprintf(stderr,"Cannot write to %s !!!\n",RESULTS_FILENAME);
+		exit(EXIT_FAILURE);
+	}
+
+	free(sol);
+}
+
+
+/* If every K is done and no other process got here first, sort the results
+   file and append the checksum.  Returns 1 if this process did that.
+*/
+int LedgerFinish()
+{
+	int i, done = 1;
+
+	ledger_lock(LOCK_EX);
+
+	for(i = 0; i < ledger_hdr->count && done; ++i){
+		done = ((__atomic_load_n(&ledger_ent[i].owner, __ATOMIC_ACQUIRE) & 3) == LK_DONE);
+	}
+
+	if(done && !ledger_hdr->finalized){
+
+		cksum = 0;
+		totalaps = 0;
+		for(i = 0; i < ledger_hdr->count; ++i){
+			uint64_t total = cksum;
+			total += ledger_ent[i].cksum;
+			if(total > MAXINTV){
+				total -= MAXINTV;
+			}
+			cksum = total;
+			totalaps += ledger_ent[i].aps;
+		}
+
+		sort_results();
+		write_cksum();
+
+		ledger_hdr->finalized = 1;
+		msync(ledger_hdr, ledger_size, MS_SYNC);
+	}
+	else{
+		done = 0;
+	}
+
+	ledger_lock(LOCK_UN);
+
+	munmap(ledger_hdr, ledger_size);
+	close(ledger_fd);
+
+	return done;
+}
+
+#else
+
+static void no_ledger()
+{
+	fprintf(stderr,"Error: ledger mode is not supported on Windows\n");
+	printf("Error: ledger mode is not supported on Windows\n");
+	exit(EXIT_FAILURE);
+}
+
+void LedgerOpen(const char *path, int KMIN, int KMAX, int SHIFT){ no_ledger(); }
+int LedgerClaim(int *K){ return 0; }
+void LedgerComplete(int K, uint32_t k_cksum, uint32_t k_aps, sol_t *sol, int nsol){}
+int LedgerFinish(){ return 0; }
+
+#endif
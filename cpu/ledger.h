@@ -0,0 +1,28 @@
+// ledger.h
+// shared ledger mode, linked into both the CPU and OpenCL apps
+
+#ifndef LEDGER_H
+#define LEDGER_H
+
+typedef struct _sol_t {
+	uint64_t First_Term;
+	int AP_Length;
+} sol_t;
+
+// located in ledger.cpp
+extern void LedgerOpen(const char *path, int KMIN, int KMAX, int SHIFT);
+extern int LedgerClaim(int *K);
+extern void LedgerComplete(int K, uint32_t k_cksum, uint32_t k_aps, sol_t *sol, int nsol);
+extern int LedgerFinish();
+
+// located in the app's AP26.cpp
+#ifndef RESULTS_FILENAME
+#define RESULTS_FILENAME "SOL-AP26.txt"
+#endif
+extern FILE *my_fopen(const char *filename, const char *mode);
+extern void write_cksum();
+extern int will_search(int K);
+extern uint32_t totalaps;
+extern uint32_t cksum;
+
+#endif
@@ -1,10 +1,23 @@
 // mainconst.h
 
-extern void Search_avx512(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
-extern void Search_avx2(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
-extern void Search_avx(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
-extern void Search_sse41(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
-extern void Search_sse2(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
+#include "search.h"
+#include "stats.h"
+
+// located in coord.cpp
+extern void Coordinator(const char *addr, int K, int KMAX, int SHIFT, int K_COUNT, int K_DONE, int lease_secs);
+extern int WorkerConnect(const char *addr);
+extern int WorkerGetLease(int fd, int *K, int *SHIFT);
+extern void WorkerSendResult(int fd, int K, uint32_t k_cksum, uint32_t k_aps, sol_t *sol, int nsol);
+
+// located in AP26.cpp
+extern void QueueSolution(int AP_Length, int difference, uint64_t First_Term);
+extern void checkpoint(int SHIFT, int K, int force);
+extern void Search(int K, int SHIFT, int K_COUNT, int K_DONE, int num_threads);
+extern sol_t *k_sol;
+extern int k_nsol;
+
+// located in bench.cpp
+extern int Bench(int argc, char *argv[]);
 
 #define numn43s	10840
 
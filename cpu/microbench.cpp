@@ -0,0 +1,288 @@
+/* microbench.cpp --
+
+	Component micro-benchmarks, run with the bench target's -micro option.
+	Times the primitives the search is built on with synthetic inputs and
+	reports TSC cycles per operation, so a change can be traced to the
+	stage it sped up:
+
+	  REM(_N,_P,_S) against % by a constant and by a runtime divisor
+	  montMul, PrimeQ, and mont_init with strong_prp
+	  MAKE_OK and MAKE_OKOK, and one n59 through the OKOK AND chain, per ISA
+	  the 7 to 23 divisions and OK281 to OK541 cascade of check_n
+
+*/
+
+#include <x86intrin.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+
+#include "cpuconst.h"
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+#define MICRO_REM_N 1000000
+#define MICRO_MONT_N 10000000
+#define MICRO_PRP_N 200000
+#define MICRO_CHECK_N 2000000
+
+// a K and SHIFT from the reference ranges for the tables
+#define MICRO_K 366384
+#define MICRO_SHIFT 0
+
+volatile uint64_t micro_sink;
+
+// the OKOK primes as runtime values, so % can't be strength reduced
+static uint32_t div_primes[NUM_OKOK_PRIMES];
+
+
+static uint64_t xorshift(uint64_t &s)
+{
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return s;
+}
+
+
+#define MICRO_PRIME(_P,_S) div_primes[i++] = _P;
+#define MICRO_REM(_P,_S) sum += REM(n,_P,_S);
+#define MICRO_MODC(_P,_S) sum += n % _P;
+
+
+// n59 sized inputs, below 2^48 as REM requires for the 9 bit primes
+static void time_rem(double *rem, double *modc, double *modv)
+{
+	uint64_t *in = (uint64_t*)malloc(MICRO_REM_N * sizeof(uint64_t));
+	if(in == NULL){
+		fprintf(stderr,"Error: micro-benchmark allocation failed\n");
+		printf("Error: micro-benchmark allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t s = 88172645463325252ULL;
+	for(int r = 0; r < MICRO_REM_N; ++r){
+		in[r] = xorshift(s) % MOD;
+	}
+
+	int i = 0;
+	OKOK_PRIMES(MICRO_PRIME)
+
+	uint64_t sum = 0;
+	uint64_t t = __rdtsc();
+	for(int r = 0; r < MICRO_REM_N; ++r){
+		uint64_t n = in[r];
+		OKOK_PRIMES(MICRO_REM)
+	}
+	*rem = (double)(__rdtsc() - t) / ((double)MICRO_REM_N * NUM_OKOK_PRIMES);
+
+	t = __rdtsc();
+	for(int r = 0; r < MICRO_REM_N; ++r){
+		uint64_t n = in[r];
+		OKOK_PRIMES(MICRO_MODC)
+	}
+	*modc = (double)(__rdtsc() - t) / ((double)MICRO_REM_N * NUM_OKOK_PRIMES);
+
+	t = __rdtsc();
+	for(int r = 0; r < MICRO_REM_N; ++r){
+		uint64_t n = in[r];
+		for(i = 0; i < NUM_OKOK_PRIMES; ++i){
+			sum += n % div_primes[i];
+		}
+	}
+	*modv = (double)(__rdtsc() - t) / ((double)MICRO_REM_N * NUM_OKOK_PRIMES);
+
+	micro_sink += sum;
+
+	free(in);
+}
+
+
+// AP term sized odd inputs, about 2^57
+static uint64_t prp_input(uint64_t &s)
+{
+	return ((xorshift(s) >> 7) | (UINT64_C(1) << 56)) | 1;
+}
+
+
+static void time_prp(double *mont, double *primeq, double *sprp)
+{
+	uint64_t s = 2463534242ULL;
+	uint64_t N = prp_input(s);
+	uint64_t q = invert(N);
+	uint64_t a = N >> 1, b = N >> 2;
+	int mismatch = 0;
+
+	// dependent chain, the latency the exponentiation sees
+	uint64_t t = __rdtsc();
+	for(int r = 0; r < MICRO_MONT_N; ++r){
+		a = montMul(a, b, N, q);
+	}
+	*mont = (double)(__rdtsc() - t) / MICRO_MONT_N;
+	micro_sink += a;
+
+	uint64_t *in = (uint64_t*)malloc(MICRO_PRP_N * sizeof(uint64_t));
+	char *res = (char*)malloc(MICRO_PRP_N);
+	if(in == NULL || res == NULL){
+		fprintf(stderr,"Error: micro-benchmark allocation failed\n");
+		printf("Error: micro-benchmark allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int r = 0; r < MICRO_PRP_N; ++r){
+		in[r] = prp_input(s);
+	}
+
+	t = __rdtsc();
+	for(int r = 0; r < MICRO_PRP_N; ++r){
+		res[r] = PrimeQ(in[r]);
+	}
+	*primeq = (double)(__rdtsc() - t) / MICRO_PRP_N;
+
+	t = __rdtsc();
+	for(int r = 0; r < MICRO_PRP_N; ++r){
+		int tt;
+		uint64_t curBit, exp, nmo, qq, one, r2;
+		mont_init(in[r], tt, curBit, exp, nmo, qq, one, r2);
+		if(strong_prp(2, in[r], tt, curBit, exp, nmo, qq, one, r2) != (bool)res[r]){
+			mismatch++;
+		}
+	}
+	*sprp = (double)(__rdtsc() - t) / MICRO_PRP_N;
+
+	if(mismatch){
+		fprintf(stderr,"Error: PrimeQ and strong_prp disagree on %d inputs\n", mismatch);
+		printf("Error: PrimeQ and strong_prp disagree on %d inputs\n", mismatch);
+		exit(EXIT_FAILURE);
+	}
+
+	free(in);
+	free(res);
+}
+
+
+#define MICRO_CASCADE(_X) if(!OK##_X[n%_X]) continue;
+
+/* The part of check_n before the PRP tests, on n below 640*MOD.
+   Needs the OK tables set up by one of the Micro_ functions.
+*/
+static void time_check(double *check, double *pass)
+{
+	uint64_t *in = (uint64_t*)malloc(MICRO_CHECK_N * sizeof(uint64_t));
+	if(in == NULL){
+		fprintf(stderr,"Error: micro-benchmark allocation failed\n");
+		printf("Error: micro-benchmark allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t s = 1181783497276652981ULL;
+	for(int r = 0; r < MICRO_CHECK_N; ++r){
+		in[r] = xorshift(s) % (640*MOD);
+	}
+
+	int count = 0;
+	uint64_t t = __rdtsc();
+	for(int r = 0; r < MICRO_CHECK_N; ++r){
+		uint64_t n = in[r];
+		if(!(n%7 && n%11 && n%13 && n%17 && n%19 && n%23)) continue;
+		MICRO_CASCADE(281) MICRO_CASCADE(283) MICRO_CASCADE(293) MICRO_CASCADE(307)
+		MICRO_CASCADE(311) MICRO_CASCADE(313) MICRO_CASCADE(317) MICRO_CASCADE(331)
+		MICRO_CASCADE(337) MICRO_CASCADE(347) MICRO_CASCADE(349) MICRO_CASCADE(353)
+		MICRO_CASCADE(359) MICRO_CASCADE(367) MICRO_CASCADE(373) MICRO_CASCADE(379)
+		MICRO_CASCADE(383) MICRO_CASCADE(389) MICRO_CASCADE(397) MICRO_CASCADE(401)
+		MICRO_CASCADE(409) MICRO_CASCADE(419) MICRO_CASCADE(421) MICRO_CASCADE(431)
+		MICRO_CASCADE(433) MICRO_CASCADE(439) MICRO_CASCADE(443) MICRO_CASCADE(449)
+		MICRO_CASCADE(457) MICRO_CASCADE(461) MICRO_CASCADE(463) MICRO_CASCADE(467)
+		MICRO_CASCADE(479) MICRO_CASCADE(487) MICRO_CASCADE(491) MICRO_CASCADE(499)
+		MICRO_CASCADE(503) MICRO_CASCADE(509) MICRO_CASCADE(521) MICRO_CASCADE(523)
+		MICRO_CASCADE(541)
+		count++;
+	}
+	*check = (double)(__rdtsc() - t) / MICRO_CHECK_N;
+	*pass = (double)count / MICRO_CHECK_N;
+
+	micro_sink += count;
+
+	free(in);
+}
+
+
+int Microbench(int num_isa, const int *use_isa, const char * const *isa_names, const char *out_name)
+{
+	double rem, modc, modv, mont, primeq, sprp, check, pass;
+
+	printf("Component micro-benchmarks, TSC cycles per operation\n");
+
+	FILE *out = fopen(out_name, "w");
+	if(out == NULL){
+		printf("ERROR: cannot open %s\n", out_name);
+		fprintf(stderr, "ERROR: cannot open %s\n", out_name);
+		exit(EXIT_FAILURE);
+	}
+
+	time_rem(&rem, &modc, &modv);
+	printf("REM macro:             %8.2f per remainder\n", rem);
+	printf("%% constant divisor:    %8.2f per remainder\n", modc);
+	printf("%% runtime divisor:     %8.2f per remainder\n", modv);
+
+	time_prp(&mont, &primeq, &sprp);
+	printf("montMul:               %8.2f per multiply\n", mont);
+	printf("PrimeQ:                %8.0f per test\n", primeq);
+	printf("mont_init+strong_prp:  %8.0f per test\n", sprp);
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"version\": \"%s\",\n", VERS);
+	fprintf(out, "  \"rem\": %.2f, \"mod_const\": %.2f, \"mod_runtime\": %.2f,\n", rem, modc, modv);
+	fprintf(out, "  \"montmul\": %.2f, \"primeq\": %.0f, \"strong_prp\": %.0f,\n", mont, primeq, sprp);
+	fprintf(out, "  \"isa\": [");
+
+	int first = 1;
+	int ran = 0;
+	for(int isa = 0; isa < num_isa; ++isa){
+		if(!use_isa[isa]) continue;
+
+		micro_t m;
+
+		switch(isa){
+			case 0: Micro_sse2(MICRO_K, MICRO_SHIFT, &m); break;
+			case 1: Micro_sse41(MICRO_K, MICRO_SHIFT, &m); break;
+			case 2: Micro_avx(MICRO_K, MICRO_SHIFT, &m); break;
+			case 3: Micro_avx2(MICRO_K, MICRO_SHIFT, &m); break;
+			case 4: Micro_avx512(MICRO_K, MICRO_SHIFT, &m); break;
+		}
+
+		// passes of the chain per n59 to cover the 10 SHIFTs
+		int passes = (640 + m.sito_shifts - 1) / m.sito_shifts;
+		double per_n59 = m.sito * passes;
+
+		printf("%-7s MAKE_OK %.0f per table, MAKE_OKOK %.0f per table, AND chain %.1f per pass of %d SHIFTs, %.1f per n59\n",
+			isa_names[isa], m.make_ok, m.make_okok, m.sito, m.sito_shifts, per_n59);
+
+		fprintf(out, "%s\n    {\"isa\": \"%s\", \"make_ok\": %.0f, \"make_okok\": %.0f, \"sito_pass\": %.2f, \"sito_shifts\": %d, \"sito_n59\": %.2f}",
+			first ? "" : ",", isa_names[isa], m.make_ok, m.make_okok, m.sito, m.sito_shifts, per_n59);
+		first = 0;
+		ran = 1;
+	}
+
+	if(!ran){
+		micro_t m;
+		Micro_sse2(MICRO_K, MICRO_SHIFT, &m);
+	}
+
+	fprintf(out, "\n  ],\n");
+
+	// the OK tables were set up for MICRO_K by the Micro_ functions
+	time_check(&check, &pass);
+	printf("check_n 7-23, OK281-OK541: %.2f per n, %.4f%% pass\n", check, pass*100.0);
+
+	fprintf(out, "  \"check_n\": %.2f, \"check_n_pass\": %.6f\n", check, pass);
+	fprintf(out, "}\n");
+	fclose(out);
+
+	printf("Results written to %s\n", out_name);
+
+	return EXIT_SUCCESS;
+}
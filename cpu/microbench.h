@@ -0,0 +1,54 @@
+// microbench.h
+// component micro-benchmarks, built into the bench target, see microbench.cpp
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+// table setup and sieve chain timings of one instruction set, in TSC cycles
+typedef struct _micro_t {
+	double make_ok;		// per MAKE_OK table
+	double make_okok;	// per MAKE_OKOK table
+	double sito;		// per n59 through the OKOK AND chain, all tables, no early exit
+	int sito_shifts;	// SHIFTs covered by one pass of the chain
+} micro_t;
+
+#define MICRO_TABLE_REPS 20
+#define MICRO_N59 2000000
+
+// primes with OK tables
+#define NUM_OK_PRIMES 83
+#define OK_PRIMES(_F) \
+  _F(61) _F(67) _F(71) _F(73) _F(79) _F(83) _F(89) _F(97) _F(101) _F(103) \
+  _F(107) _F(109) _F(113) _F(127) _F(131) _F(137) _F(139) _F(149) _F(151) _F(157) \
+  _F(163) _F(167) _F(173) _F(179) _F(181) _F(191) _F(193) _F(197) _F(199) _F(211) \
+  _F(223) _F(227) _F(229) _F(233) _F(239) _F(241) _F(251) _F(257) _F(263) _F(269) \
+  _F(271) _F(277) _F(281) _F(283) _F(293) _F(307) _F(311) _F(313) _F(317) _F(331) \
+  _F(337) _F(347) _F(349) _F(353) _F(359) _F(367) _F(373) _F(379) _F(383) _F(389) \
+  _F(397) _F(401) _F(409) _F(419) _F(421) _F(431) _F(433) _F(439) _F(443) _F(449) \
+  _F(457) _F(461) _F(463) _F(467) _F(479) _F(487) _F(491) _F(499) _F(503) _F(509) \
+  _F(521) _F(523) _F(541)
+
+// primes with OKOK tables, and the REM shift for each
+#define NUM_OKOK_PRIMES 42
+#define OKOK_PRIMES(_F) \
+  _F(61,6) _F(67,7) _F(71,7) _F(73,7) _F(79,7) _F(83,7) _F(89,7) _F(97,7) \
+  _F(101,7) _F(103,7) _F(107,7) _F(109,7) _F(113,7) _F(127,7) _F(131,8) _F(137,8) \
+  _F(139,8) _F(149,8) _F(151,8) _F(157,8) _F(163,8) _F(167,8) _F(173,8) _F(179,8) \
+  _F(181,8) _F(191,8) _F(193,8) _F(197,8) _F(199,8) _F(211,8) _F(223,8) _F(227,8) \
+  _F(229,8) _F(233,8) _F(239,8) _F(241,8) _F(251,8) _F(257,9) _F(263,9) _F(269,9) \
+  _F(271,9) _F(277,9)
+
+// keeps the timed loops from being optimized away
+extern volatile uint64_t micro_sink;
+
+// located in microbench.cpp
+extern int Microbench(int num_isa, const int *use_isa, const char * const *isa_names, const char *out_name);
+
+// located in the cpu*.cpp files
+extern void Micro_avx512(int K, int SHIFT, micro_t *m);
+extern void Micro_avx2(int K, int SHIFT, micro_t *m);
+extern void Micro_avx(int K, int SHIFT, micro_t *m);
+extern void Micro_sse41(int K, int SHIFT, micro_t *m);
+extern void Micro_sse2(int K, int SHIFT, micro_t *m);
+
+#endif
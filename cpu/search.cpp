@@ -0,0 +1,352 @@
+/* search.cpp --
+
+	The CPU search of one K, linked into the CPU app and into the OpenCL
+	app, where -cpu searches part of each K on the CPU cores.  Holds the
+	base 2 PRP test, the n43 range and solution buffers the Search_
+	functions of the cpu*.cpp files share, and the instruction set choice.
+
+*/
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+
+#include "boinc_api.h"
+
+#include "mainconst.h"
+
+#define EXIT_FAILURE 1
+
+/* Global variables */
+int sse41, avx, avx2, avx512;
+uint64_t *n43_h;
+
+
+/////////////////////////////
+// main lock for search data
+// the Search_ functions search n43_h[n43_start] to n43_h[n43_stop-1],
+// threads take thread_range n43 at a time from current_n43
+int current_n43;
+int n43_start = 0, n43_stop = numn43s;
+pthread_mutex_t lock1 = PTHREAD_MUTEX_INITIALIZER;
+/////////////////////////////
+
+// thread 0 reports progress and the time of each K, off when the OpenCL
+// app reports them
+int search_report = 1;
+
+sol_buf_t *sol_bufs = NULL;
+
+// per thread search counters, see stats.h
+stats_t *stats = NULL;
+
+
+/*
+	tests primality of each term of the AP sequence
+	test is good to 2^64-1
+*/
+
+
+uint64_t invert(uint64_t p)
+{
+	uint64_t p_inv = 1, prev = 0;
+	while (p_inv != prev) { prev = p_inv; p_inv *= 2 - p * p_inv; }
+	return p_inv;
+}
+
+
+uint64_t montMul(uint64_t a, uint64_t b, uint64_t p, uint64_t q)
+{
+	unsigned __int128 res;
+
+	res  = (unsigned __int128)a * b;
+	uint64_t ab0 = (uint64_t)res;
+	uint64_t ab1 = res >> 64;
+
+	uint64_t m = ab0 * q;
+
+	res = (unsigned __int128)m * p;
+	uint64_t mp = res >> 64;
+
+	uint64_t r = ab1 - mp;
+
+	return ( ab1 < mp ) ? r + p : r;
+}
+
+
+static uint64_t add(uint64_t a, uint64_t b, uint64_t p)
+{
+	uint64_t r;
+
+	uint64_t c = (a >= p - b) ? p : 0;
+
+	r = a + b - c;
+
+	return r;
+}
+
+
+// initialize montgomery constants
+void mont_init(uint64_t N, int & t, uint64_t & curBit, uint64_t & exp, uint64_t & nmo, uint64_t & q, uint64_t & one, uint64_t & r2){
+
+	nmo = N-1;
+	t = __builtin_ctzll(nmo);
+	exp = N >> t;
+	curBit = 0x8000000000000000;
+	curBit >>= ( __builtin_clzll(exp) + 1 );
+	q = invert(N);
+	one = (-N) % N;
+	nmo = N - one;
+	uint64_t two = add(one, one, N);
+	r2 = add(two, two, N);
+	for (int i = 0; i < 5; ++i)
+		r2 = montMul(r2, r2, N, q);	// 4^{2^5} = 2^64
+
+}
+
+
+bool strong_prp(int base, uint64_t N, int t, uint64_t curBit, uint64_t exp, uint64_t nmo, uint64_t q, uint64_t one, uint64_t r2)
+{
+
+	/* If N is prime and N = d*2^t+1, where d is odd, then either
+		1.  a^d = 1 (mod N), or
+		2.  a^(d*2^s) = -1 (mod N) for some s in 0 <= s < t    */
+
+
+	uint64_t a = base;
+	uint64_t mbase = montMul(a,r2,N,q);  // convert base to montgomery form
+
+	a = mbase;
+
+  	/* r <-- a^d mod N, assuming d odd */
+	while( curBit )
+	{
+		a = montMul(a,a,N,q);
+
+		if(exp & curBit){
+			a = montMul(a,mbase,N,q);
+		}
+
+		curBit >>= 1;
+	}
+
+	/* Clause 1. and s = 0 case for clause 2. */
+	if (a == one || a == nmo){
+		return true;
+	}
+
+	/* 0 < s < t cases for clause 2. */
+	for (int s = 1; s < t; ++s){
+
+		a = montMul(a,a,N,q);
+
+		if(a == nmo){
+	    	return true;
+		}
+	}
+
+
+	return false;
+}
+
+
+// strong probable prime to base 2
+bool PrimeQ(uint64_t N)
+{
+	uint64_t nmo = N-1;
+	int t = __builtin_ctzll(nmo);
+	uint64_t exp = N >> t;
+	uint64_t curBit = 0x8000000000000000;
+	curBit >>= ( __builtin_clzll(exp) + 1 );
+	uint64_t q = invert(N);
+	uint64_t one = (-N) % N;
+	nmo = N - one;
+	uint64_t two = add(one, one, N);
+	
+	uint64_t a = two;
+
+	/* If N is prime and N = d*2^t+1, where d is odd, then either
+		1.  a^d = 1 (mod N), or
+		2.  a^(d*2^s) = -1 (mod N) for some s in 0 <= s < t    */
+
+  	/* r <-- a^d mod N, assuming d odd */
+	while( curBit )
+	{
+		a = montMul(a,a,N,q);
+
+		if(exp & curBit){
+			a = add(a,a,N);
+		}
+
+		curBit >>= 1;
+	}
+
+	/* Clause 1. and s = 0 case for clause 2. */
+	if (a == one || a == nmo){
+		return true;
+	}
+
+	/* 0 < s < t cases for clause 2. */
+	for (int s = 1; s < t; ++s){
+
+		a = montMul(a,a,N,q);
+
+		if(a == nmo){
+	    	return true;
+		}
+	}
+
+	return false;
+}
+
+
+void ckerr(int err){
+	if(err){
+		fprintf(stderr, "ERROR: pthreads, code: %d\n", err);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int boinc_standalone()
+{
+	return boinc_is_standalone();
+}
+
+
+void AppendSolution(sol_t **sol, int *count, int *size, int AP_Length, uint64_t First_Term)
+{
+	if(*count == *size){
+		*size = (*size) ? *size * 2 : 64;
+		*sol = (sol_t*)realloc(*sol, *size * sizeof(sol_t));
+		if(*sol == NULL){
+			fprintf(stderr,"Error: solution buffer allocation failed\n");
+			printf("Error: solution buffer allocation failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	(*sol)[*count].First_Term = First_Term;
+	(*sol)[*count].AP_Length = AP_Length;
+	(*count)++;
+}
+
+
+/* Called by search thread id for each AP10+ it finds.
+   Only that thread touches its buffer until main merges it.
+*/
+void RecordSolution(int id, int AP_Length, uint64_t First_Term)
+{
+	AppendSolution(&sol_bufs[id].sol, &sol_bufs[id].count, &sol_bufs[id].size, AP_Length, First_Term);
+}
+
+
+// pick the highest instruction set the CPU supports
+void detect_isa()
+{
+	sse41 = __builtin_cpu_supports("sse4.1");
+	avx = __builtin_cpu_supports("avx");
+	avx2 = __builtin_cpu_supports("avx2");
+	avx512 = __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+
+	if(avx512){
+		if(boinc_is_standalone()){
+			printf("Detected avx512 CPU\n");
+		}
+		fprintf(stderr, "Detected avx512 CPU\n");
+	}
+	else if(avx2){
+		if(boinc_is_standalone()){
+			printf("Detected avx2 CPU\n");
+		}
+		fprintf(stderr, "Detected avx2 CPU\n");
+	}
+	else if(avx){
+		if(boinc_is_standalone()){
+			printf("Detected avx CPU\n");
+		}
+		fprintf(stderr, "Detected avx CPU\n");
+	}
+	else if(sse41){
+		if(boinc_is_standalone()){
+			printf("Detected sse4.1 CPU\n");
+		}
+		fprintf(stderr, "Detected sse4.1 CPU\n");
+	}
+	else{
+		if(boinc_is_standalone()){
+			printf("Assumed sse2 CPU\n");
+		}
+		fprintf(stderr, "Assumed sse2 CPU\n");
+	}
+}
+
+
+/* Allocate the n43 array, the per thread solution buffers and counters.
+ */
+void alloc_thread_bufs(int num_threads)
+{
+	n43_h = (uint64_t*)malloc(numn43s * sizeof(uint64_t));
+	sol_bufs = (sol_buf_t*)calloc(num_threads, sizeof(sol_buf_t));
+	stats = (stats_t*)calloc(num_threads, sizeof(stats_t));
+	if(n43_h == NULL || sol_bufs == NULL || stats == NULL){
+		fprintf(stderr,"Error: solution buffer allocation failed\n");
+		printf("Error: solution buffer allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+void free_thread_bufs(int num_threads)
+{
+	free(n43_h);
+	for(int i = 0; i < num_threads; ++i){
+		free(sol_bufs[i].sol);
+	}
+	free(sol_bufs);
+	free(stats);
+}
+
+
+/* Search one K with the selected instruction set.  The raw APs are left
+   in sol_bufs.
+ */
+void SearchCPU(int K, int SHIFT, int K_COUNT, int K_DONE, int num_threads)
+{
+	if(avx512){
+		Search_avx512(K, SHIFT, K_COUNT, K_DONE, num_threads);
+	}
+	else if(avx2){
+		Search_avx2(K, SHIFT, K_COUNT, K_DONE, num_threads);
+	}
+	else if(avx){
+		Search_avx(K, SHIFT, K_COUNT, K_DONE, num_threads);
+	}
+	else if(sse41){
+		Search_sse41(K, SHIFT, K_COUNT, K_DONE, num_threads);
+	}
+	else{
+		Search_sse2(K, SHIFT, K_COUNT, K_DONE, num_threads);
+	}
+}
+
+
+/* Move the raw APs of the per thread buffers to sol, which has room for
+   all of them, and return how many there were.  With sol NULL only count.
+ */
+int TakeSolutions(sol_t *sol, int num_threads)
+{
+	int i, count = 0;
+
+	for(i = 0; i < num_threads; ++i){
+		int n = sol_bufs[i].count;
+		if(sol != NULL){
+			memcpy(&sol[count], sol_bufs[i].sol, n * sizeof(sol_t));
+			sol_bufs[i].count = 0;
+		}
+		count += n;
+	}
+
+	return count;
+}
@@ -0,0 +1,51 @@
+// search.h
+// CPU search, linked into the CPU app and the OpenCL app for -cpu, see search.cpp
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "ledger.h"
+
+// per thread solution buffers
+// search threads append raw APs here, the app validates and reports
+// them at the end of each K
+typedef struct _sol_buf_t {
+	sol_t *sol;
+	int count, size;
+	char pad[48];	// one buffer per cache line
+} sol_buf_t;
+
+// located in search.cpp
+extern int sse41, avx, avx2, avx512;
+extern uint64_t *n43_h;
+extern int current_n43, n43_start, n43_stop;
+extern int search_report;
+extern pthread_mutex_t lock1;
+extern sol_buf_t *sol_bufs;
+
+extern uint64_t invert(uint64_t p);
+extern uint64_t montMul(uint64_t a, uint64_t b, uint64_t p, uint64_t q);
+extern void mont_init(uint64_t N, int & t, uint64_t & curBit, uint64_t & exp, uint64_t & nmo, uint64_t & q, uint64_t & one, uint64_t & r2);
+extern bool strong_prp(int base, uint64_t N, int t, uint64_t curBit, uint64_t exp, uint64_t nmo, uint64_t q, uint64_t one, uint64_t r2);
+extern bool PrimeQ(uint64_t N);
+extern void ckerr(int err);
+extern int boinc_standalone(void);
+extern void AppendSolution(sol_t **sol, int *count, int *size, int AP_Length, uint64_t First_Term);
+extern void RecordSolution(int id, int AP_Length, uint64_t First_Term);
+extern void detect_isa();
+extern void alloc_thread_bufs(int num_threads);
+extern void free_thread_bufs(int num_threads);
+extern void SearchCPU(int K, int SHIFT, int K_COUNT, int K_DONE, int num_threads);
+extern int TakeSolutions(sol_t *sol, int num_threads);
+
+// located in the cpu*.cpp files
+extern void Search_avx512(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
+extern void Search_avx2(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
+extern void Search_avx(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
+extern void Search_sse41(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
+extern void Search_sse2(int K, int startSHIFT, int K_COUNT, int K_DONE, int threads);
+
+// located in the app's AP26.cpp
+extern void Progress(double prog);
+
+#endif
@@ -0,0 +1,46 @@
+// stats.h
+// per thread search counters, only counted when built with -DAP26_STATS
+
+#ifndef STATS_H
+#define STATS_H
+
+#define STATS_APLEN 28		// AP length histogram, the last bin holds longer APs too
+
+// the sieve funnel.  a pass is one n59 through one OKOK chain, which covers
+// 128 SHIFTs with sse2 and sse4.1, 256 with avx and avx2, and 512 or 128
+// with avx512's two chains
+typedef struct _stats_t {
+	uint64_t passes;	// chain passes
+	uint64_t sito137;	// passes with bits left after OKOK137
+	uint64_t sito199;	// after OKOK199
+	uint64_t sito277;	// after OKOK277
+	uint64_t survivors;	// bits that reached check_n
+	uint64_t div23;		// n with no factor 7 to 23
+	uint64_t cascade;	// n that passed OK281 to OK541
+	uint64_t prp;		// PrimeQ calls
+	uint64_t aplen[STATS_APLEN];	// AP length found from each n that passed the cascade
+	char pad[32];		// 64 bytes per cache line
+} stats_t;
+
+// located in search.cpp, one per search thread, and in AP26.cpp their sum for the last K
+extern stats_t *stats;
+extern stats_t k_stats;
+
+// located in AP26.cpp, AP26_STATS builds only
+extern void sum_stats(int num_threads);
+
+#ifdef AP26_STATS
+#define STAT_ADD(_ID,_F,_N) (stats[_ID]._F += (_N))
+#else
+#define STAT_ADD(_ID,_F,_N) ((void)0)
+#endif
+
+// PrimeQ(_M), counted for thread _ID
+#define STAT_PRIMEQ(_ID,_M) (STAT_ADD(_ID,prp,1), PrimeQ(_M))
+
+// the condition _C, counted in _F when true
+#define STAT_PASS(_ID,_F,_C) ((_C) ? (STAT_ADD(_ID,_F,1), 1) : 0)
+
+#define STAT_APLEN(_ID,_K) STAT_ADD(_ID, aplen[(_K) < STATS_APLEN ? (_K) : STATS_APLEN-1], 1)
+
+#endif
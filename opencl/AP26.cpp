@@ -6,14 +6,20 @@
 
 
 #include <cinttypes>
+#include <pthread.h>
 
 #include "const.h"
 
 #include "boinc_api.h"
 #include "boinc_opencl.h"
+#include "filesys.h"
 
 #include "simpleCL.h"
 
+// shared ledger and CPU search for -cpu, from the CPU app
+#include "ledger.h"
+#include "search.h"
+
 // ocl kernels
 #include "clearok.h"
 #include "clearokok.h"
@@ -25,12 +31,44 @@
 #include "setupok.h"
 #include "sieve.h"
 #include "sieve_nv.h"
+#include "sieve_lean.h"
+#include "sieve_inc.h"
+#include "sieve_fused.h"
+#include "batch.h"
 
 #define numn59s 137375320
 #define halfn59s 68687660
 #define numn43s	10840
 #define numOK 23693
+#define numOKOK 236930	// 10 words per OK entry, 640 shifts
+#define maxsieve 191739	// largest sieve launch with 32 bit (index, i59, shift bit) candidates
 #define sol 10240
+#define MAXDEPTH 8	// pipeline slots
+#define NUMCOUNTERS 24	// counters per slot, see check_result and kernels/checkn.cl
+#define READCOUNTERS 8	// counters read back per slot
+#define OVF_MAX 16	// overflowed chunks listed per slot
+#define WAVE_FWD 8	// wavefront checkn rounds, the last ones run their APs to the end
+#define WAVE_BACK 4
+#define NUMRES 2	// K results per device, one is validated while the next K is searched
+#define MAXBATCH 8	// K per batch with -batch
+#define KC_WORDS 5	// STEP, S43, S47, S53, S59 of a batch's K, see kernels/batch.cl
+#define TUNE_FILENAME "AP26-tune.txt"
+#define CACHE_DIRNAME "AP26-cache"	// compiled kernel binaries
+
+// sieve kernel variants the autotuner chooses from
+#define VAR_SIEVE 0
+#define VAR_NV 1
+#define VAR_INC 2
+#define VAR_LEAN 3
+#define VAR_CPU 4
+#define NUMVAR 5
+const char *var_names[NUMVAR] = { "sieve", "sieve_nv", "sieve_inc", "sieve_lean", "sieve_cpu" };
+
+// lean variants read n43_d, the others the n59 arrays
+#define LEAN_VAR(v) ((v) == VAR_LEAN || (v) == VAR_CPU)
+
+// primes whose residues sieve_inc steps with S59 mod p
+const uint32_t inc_p[10] = { 61, 67, 71, 73, 79, 83, 89, 97, 101, 103 };
 
 #define EXIT_SUCCESS 0
 #define EXIT_FAILURE 1
@@ -51,32 +89,191 @@ uint32_t cksum;
 uint64_t last_trickle;
 time_t last_ckpt;
 
-sclHard hardware;
-
-sclSoft offset;
-sclSoft checkn;
-sclSoft setupokok;
-sclSoft setupok;
-sclSoft sieve;
-sclSoft setupn;
-sclSoft clearok;
-sclSoft clearokok;
-sclSoft clearn;
-
-uint64_t *n43_h;
-uint64_t *sol_val_h;
-int *sol_k_h;
-int *counter_h;
-cl_mem n_result_d = NULL;
-cl_mem counter_d = NULL;
-cl_mem OKOK_d = NULL;
-cl_mem OK_d = NULL;
-cl_mem offset_d = NULL;
-cl_mem sol_k_d = NULL;
-cl_mem sol_val_d = NULL;
-cl_mem n43_d = NULL;
-cl_mem n59_0_d = NULL;
-cl_mem n59_1_d = NULL;
+/* One K's results.  SearchAP26 reads the counters and solution arrays into
+   pinned host memory without blocking and queues the K for the validation
+   pool, which checks and reports the APs while the device searches the next K.
+*/
+#define RES_FREE 0
+#define RES_QUEUED 1
+#define RES_DONE 2
+
+typedef struct kres_s {
+	int K;
+	int state;
+	int dev_id;
+	int depth;
+	int numn;		// candidate buffer entries per chunk, for the overflow check
+	int secs;
+	cl_mem pin_d;		// CL_MEM_ALLOC_HOST_PTR buffer mapped at pin_h
+	char *pin_h;
+	int *counter_h[MAXDEPTH];
+	int *sol_k_h[MAXDEPTH];
+	uint64_t *sol_val_h[MAXDEPTH];
+	cl_event read_done;
+
+	// zero-copy devices write this K's counters and solutions here, they are
+	// mapped for validation instead of read into pin_h
+	cl_mem counter_d[MAXDEPTH];
+	cl_mem sol_k_d[MAXDEPTH];
+	cl_mem sol_val_d[MAXDEPTH];
+	cl_command_queue queue;
+	int mapped;
+
+	// checksum, AP count and APs to report
+	uint32_t cksum;
+	uint32_t aps;
+	sol_t *k_sol;
+	int k_nsol, k_size;
+
+	// raw APs the -cpu threads found in their n43s, validated with the device's
+	sol_t *cpu_sol;
+	int cpu_nsol, cpu_size;
+
+	struct kres_s *next;
+} kres_t;
+
+// sieve and checkn built with one K's constants, for -kspec
+typedef struct {
+	sclSoft sieve;
+	sclSoft checkn;
+	int K;			// 0 = none
+} kspec_t;
+
+// state of one OpenCL device
+typedef struct {
+	int id;
+	sclHard hardware;
+
+	sclSoft offset;
+	sclSoft checkn;
+	sclSoft setupokok;
+	sclSoft setupok;
+	sclSoft sieve;
+	sclSoft var[NUMVAR];	// compiled sieve variants, until the tuner keeps one
+	int has_var[NUMVAR];
+	int variant;
+	sclSoft setupn;
+	sclSoft clearok;
+	sclSoft clearokok;
+	sclSoft clearn;
+
+	uint64_t *n43_h;
+	// one candidate buffer, counter and solution array per pipeline slot.
+	// the sieve stores ncap candidates per chunk, n_result_d has nbuf entries
+	cl_mem n_result_d[MAXDEPTH];
+	cl_mem counter_d[MAXDEPTH];	// with zerocopy the current K result's buffers
+	cl_mem OKOK_d;
+	cl_mem OK_d;
+	cl_mem offset_d;
+	cl_mem sol_k_d[MAXDEPTH];
+	cl_mem sol_val_d[MAXDEPTH];
+	cl_mem n43_d;
+	cl_mem n59_0_d;
+	cl_mem n59_1_d;
+	cl_mem S59p_d;
+
+	uint32_t numn;
+	int ncap;
+	int nbuf;
+	int profile;
+	int computeunits;
+	int COMPUTE;
+	int progress;		// report BOINC progress from SearchAP26
+	int lean;		// sieve derives n53 from n43_d, no n59 arrays
+	int zerocopy;		// host and device share memory, map n43, counter and solution buffers
+	int cpu;		// CPU device profile, lean sieve with small work-groups and chunks
+	int depth;		// pipeline slots, checkn of one chunk overlaps the sieve of the next
+	sclHard check_hw;	// hardware with a second queue for checkn
+	double wait_us;		// average checkn wait, for -spin
+
+	// wavefront checkn, one AP term per round.  the lists are shared by the
+	// slots, all checkn work is in order on check_hw
+	int wave;
+	sclSoft clearw;
+	sclSoft checkw_first;
+	sclSoft checkw_fwd;
+	sclSoft checkw_back;
+	cl_mem wn_d[2];
+	cl_mem wk_d[2];
+	cl_mem bn_d[2];
+	cl_mem bk_d[2];
+	cl_mem wave_d;
+
+	// tuned sieve setup, keyed by device name, driver and lean mode in TUNE_FILENAME
+	char tune_key[2100];
+	int tuned;
+	size_t tune_local;
+	uint64_t tune_global;
+	int tune_depth;
+	int tune_wave;
+
+	// -kspec kernels.  ks_next is built on ks_thread while the previous K is searched
+	kspec_t ks_cur;
+	kspec_t ks_next;
+	int ks_shift;
+	int ks_running;
+	pthread_t ks_thread;
+
+	// -fused sieve and PRP kernel, fused_range n59s per launch, sized on the first launch
+	int fused;
+	sclSoft fused_k;
+	sclSoft checkspill;
+	cl_mem work_d;
+	int fused_range;
+
+	// -batch, up to batch K searched in one pass over the n59s.  each K has
+	// its segment of the n43, OK, OKOK, candidate, counter and solution buffers
+	int batch;
+	sclSoft clearok_b;
+	sclSoft setupok_b;
+	sclSoft clearokok_b;
+	sclSoft setupokok_b;
+	sclSoft clearn_b;
+	sclSoft sieve_b;
+	sclSoft checkn_b;
+	uint64_t *n43b_h;
+	uint64_t *kc_h;
+	cl_mem kc_d;
+	cl_mem counterb_d[MAXDEPTH];
+	cl_mem sol_kb_d[MAXDEPTH];
+	cl_mem sol_valb_d[MAXDEPTH];
+
+	// -cpu, the device sieves the n43s below cpu_n43 and the CPU threads the
+	// rest.  the split follows the n43 per second each side did on the last K
+	int cpu_n43;
+	int n59_limit;		// end of the lean sieve's n59 range
+	double gpu_rate, cpu_rate;
+
+	// results of the last K searched, being validated, and the one before.
+	// NUMRES batches with -batch
+	kres_t res[NUMRES * MAXBATCH];
+	int numres;
+	int res_next;
+
+	// throughput, for handing out K in multi device mode
+	int kdone;
+	double secs;
+	int curK;
+	int active;
+	time_t started;
+	pthread_t thread;
+} ap26_dev_t;
+
+ap26_dev_t *devs = NULL;
+int num_devs = 0;
+int lean_mode = 0;
+int pipe_depth = 0;	// 0 = tuned
+int wave_mode = -1;	// -1 = tuned
+int retune = 0;
+int use_cache = 1;
+int kspec_mode = 0;
+int fused_mode = 0;
+int spin_mode = 0;
+int val_threads = 2;
+int zerocopy_mode = 1;
+int cpu_threads = 0;	// -cpu, CPU search threads beside the device
+int start_cap = 0;	// -ncap, candidate buffer entries at the start of each K, to test the reruns
+int batch_size = 1;
 
 FILE *results_file = NULL;
 
@@ -113,118 +310,6 @@ void handle_trickle_up(){
 }
 
 
-/*
-	tests primality of each term of the AP sequence
-	test is good to 2^64-1
-*/
-
-
-uint64_t invert(uint64_t p)
-{
-	uint64_t p_inv = 1, prev = 0;
-	while (p_inv != prev) { prev = p_inv; p_inv *= 2 - p * p_inv; }
-	return p_inv;
-}
-
-
-uint64_t montMul(uint64_t a, uint64_t b, uint64_t p, uint64_t q)
-{
-	unsigned __int128 res;
-
-	res  = (unsigned __int128)a * b;
-	uint64_t ab0 = (uint64_t)res;
-	uint64_t ab1 = res >> 64;
-
-	uint64_t m = ab0 * q;
-
-	res = (unsigned __int128)m * p;
-	uint64_t mp = res >> 64;
-
-	uint64_t r = ab1 - mp;
-
-	return ( ab1 < mp ) ? r + p : r;
-}
-
-
-uint64_t add(uint64_t a, uint64_t b, uint64_t p)
-{
-	uint64_t r;
-
-	uint64_t c = (a >= p - b) ? p : 0;
-
-	r = a + b - c;
-
-	return r;
-}
-
-
-// initialize montgomery constants
-void mont_init(uint64_t N, int & t, uint64_t & curBit, uint64_t & exp, uint64_t & nmo, uint64_t & q, uint64_t & one, uint64_t & r2){
-
-
-	nmo = N-1;
-	t = __builtin_ctzll(nmo);
-	exp = N >> t;
-	curBit = 0x8000000000000000;
-	curBit >>= ( __builtin_clzll(exp) + 1 );
-	q = invert(N);
-	one = (-N) % N;
-	nmo = N - one;
-	uint64_t two = add(one, one, N);
-	r2 = add(two, two, N);
-	for (int i = 0; i < 5; ++i)
-		r2 = montMul(r2, r2, N, q);	// 4^{2^5} = 2^64
-
-}
-
-
-bool strong_prp(int base, uint64_t N, int t, uint64_t curBit, uint64_t exp, uint64_t nmo, uint64_t q, uint64_t one, uint64_t r2)
-{
-
-	/* If N is prime and N = d*2^t+1, where d is odd, then either
-		1.  a^d = 1 (mod N), or
-		2.  a^(d*2^s) = -1 (mod N) for some s in 0 <= s < t    */
-
-
-	uint64_t a = base;
-	uint64_t mbase = montMul(a,r2,N,q);  // convert base to montgomery form
-
-	a = mbase;
-
-  	/* r <-- a^d mod N, assuming d odd */
-	while( curBit )
-	{
-		a = montMul(a,a,N,q);
-
-		if(exp & curBit){
-			a = montMul(a,mbase,N,q);
-		}
-
-		curBit >>= 1;
-	}
-
-	/* Clause 1. and s = 0 case for clause 2. */
-	if (a == one || a == nmo){
-		return true;
-	}
-
-	/* 0 < s < t cases for clause 2. */
-	for (int s = 1; s < t; ++s){
-
-		a = montMul(a,a,N,q);
-
-		if(a == nmo){
-	    		return true;
-		}
-	}
-
-
-	return false;
-}
-
-
-
-
 cl_mem sclMalloc( sclHard hardware, cl_int mode, size_t size ){
         cl_mem buffer;
 
@@ -413,6 +498,13 @@ int read_state(int KMIN, int KMAX, int SHIFT, int *K)
 }
 
 
+/*
+	tests primality of each term of the AP sequence
+	test is good to 2^64-1
+	mont_init and strong_prp are shared with the CPU app, see search.cpp
+*/
+
+
 /* 
    Returns index j where:
    0<=j<k ==> f+j*d*23# is composite.
@@ -491,16 +583,16 @@ int validate_ap26(int k, int d, uint64_t f)
 
 
 // GPU does a prp base 2 check only. It will sometimes report an AP with a base 2 probable prime.
-void ReportSolution(int AP_Length,int difference,uint64_t First_Term)
+void ReportSolution(kres_t *res, int AP_Length,int difference,uint64_t First_Term)
 {
 
 	int i;
 
 	/*	add each AP10+ first_term mod 1000 and that AP's length to checksum	*/
-	cksum += First_Term % 1000;
-	cksum += AP_Length;
-	if(cksum > MAXINTV){
-		cksum -= MAXINTV;
+	res->cksum += First_Term % 1000;
+	res->cksum += AP_Length;
+	if(res->cksum > MAXINTV){
+		res->cksum -= MAXINTV;
 	}
 
 	i = validate_ap26(AP_Length,difference,First_Term);
@@ -520,34 +612,236 @@ void ReportSolution(int AP_Length,int difference,uint64_t First_Term)
 
 		// Even though this AP is not valid, it may contain an AP that is.
 		/* Check leading terms */
-		ReportSolution(i,difference,First_Term);
+		ReportSolution(res,i,difference,First_Term);
 
 		/* Check trailing terms */
-		ReportSolution(AP_Length-(i+1),difference,First_Term+(uint64_t)(i+1)*difference*2*3*5*7*11*13*17*19*23);
+		ReportSolution(res,AP_Length-(i+1),difference,First_Term+(uint64_t)(i+1)*difference*2*3*5*7*11*13*17*19*23);
 		return;
 	}
 	else if (AP_Length >= MINIMUM_AP_LENGTH_TO_REPORT){
 
-		if (results_file == NULL)
-			results_file = my_fopen(RESULTS_FILENAME,"a");
+		if(res->k_nsol == res->k_size){
+			res->k_size = (res->k_size) ? res->k_size * 2 : 64;
+			res->k_sol = (sol_t*)realloc(res->k_sol, res->k_size * sizeof(sol_t));
+			if(res->k_sol == NULL){
+				fprintf(stderr,"Error: solution buffer allocation failed\n");
+				printf("Error: solution buffer allocation failed\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		res->k_sol[res->k_nsol].First_Term = First_Term;
+		res->k_sol[res->k_nsol].AP_Length = AP_Length;
+		res->k_nsol++;
+	}
+	
+}
+
+
+// add a K's checksum and AP count to the totals and write its APs to the results file
+void commit_K(int K, uint32_t k_cksum, uint32_t k_aps, sol_t *k_sol, int k_nsol)
+{
+	cksum += k_cksum;
+	if(cksum > MAXINTV){
+		cksum -= MAXINTV;
+	}
+
+	totalaps += k_aps;
+
+	if(k_nsol == 0) return;
+
+	if (results_file == NULL)
+		results_file = my_fopen(RESULTS_FILENAME,"a");
+
+	if (results_file == NULL){
+		fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < k_nsol; ++i){
 
 		if(boinc_is_standalone()){
-			printf("Solution: %d %d %" PRIu64 "\n",AP_Length,difference,First_Term);
+			printf("Solution: %d %d %" PRIu64 "\n",k_sol[i].AP_Length,K,k_sol[i].First_Term);
 		}
 
-		if (results_file == NULL){
-			fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+		if (fprintf(results_file,"%d %d %" PRIu64 "\n",k_sol[i].AP_Length,K,k_sol[i].First_Term)<0){
+			fprintf(stderr,"Cannot write to %s !!!\n",RESULTS_FILENAME);
 			exit(EXIT_FAILURE);
 		}
+	}
+}
 
-		if (fprintf(results_file,"%d %d %" PRIu64 "\n",AP_Length,difference,First_Term)<0){
-			fprintf(stderr,"Cannot write to %s !!!\n",RESULTS_FILENAME);
+/* Validation pool.  SearchAP26 queues each K's results, a worker waits for
+   their read, checks the counters and reports the APs.
+*/
+static kres_t *val_head = NULL, *val_tail = NULL;
+static pthread_mutex_t val_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t val_cond = PTHREAD_COND_INITIALIZER;	// a K was queued
+static pthread_cond_t res_cond = PTHREAD_COND_INITIALIZER;	// a K was validated
+
+
+void check_result(kres_t *res)
+{
+	int found = 0;
+	uint64_t totaln = 0;
+
+	/*
+		counter_h[0] is the number of candidates sent from the sieve kernel to the prp test kernel
+		counter_h[1] is the maximum value of counter[0] since the last clear, used to check for buffer overflow
+		counter_h[2] is the number of solutions found
+		counter_h[3] is a flag set to 1 if the AP sequence PRP test kernel encountered an overflow over 2^64-1
+		counter_h[7] is the number of candidates tested, not counted with -fused
+
+		the device keeps more, counter[4] is the candidate buffer size, chunks over it are
+		rerun by SearchAP26 before the read, see rerunOverflow
+	*/
+
+	for(int slot=0; slot<res->depth; ++slot){
+
+		int *counter_h = res->counter_h[slot];
+
+		// check if number of candidates overflowed the array, -fused and -batch chunks aren't rerun
+		if(counter_h[1] > res->numn){
+			printf("Error: checkn array overflow.\n");
+			fprintf(stderr, "Error: checkn array overflow.\n");
+			exit(EXIT_FAILURE);
+		}
+		// check if number of solutions overflowed the array
+		if(counter_h[2] > sol){
+			printf("Error: solution array overflow.\n");
+			fprintf(stderr, "Error: solution array overflow.\n");
+			exit(EXIT_FAILURE);
+		}
+		// check if PRP test kernel has reached the software limit
+		if(counter_h[3] != 0){
+			printf("Error: AP sequence PRP test kernel overflowed.  SHIFT is too large.\n");
+			fprintf(stderr, "Error: AP sequence PRP test kernel overflowed.  SHIFT is too large.\n");
 			exit(EXIT_FAILURE);
 		}
+
+		// report solutions
+		for(int e=0; e < counter_h[2]; ++e){
+			ReportSolution(res,res->sol_k_h[slot][e],res->K,res->sol_val_h[slot][e]);
+		}
+
+		res->aps += counter_h[2];
+		found += counter_h[2];
+		totaln += (uint32_t)counter_h[7];
 	}
-	
+
+	// APs of the -cpu threads' n43s
+	for(int e=0; e < res->cpu_nsol; ++e){
+		ReportSolution(res,res->cpu_sol[e].AP_Length,res->K,res->cpu_sol[e].First_Term);
+	}
+	res->aps += res->cpu_nsol;
+	found += res->cpu_nsol;
+
+	if(boinc_is_standalone()){
+		if(num_devs > 1) printf("Device %d: ", res->dev_id);
+		printf("K %d done in %d sec. AP10+ found: %d\n", res->K, res->secs, found);
+		if(totaln){
+			if(num_devs > 1) printf("Device %d: ", res->dev_id);
+			printf("K %d candidates tested: %" PRIu64 "\n", res->K, totaln);
+		}
+	}
+}
+
+
+static void *validate_thread(void *arg)
+{
+	pthread_mutex_lock(&val_lock);
+
+	for(;;){
+		while(val_head == NULL)
+			pthread_cond_wait(&val_cond, &val_lock);
+
+		kres_t *res = val_head;
+		val_head = res->next;
+		if(val_head == NULL) val_tail = NULL;
+
+		pthread_mutex_unlock(&val_lock);
+
+		clWaitForEvents(1, &res->read_done);
+		clReleaseEvent(res->read_done);
+
+		check_result(res);
+
+		pthread_mutex_lock(&val_lock);
+		res->state = RES_DONE;
+		pthread_cond_broadcast(&res_cond);
+	}
+
+	return NULL;
+}
+
+
+void start_validators()
+{
+	for(int i = 0; i < val_threads; ++i){
+		pthread_t t;
+		if(pthread_create(&t, NULL, validate_thread, NULL)){
+			fprintf(stderr,"Error: pthread_create failed\n");
+			printf("Error: pthread_create failed\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(t);
+	}
+}
+
+
+void queue_result(kres_t *res)
+{
+	pthread_mutex_lock(&val_lock);
+
+	res->state = RES_QUEUED;
+	res->next = NULL;
+	if(val_tail != NULL) val_tail->next = res;
+	else val_head = res;
+	val_tail = res;
+
+	pthread_cond_signal(&val_cond);
+	pthread_mutex_unlock(&val_lock);
+}
+
+
+void wait_result(kres_t *res)
+{
+	pthread_mutex_lock(&val_lock);
+	while(res->state != RES_DONE)
+		pthread_cond_wait(&res_cond, &val_lock);
+	pthread_mutex_unlock(&val_lock);
+}
+
+
+// give a zero-copy K's result buffers back to the device
+void unmap_result(kres_t *res)
+{
+	if(!res->mapped) return;
+
+	for(int slot=0; slot<res->depth; ++slot){
+		clEnqueueUnmapMemObject(res->queue, res->counter_d[slot], res->counter_h[slot], 0, NULL, NULL);
+		clEnqueueUnmapMemObject(res->queue, res->sol_k_d[slot], res->sol_k_h[slot], 0, NULL, NULL);
+		clEnqueueUnmapMemObject(res->queue, res->sol_val_d[slot], res->sol_val_h[slot], 0, NULL, NULL);
+	}
+	clFlush(res->queue);
+
+	res->mapped = 0;
+}
+
+
+// once validated, pass a K's results to commit_K or LedgerComplete and free them for a later K
+void finish_result(kres_t *res, void (*commit)(int, uint32_t, uint32_t, sol_t *, int))
+{
+	wait_result(res);
+
+	commit(res->K, res->cksum, res->aps, res->k_sol, res->k_nsol);
+
+	unmap_result(res);
+	res->k_nsol = 0;
+	res->state = RES_FREE;
 }
 
+
 /* Checkpoint 
 */
 void checkpoint(int SHIFT, int K, int force)
@@ -589,142 +883,343 @@ int will_search(int K)
           	K%PRIME5 && K%PRIME6 && K%PRIME7 && K%PRIME8);
 }
 
-// Definition of SearchAP26()
-#include "AP26.h"
-
-
-#ifdef _WIN32
-double getSysOpType()
+/* Path of a file kept between runs, the tune file or kernel cache.  Under
+   BOINC it is kept in the project directory so it outlasts the slot
+   directory of one task.
+*/
+void project_path(char *path, size_t size, const char *name)
 {
-    double ret = 0.0;
-    NTSTATUS(WINAPI *RtlGetVersion)(LPOSVERSIONINFOEXW);
-    OSVERSIONINFOEXW osInfo;
-
-    *(FARPROC*)&RtlGetVersion = GetProcAddress(GetModuleHandleA("ntdll"), "RtlGetVersion");
-
-    if (NULL != RtlGetVersion)
-    {
-        osInfo.dwOSVersionInfoSize = sizeof(osInfo);
-        RtlGetVersion(&osInfo);
-        ret = (double)osInfo.dwMajorVersion;
-    }
-    return ret;
+	if(!boinc_is_standalone()){
+		APP_INIT_DATA aid;
+		boinc_get_init_data(aid);
+		if(aid.project_dir[0] != 0){
+			snprintf(path, size, "%s/%s", aid.project_dir, name);
+			return;
+		}
+	}
+	snprintf(path, size, "%s", name);
 }
-#endif
 
 
-int main(int argc, char *argv[])
+/* Look up dev->tune_key in the tune file.  Lines are
+     name<TAB>driver<TAB>mode<TAB>variant local global depth
+   Returns 1 and sets the tune fields if a usable entry was found.
+*/
+int load_tune(ap26_dev_t *dev)
 {
-	int i, K, SHIFT, computeunits;
-	int profile = 1;
-	int COMPUTE = 0;
-
-	// disable kernel cache.  compile every time, for testing.
-	// linux
-	// setenv("CUDA_CACHE_DISABLE", "1", 1);
-	// windows
-	// _putenv_s("CUDA_CACHE_DISABLE", "1");
-
-        // Initialize BOINC
-        BOINC_OPTIONS options;
-        boinc_options_defaults(options);
-        options.normal_thread_priority = true;    // Raise thread priority to keep GPU busy
-        boinc_init_options(&options);
-
-	fprintf(stderr, "AP26 OpenCL 10-shift search version %s by Bryan Little\n",VERS);
-	fprintf(stderr, "Compiled " __DATE__ " with GCC " __VERSION__ "\n");
-
-	if(boinc_is_standalone()){
-		printf("AP26 OpenCL 10-shift search version %s by Bryan Little\n",VERS);
-		printf("Compiled " __DATE__ " with GCC " __VERSION__ "\n");
+	char path[1024];
+	char line[4096];
+	size_t keylen = strlen(dev->tune_key);
+
+	project_path(path, sizeof(path), TUNE_FILENAME);
+
+	FILE *in = fopen(path, "r");
+	if(in == NULL) return 0;
+
+	while(fgets(line, sizeof(line), in) != NULL){
+		if(strncmp(line, dev->tune_key, keylen) != 0 || line[keylen] != '\t') continue;
+
+		char name[32];
+		unsigned int local;
+		uint64_t global;
+		int depth;
+		int wave;
+
+		if(sscanf(line + keylen + 1, "%31s %u %" SCNu64 " %d %d", name, &local, &global, &depth, &wave) != 5) continue;
+
+		for(int v = 0; v < NUMVAR; ++v){
+			if(strcmp(name, var_names[v]) == 0 && local > 0 && global > 0 && depth >= 1 && depth <= MAXDEPTH){
+				dev->variant = v;
+				dev->tune_local = local;
+				dev->tune_global = global;
+				dev->tune_depth = depth;
+				dev->tune_wave = (wave != 0);
+				dev->tuned = 1;
+			}
+		}
 	}
 
-	// Print out cmd line for diagnostics
-        fprintf(stderr, "Command line: ");
-        for (i = 0; i < argc; i++)
-        	fprintf(stderr, "%s ", argv[i]);
-        fprintf(stderr, "\n");
+	fclose(in);
 
-	/* Get search parameters from command line */
-	if(argc < 4){
-		printf("Usage: %s KMIN KMAX SHIFT\n",argv[0]);
-		exit(EXIT_FAILURE);
+	// an entry for another mode's variant is not usable
+	if(dev->tuned && LEAN_VAR(dev->variant) != (dev->lean != 0)){
+		dev->tuned = 0;
 	}
 
-	sscanf(argv[1],"%d",&KMIN);
-	sscanf(argv[2],"%d",&KMAX);
-	sscanf(argv[3],"%d",&SHIFT);
+	return dev->tuned;
+}
 
-	/* Resume from checkpoint if there is one */
-	if (read_state(KMIN,KMAX,SHIFT,&K)){
-		if(boinc_is_standalone()){
-			printf("Resuming search from checkpoint.\n");
+
+/* Replace this device's line in the tune file.  The lines are written to a
+   temporary file renamed over the tune file, so a crash or a full disk never
+   leaves other devices' entries cut short.
+*/
+void save_tune(ap26_dev_t *dev)
+{
+	static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER;
+	char path[1024];
+	char temp_path[1032];
+	char line[4096];
+	char *keep = NULL;
+	size_t keep_len = 0;
+	size_t keylen = strlen(dev->tune_key);
+
+	project_path(path, sizeof(path), TUNE_FILENAME);
+
+	pthread_mutex_lock(&tune_lock);
+
+	// other devices' lines
+	FILE *in = fopen(path, "r");
+	if(in != NULL){
+		while(fgets(line, sizeof(line), in) != NULL){
+			if(strncmp(line, dev->tune_key, keylen) == 0 && line[keylen] == '\t') continue;
+			size_t len = strlen(line);
+			keep = (char*)realloc(keep, keep_len + len + 1);
+			memcpy(keep + keep_len, line, len + 1);
+			keep_len += len;
 		}
-		fprintf(stderr,"Resuming from checkpoint. K: %d\n",K);
+		fclose(in);
 	}
-	else{
-		if(boinc_is_standalone()){
-			printf("Beginning a new search with parameters from the command line\n");
-		}
-		K = KMIN;
-		cksum = 0; // zero result checksum for BOINC
-		totalaps = 0;  // total count of APs found
-		write_state_a_next = true;
 
-		// clear result file
-		FILE * temp_file = my_fopen(RESULTS_FILENAME,"w");
-		if (temp_file == NULL){
-			fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
-			exit(EXIT_FAILURE);
-		}
-		fclose(temp_file);
+	sprintf(temp_path, "%s.tmp", path);
 
-		// setup boinc trickle up
-		last_trickle = (uint64_t)time(NULL);
+	FILE *out = fopen(temp_path, "w");
+	if(out == NULL){
+		fprintf(stderr, "Cannot write %s, sieve tuning will be repeated next run\n", temp_path);
 	}
-
-	//trying to resume a finished workunit
-	if(K > KMAX){
-		if(boinc_is_standalone()){
-			printf("Workunit complete.\n");
+	else{
+		int err = 0;
+		if(keep_len && fputs(keep, out) < 0) err = 1;
+		if(fprintf(out, "%s\t%s %u %" PRIu64 " %d %d\n", dev->tune_key, var_names[dev->variant], (unsigned int)dev->tune_local, dev->tune_global, dev->tune_depth, dev->tune_wave) < 0) err = 1;
+		if(fclose(out) || err || boinc_rename(temp_path, path)){
+			fprintf(stderr, "Cannot write %s, sieve tuning will be repeated next run\n", path);
+			remove(temp_path);
 		}
-		fprintf(stderr,"Workunit complete.\n");
-		boinc_finish(EXIT_SUCCESS);
-		return EXIT_SUCCESS;
 	}
 
+	pthread_mutex_unlock(&tune_lock);
 
-	cl_int err;
-	cl_platform_id platform = 0;
-	cl_device_id device = 0;
-	cl_context ctx;
-	cl_command_queue queue;
+	free(keep);
+}
 
-	int retval = 0;
-	retval = boinc_get_opencl_ids(argc, argv, 0, &device, &platform);
-	if (retval) {
-		if(boinc_is_standalone()){
-			printf("init_data.xml not found, using device 0.\n");
 
-			err = clGetPlatformIDs(1, &platform, NULL);
-			if (err != CL_SUCCESS) {
-				printf( "clGetPlatformIDs() failed with %d\n", err );
-				exit(EXIT_FAILURE);
-			}
-			err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
-			if (err != CL_SUCCESS) {
-				printf( "clGetDeviceIDs() failed with %d\n", err );
-				exit(EXIT_FAILURE);
-			}
+/* Source and kernel name of sieve variant v.  sieve_inc and sieve_lean use
+   the sieve.cl helpers and are built appended to it.  sieve_cpu is
+   sieve_lean with SIEVE_DIRECT defined.  The caller frees the source.
+*/
+char *variant_source(int v, const char **kernel)
+{
+	const char *head = (v == VAR_CPU) ? "#define SIEVE_DIRECT\n" : "";
+	const char *base = (v == VAR_NV) ? sieve_nv_cl : sieve_cl;
+	const char *extra = "";
+
+	if(v == VAR_INC) extra = sieve_inc_cl;
+	if(LEAN_VAR(v)) extra = sieve_lean_cl;
+
+	char *src = (char*)malloc(strlen(head) + strlen(base) + strlen(extra) + 1);
+	strcpy(src, head);
+	strcat(src, base);
+	strcat(src, extra);
+
+	if(v == VAR_INC) *kernel = var_names[v];
+	else if(LEAN_VAR(v)) *kernel = "sieve_lean";
+	else *kernel = "sieve";
+
+	return src;
+}
+
+
+// per K sieve constants
+typedef struct {
+	uint64_t STEP;
+	uint64_t S43, S47, S53, S59;
+} kconst_t;
+
+void getKconst(int K, kconst_t *kc)
+{
+	kc->STEP=K*PRIM23;
+	kc->S43=(PRES5*(K%17835)+((PRES5*17835)%MOD)*(K/17835))%MOD;
+	kc->S47=(PRES6*(K%17835)+((PRES6*17835)%MOD)*(K/17835))%MOD;
+	kc->S53=(PRES7*(K%17835)+((PRES7*17835)%MOD)*(K/17835))%MOD;
+	kc->S59=(PRES8*(K%17835)+((PRES8*17835)%MOD)*(K/17835))%MOD;
+}
+
+
+// build options defining K's constants, see kernels/sieve.cl
+void kspec_options(int K, int SHIFT, char *opt, size_t size)
+{
+	kconst_t kc;
+	getKconst(K, &kc);
+
+	int n = snprintf(opt, size, "-D K_STEP=%" PRIu64 "UL -D K_S43=%" PRIu64 "UL -D K_S47=%" PRIu64 "UL -D K_S53=%" PRIu64 "UL -D K_S59=%" PRIu64 "UL -D K_SHIFT=%d",
+			kc.STEP, kc.S43, kc.S47, kc.S53, kc.S59, SHIFT);
+
+	for(int j = 0; j < 10 && n < (int)size; ++j){
+		n += snprintf(opt + n, size - n, " -D K_S59P%d=%uu", j, (unsigned int)(kc.S59 % inc_p[j]));
+	}
+}
+
+
+static void *kspec_thread(void *arg)
+{
+	ap26_dev_t *dev = (ap26_dev_t*)arg;
+	const char *kernel;
+	char opt[1024];
+
+	char *src = variant_source(dev->variant, &kernel);
+	kspec_options(dev->ks_next.K, dev->ks_shift, opt, sizeof(opt));
+
+	dev->ks_next.sieve = sclGetCLSoftwareOpts(src, kernel, dev->hardware, 1, opt);
+	dev->ks_next.checkn = sclGetCLSoftwareOpts(checkn_cl, "checkn", dev->hardware, 1, opt);
+
+	free(src);
+
+	return NULL;
+}
+
+
+void kspec_release(ap26_dev_t *dev, kspec_t *ks)
+{
+	const char *kernel;
+	char opt[1024];
+
+	if(ks->K == 0) return;
+
+	sclReleaseClSoft(ks->sieve);
+	sclReleaseClSoft(ks->checkn);
+
+	// each K is searched once, don't let its binaries pile up in the cache
+	char *src = variant_source(dev->variant, &kernel);
+	kspec_options(ks->K, dev->ks_shift, opt, sizeof(opt));
+	sclRemoveCached(src, kernel, dev->hardware, 1, opt);
+	sclRemoveCached(checkn_cl, "checkn", dev->hardware, 1, opt);
+	free(src);
+
+	ks->K = 0;
+}
+
+
+void kspec_join(ap26_dev_t *dev)
+{
+	if(dev->ks_running){
+		pthread_join(dev->ks_thread, NULL);
+		dev->ks_running = 0;
+	}
+}
+
+
+// the K this device will most likely search after K, 0 if none.  devices
+// take K in turn, so with several devices skip the others' share
+int kspec_predict(int K)
+{
+	int skip = num_devs;
+
+	while(K < KMAX){
+		++K;
+		if(will_search(K) && --skip == 0) return K;
+	}
+
+	return 0;
+}
+
+
+/* Switch to the kernels built for K, if the previous K predicted it, and
+   start building the next K's in the background.  The build normally
+   finishes long before the K does, the join only waits if it didn't.
+   Returns 1 if ks_cur holds K's kernels.
+*/
+int kspec_begin(ap26_dev_t *dev, int K, int SHIFT)
+{
+	kspec_join(dev);
+
+	kspec_release(dev, &dev->ks_cur);
+	if(dev->ks_next.K == K){
+		dev->ks_cur = dev->ks_next;
+		dev->ks_next.K = 0;
+	}
+	else{
+		kspec_release(dev, &dev->ks_next);
+	}
+
+	int next = kspec_predict(K);
+	if(next){
+		dev->ks_next.K = next;
+		dev->ks_shift = SHIFT;
+		if(pthread_create(&dev->ks_thread, NULL, kspec_thread, dev) == 0){
+			dev->ks_running = 1;
 		}
 		else{
-			fprintf(stderr, "Error: boinc_get_opencl_ids() failed with error %d\n", retval );
-			exit(EXIT_FAILURE);
+			dev->ks_next.K = 0;
+		}
+	}
+
+	return dev->ks_cur.K == K;
+}
+
+
+// Definition of SearchAP26()
+#include "AP26.h"
+
+
+#ifdef _WIN32
+double getSysOpType()
+{
+    double ret = 0.0;
+    NTSTATUS(WINAPI *RtlGetVersion)(LPOSVERSIONINFOEXW);
+    OSVERSIONINFOEXW osInfo;
+
+    *(FARPROC*)&RtlGetVersion = GetProcAddress(GetModuleHandleA("ntdll"), "RtlGetVersion");
+
+    if (NULL != RtlGetVersion)
+    {
+        osInfo.dwOSVersionInfoSize = sizeof(osInfo);
+        RtlGetVersion(&osInfo);
+        ret = (double)osInfo.dwMajorVersion;
+    }
+    return ret;
+}
+#endif
+
+
+// build sieve variant v
+void compile_variant(ap26_dev_t *dev, int v)
+{
+	const char *kernel;
+	char *src = variant_source(v, &kernel);
+
+	printf("compiling %s\n", var_names[v]);
+
+	dev->var[v] = sclGetCLSoftware(src,kernel,dev->hardware, 1);
+
+	free(src);
+
+	if(v == VAR_NV){
+		// kernel has __attribute__ ((reqd_work_group_size(1024, 1, 1)))
+		// Nvidia's 4xx.x drivers changed CL_KERNEL_WORK_GROUP_SIZE return value to 256
+		// this kernel runs much quicker (33%+) at 1024 because of the local memory copy
+		// hack around nvidia's driver change
+		if(dev->var[v].local_size[0] != 1024){
+			dev->var[v].local_size[0] = 1024;
+			fprintf(stderr, "Set sieve kernel local size to 1024\n");
+			printf("Set sieve kernel local size to 1024\n");
 		}
 	}
 
+	dev->has_var[v] = 1;
+}
+
+
+/* Create a context and queue on device, compile the kernels and allocate
+   the buffers.
+*/
+void init_device(ap26_dev_t *dev, cl_platform_id platform, cl_device_id device)
+{
 	cl_context_properties cps[3] = { CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0 };
 
+	cl_int err;
+	cl_context ctx;
+	cl_command_queue queue;
+
 	ctx = clCreateContext(cps, 1, &device, NULL, NULL, &err);
 	if (err != CL_SUCCESS) {
 		fprintf(stderr, "Error: clCreateContext() returned %d\n", err);
@@ -738,17 +1233,26 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
     	}
 
-	hardware.platform = platform;
-	hardware.device = device;
-	hardware.queue = queue;
-	hardware.context = ctx;
+	dev->hardware.platform = platform;
+	dev->hardware.device = device;
+	dev->hardware.queue = queue;
+	dev->hardware.context = ctx;
+
+	// checkn runs on its own queue so it can overlap the next sieve
+	dev->check_hw = dev->hardware;
+	dev->check_hw.queue = clCreateCommandQueue(ctx, device, 0, &err);
+	if(err != CL_SUCCESS) { 
+		fprintf(stderr, "Error: Creating Command Queue. (clCreateCommandQueue) returned %d\n", err );
+		exit(EXIT_FAILURE);
+    	}
+	dev->depth = pipe_depth;
 
  	char device_name[1024];
  	char device_vend[1024];
  	char device_driver[1024];
 	cl_uint CUs;
 
-	err = clGetDeviceInfo(hardware.device, CL_DEVICE_NAME, sizeof(device_name), &device_name, NULL);
+	err = clGetDeviceInfo(dev->hardware.device, CL_DEVICE_NAME, sizeof(device_name), &device_name, NULL);
 	if ( err != CL_SUCCESS ) {
 		if(boinc_is_standalone()){
 			printf( "Error: clGetDeviceInfo\n" );
@@ -757,7 +1261,7 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	err = clGetDeviceInfo(hardware.device, CL_DEVICE_VENDOR, sizeof(device_vend), &device_vend, NULL);
+	err = clGetDeviceInfo(dev->hardware.device, CL_DEVICE_VENDOR, sizeof(device_vend), &device_vend, NULL);
 	if ( err != CL_SUCCESS ) {
 		if(boinc_is_standalone()){
 			printf( "Error: clGetDeviceInfo\n" );
@@ -766,7 +1270,7 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	err = clGetDeviceInfo(hardware.device, CL_DRIVER_VERSION, sizeof(device_driver), &device_driver, NULL);
+	err = clGetDeviceInfo(dev->hardware.device, CL_DRIVER_VERSION, sizeof(device_driver), &device_driver, NULL);
 	if ( err != CL_SUCCESS ) {
 		if(boinc_is_standalone()){
 			printf( "Error: clGetDeviceInfo\n" );
@@ -775,7 +1279,7 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	err = clGetDeviceInfo(hardware.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &CUs, NULL);
+	err = clGetDeviceInfo(dev->hardware.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &CUs, NULL);
 	if ( err != CL_SUCCESS ) {
 		if(boinc_is_standalone()){
 			printf( "Error: clGetDeviceInfo\n" );
@@ -789,18 +1293,72 @@ int main(int argc, char *argv[])
 		printf("GPU Info:\n  Name: \t\t%s\n  Vendor: \t\t%s\n  Driver: \t\t%s\n  Compute Units: \t%u\n", device_name, device_vend, device_driver, CUs);
 	}
 
+	cl_bool unified = CL_FALSE;
+	cl_device_type dtype = 0;
+	clGetDeviceInfo(dev->hardware.device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+	clGetDeviceInfo(dev->hardware.device, CL_DEVICE_TYPE, sizeof(cl_device_type), &dtype, NULL);
+
+	// CPU devices such as PoCL get their own profile.  the n59 arrays would only
+	// be 1.1 GB of host memory read back through the cache, they use the lean sieve
+	dev->cpu = (dtype & CL_DEVICE_TYPE_CPU) ? 1 : 0;
+	if(dev->cpu){
+		fprintf(stderr, "Using CPU device profile\n");
+		if(boinc_is_standalone()){
+			printf("Using CPU device profile\n");
+		}
+	}
+
+	// the n59 arrays need two halfn59s buffers, about 1.1 GB.  use the lean sieve
+	// if asked to or if the device can't hold them
+	cl_ulong max_alloc = 0, global_mem = 0;
+	clGetDeviceInfo(dev->hardware.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+	clGetDeviceInfo(dev->hardware.device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &global_mem, NULL);
+
+	// batches use the lean sieve, one set of n59 arrays is already 1.1 GB.
+	// -cpu too, only the lean sieve can stop short of the last n43
+	dev->batch = batch_size;
+	dev->lean = lean_mode || dev->cpu || dev->batch > 1 || cpu_threads;
+	dev->n59_limit = numn59s;
+	// first K, each CPU thread takes one range of thread_range n43s
+	dev->cpu_n43 = numn43s - cpu_threads * 50;
+	if(dev->cpu_n43 < 1) dev->cpu_n43 = 1;
+	dev->gpu_rate = dev->cpu_rate = 0;
+	if(!dev->lean && (max_alloc < (cl_ulong)halfn59s * sizeof(uint64_t) || global_mem < (cl_ulong)numn59s * sizeof(uint64_t) * 5 / 4)){
+		dev->lean = 1;
+		fprintf(stderr, "Not enough device memory for the n59 arrays, using lean sieve\n");
+		if(boinc_is_standalone()){
+			printf("Not enough device memory for the n59 arrays, using lean sieve\n");
+		}
+	}
+
+	// integrated GPUs and CPU devices share host memory, their n43, counter and
+	// solution buffers are mapped instead of copied.  batches are read into
+	// pinned memory
+	dev->zerocopy = zerocopy_mode && dev->batch == 1 && (unified || dev->cpu);
+	if(dev->zerocopy){
+		fprintf(stderr, "Using zero-copy host memory\n");
+		if(boinc_is_standalone()){
+			printf("Using zero-copy host memory\n");
+		}
+	}
+
 	// check vendor and normalize compute units. doesn't have to be accurate, work size is determined by kernel runtime.
-	computeunits = (int)CUs;
+	dev->computeunits = (int)CUs;
 
 	char intel_s[] = "Intel";
 	char arc_s[] = "Arc";
 	char nvidia_s[] = "NVIDIA";
+	int is_nv = 0;
 	
-	if(strstr((char*)device_vend, (char*)nvidia_s) != NULL){
+	// checked first, Intel's CPU runtime would pass for integrated graphics
+	if(dev->cpu){
+		// compute units are cores, tuneSieve sizes the chunks for them
+	}
+	else if(strstr((char*)device_vend, (char*)nvidia_s) != NULL){
 
 	 	cl_uint ccmajor;
 
-		err = clGetDeviceInfo(hardware.device, CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV, sizeof(ccmajor), &ccmajor, NULL);
+		err = clGetDeviceInfo(dev->hardware.device, CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV, sizeof(ccmajor), &ccmajor, NULL);
 		if ( err != CL_SUCCESS ) {
 			if(boinc_is_standalone()){
 		        	printf( "Error: clGetDeviceInfo\n" );
@@ -809,27 +1367,7 @@ int main(int argc, char *argv[])
 		        exit(EXIT_FAILURE);
 		}
 
-		if(ccmajor < 7){
-			// older nvidia gpus
-		        printf("compiling sieve for NVIDIA with local mem cache\n");
-		        sieve = sclGetCLSoftware(sieve_nv_cl,"sieve",hardware, 1);
-
-			// kernel has __attribute__ ((reqd_work_group_size(1024, 1, 1)))
-			// Nvidia's 4xx.x drivers changed CL_KERNEL_WORK_GROUP_SIZE return value to 256
-			// this kernel runs much quicker (33%+) at 1024 because of the local memory copy
-			// hack around nvidia's driver change
-			if(sieve.local_size[0] != 1024){
-				sieve.local_size[0] = 1024;
-				fprintf(stderr, "Set sieve kernel local size to 1024\n");
-				printf("Set sieve kernel local size to 1024\n");
-			}
-
-		}
-		else{
-			// current gpus with big L2 cache
-		        printf("compiling sieve\n");
-		        sieve = sclGetCLSoftware(sieve_cl,"sieve",hardware, 1);
-		}
+		is_nv = 1;
 
 
 #ifdef _WIN32
@@ -838,7 +1376,7 @@ int main(int argc, char *argv[])
 		float winVer = (float)getSysOpType();
 
 		if(winVer >= 10.0f && ccmajor >= 6){
-			COMPUTE = 1;
+			dev->COMPUTE = 1;
 		}
 
 #else
@@ -874,7 +1412,7 @@ int main(int argc, char *argv[])
 			|| strstr((char*)device_name, (char*)dc11) != NULL
 			|| strstr((char*)device_name, (char*)dc12) != NULL
 			|| strstr((char*)device_name, (char*)dc13) != NULL){
-			COMPUTE = 1;
+			dev->COMPUTE = 1;
 		}
 
 #endif
@@ -886,84 +1424,893 @@ int main(int argc, char *argv[])
 	else if( strstr((char*)device_vend, (char*)intel_s) != NULL ){
 
 		if( strstr((char*)device_name, (char*)arc_s) != NULL ){
-			computeunits /= 10;
+			dev->computeunits /= 10;
 		}
 		else{
-			computeunits /= 20;
+			dev->computeunits /= 20;
 	                fprintf(stderr,"Detected Intel integrated graphics\n");	
 		}
 
-                printf("compiling sieve\n");
-                sieve = sclGetCLSoftware(sieve_cl,"sieve",hardware, 1);
-
 	}
 	// AMD
         else{
-		computeunits /= 2;
-
-                printf("compiling sieve\n");
-                sieve = sclGetCLSoftware(sieve_cl,"sieve",hardware, 1);
+		dev->computeunits /= 2;
         }
 
 
-	if(computeunits < 1){
-		computeunits = 1;
+	if(dev->computeunits < 1){
+		dev->computeunits = 1;
+	}
+
+	// sieve variants.  a tuned device only needs its saved variant, otherwise
+	// build every candidate and let SearchAP26 time them
+	snprintf(dev->tune_key, sizeof(dev->tune_key), "%s\t%s\t%s", device_name, device_driver, dev->cpu ? "cpu" : dev->lean ? "lean" : "n59");
+
+	if(!retune && load_tune(dev)){
+		printf("Using tuned sieve from %s\n", TUNE_FILENAME);
+		compile_variant(dev, dev->variant);
+	}
+	else if(dev->cpu){
+		compile_variant(dev, VAR_CPU);
+		compile_variant(dev, VAR_LEAN);
+	}
+	else if(dev->lean){
+		compile_variant(dev, VAR_LEAN);
+	}
+	else{
+		compile_variant(dev, VAR_SIEVE);
+		compile_variant(dev, VAR_INC);
+		if(is_nv){
+			// local memory cache version, used to be the choice for cc < 7
+			compile_variant(dev, VAR_NV);
+		}
 	}
 	
 	// build kernels
 	printf("compiling clearok\n");
-        clearok = sclGetCLSoftware(clearok_cl,"clearok",hardware, 1);
+        dev->clearok = sclGetCLSoftware(clearok_cl,"clearok",dev->hardware, 1);
 
 	printf("compiling clearokok\n");
-        clearokok = sclGetCLSoftware(clearokok_cl,"clearokok",hardware, 1);
+        dev->clearokok = sclGetCLSoftware(clearokok_cl,"clearokok",dev->hardware, 1);
 
 	printf("compiling clearn\n");
-        clearn = sclGetCLSoftware(clearn_cl,"clearn",hardware, 1);
+        dev->clearn = sclGetCLSoftware(clearn_cl,"clearn",dev->hardware, 1);
 
 	printf("compiling offset\n");
-        offset = sclGetCLSoftware(offset_cl,"offset",hardware, 1);
+        dev->offset = sclGetCLSoftware(offset_cl,"offset",dev->hardware, 1);
 
 	printf("compiling setupok\n");
-        setupok = sclGetCLSoftware(setupok_cl,"setupok",hardware, 1);
+        dev->setupok = sclGetCLSoftware(setupok_cl,"setupok",dev->hardware, 1);
 
-	printf("compiling setupn\n");
-        setupn = sclGetCLSoftware(setupn_cl,"setupn",hardware, 1);
+	if(!dev->lean){
+		printf("compiling setupn\n");
+	        dev->setupn = sclGetCLSoftware(setupn_cl,"setupn",dev->hardware, 1);
+		sclSetGlobalSize( dev->setupn, 10840 );
+	}
 
         printf("compiling setupokok\n");
-        setupokok = sclGetCLSoftware(setupokok_cl,"setupokok",hardware, 1);
+        dev->setupokok = sclGetCLSoftware(setupokok_cl,"setupokok",dev->hardware, 1);
 
         printf("compiling checkn\n");
-        checkn = sclGetCLSoftware(checkn_cl,"checkn",hardware, 1);
+        dev->checkn = sclGetCLSoftware(checkn_cl,"checkn",dev->hardware, 1);
+
+	printf("compiling checkn wavefront\n");
+	dev->clearw = sclGetCLSoftware(checkn_cl,"clearw",dev->hardware, 1);
+	dev->checkw_first = sclGetCLSoftware(checkn_cl,"checkw_first",dev->hardware, 1);
+	dev->checkw_fwd = sclGetCLSoftware(checkn_cl,"checkw_fwd",dev->hardware, 1);
+	dev->checkw_back = sclGetCLSoftware(checkn_cl,"checkw_back",dev->hardware, 1);
+	sclSetGlobalSize( dev->clearw, 64 );
+
+	dev->fused = fused_mode;
+	if(dev->fused){
+		// sieve_fused calls the sieve and checkn helpers, build them as one source
+		char *src = (char*)malloc(strlen(sieve_cl) + strlen(checkn_cl) + strlen(sieve_fused_cl) + 1);
+		strcpy(src, sieve_cl);
+		strcat(src, checkn_cl);
+		strcat(src, sieve_fused_cl);
+
+		printf("compiling sieve_fused\n");
+		dev->fused_k = sclGetCLSoftwareOpts(src,"sieve_fused",dev->hardware, 1, "-D SIEVE_FUSED");
+
+		printf("compiling checkspill\n");
+		dev->checkspill = sclGetCLSoftwareOpts(src,"checkspill",dev->hardware, 1, "-D SIEVE_FUSED");
+
+		free(src);
+		dev->fused_range = 0;
+	}
+
+	if(dev->batch > 1){
+		// the batch kernels call the sieve, checkn and OK setup helpers, build them as one source
+		char *src = (char*)malloc(strlen(sieve_cl) + strlen(checkn_cl) + strlen(setupok_cl) + strlen(setupokok_cl) + strlen(batch_cl) + 1);
+		strcpy(src, sieve_cl);
+		strcat(src, checkn_cl);
+		strcat(src, setupok_cl);
+		strcat(src, setupokok_cl);
+		strcat(src, batch_cl);
+
+		printf("compiling batch kernels\n");
+		dev->clearok_b = sclGetCLSoftware(src,"clearok_b",dev->hardware, 1);
+		dev->setupok_b = sclGetCLSoftware(src,"setupok_b",dev->hardware, 1);
+		dev->clearokok_b = sclGetCLSoftware(src,"clearokok_b",dev->hardware, 1);
+		dev->setupokok_b = sclGetCLSoftware(src,"setupokok_b",dev->hardware, 1);
+		dev->clearn_b = sclGetCLSoftware(src,"clearn_b",dev->hardware, 1);
+		dev->sieve_b = sclGetCLSoftware(src,"sieve_b",dev->hardware, 1);
+		dev->checkn_b = sclGetCLSoftware(src,"checkn_b",dev->hardware, 1);
+
+		free(src);
+
+		sclSetGlobalSize( dev->clearok_b, numOK );
+		sclSetGlobalSize( dev->setupok_b, 542 );
+		sclSetGlobalSize( dev->clearokok_b, numOKOK );
+		sclSetGlobalSize( dev->setupokok_b, 542 );
+		sclSetGlobalSize( dev->clearn_b, MAXBATCH );
+	}
 
 	printf("Kernel compile done.\n");
 
 
 	// setup kernel global sizes
-	sclSetGlobalSize( clearn, 64 );
-	sclSetGlobalSize( clearokok, 23693 );
-	sclSetGlobalSize( clearok, 23693 );
-	sclSetGlobalSize( setupn, 10840 );
-	sclSetGlobalSize( offset, 542 );
-	sclSetGlobalSize( setupokok, 542 );
-	sclSetGlobalSize( setupok, 542 );
+	sclSetGlobalSize( dev->clearn, 64 );
+	sclSetGlobalSize( dev->clearokok, numOKOK );
+	sclSetGlobalSize( dev->clearok, 23693 );
+	sclSetGlobalSize( dev->offset, 542 );
+	sclSetGlobalSize( dev->setupokok, 542 );
+	sclSetGlobalSize( dev->setupok, 542 );
 
 
         // memory allocation
+	cl_mem_flags host_mem = dev->zerocopy ? CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR : CL_MEM_READ_WRITE;
+
         // host memory
-        n43_h = (uint64_t*)malloc(numn43s * sizeof(uint64_t));
-        sol_k_h = (int*)malloc(sol * sizeof(int));
-        sol_val_h = (uint64_t*)malloc(sol * sizeof(uint64_t));
-	counter_h = (int*)malloc(4 * sizeof(int));
+	if(!dev->zerocopy)
+	        dev->n43_h = (uint64_t*)malloc(numn43s * sizeof(uint64_t));
+	// pinned result buffers, each holds every slot's counters and solutions
+	size_t slot_bytes = sol * sizeof(uint64_t) + sol * sizeof(int) + READCOUNTERS * sizeof(int);
+	dev->numres = NUMRES * dev->batch;
+	for(int r = 0; r < dev->numres; ++r){
+		kres_t *res = &dev->res[r];
+
+		res->dev_id = dev->id;
+		res->queue = dev->hardware.queue;
+		res->state = RES_FREE;
+
+		// zero-copy, the K's slots use these buffers directly
+		if(dev->zerocopy){
+			for(int s = 0; s < MAXDEPTH; ++s){
+			        res->counter_d[s] = sclMalloc(dev->hardware, host_mem, NUMCOUNTERS * sizeof(int));
+			        res->sol_k_d[s] = sclMalloc(dev->hardware, host_mem, sol * sizeof(int));
+			        res->sol_val_d[s] = sclMalloc(dev->hardware, host_mem, sol * sizeof(uint64_t));
+			}
+			continue;
+		}
+
+		res->pin_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, MAXDEPTH * slot_bytes);
+		res->pin_h = (char*)mapBuffer(dev->hardware, res->pin_d, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, MAXDEPTH * slot_bytes, NULL);
+
+		for(int s = 0; s < MAXDEPTH; ++s){
+			char *p = res->pin_h + s * slot_bytes;
+			res->sol_val_h[s] = (uint64_t*)p;
+			res->sol_k_h[s] = (int*)(p + sol * sizeof(uint64_t));
+			res->counter_h[s] = (int*)(p + sol * sizeof(uint64_t) + sol * sizeof(int));
+		}
+	}
+	dev->res_next = 0;
         // device memory
-        n43_d = sclMalloc(hardware, CL_MEM_READ_WRITE, numn43s * sizeof(uint64_t));
-        n59_0_d = sclMalloc(hardware, CL_MEM_READ_WRITE, halfn59s * sizeof(uint64_t));
-        n59_1_d = sclMalloc(hardware, CL_MEM_READ_WRITE, halfn59s * sizeof(uint64_t));
-        counter_d = sclMalloc(hardware, CL_MEM_READ_WRITE, 4 * sizeof(int));
-        OKOK_d = sclMalloc(hardware, CL_MEM_READ_WRITE, numOK * sizeof(uint64_t));
-        OK_d = sclMalloc(hardware, CL_MEM_READ_WRITE, numOK * sizeof(char));
-        offset_d = sclMalloc(hardware, CL_MEM_READ_WRITE, 542 * sizeof(int));
-        sol_k_d = sclMalloc(hardware, CL_MEM_READ_WRITE, sol * sizeof(int));
-        sol_val_d = sclMalloc(hardware, CL_MEM_READ_WRITE, sol * sizeof(uint64_t));
+        dev->n43_d = sclMalloc(dev->hardware, host_mem, dev->batch * numn43s * sizeof(uint64_t));
+	if(!dev->lean){
+	        dev->n59_0_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, halfn59s * sizeof(uint64_t));
+	        dev->n59_1_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, halfn59s * sizeof(uint64_t));
+	}
+        dev->OKOK_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, dev->batch * numOKOK * sizeof(uint64_t));
+        dev->OK_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, dev->batch * numOK * sizeof(char));
+        dev->offset_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, 542 * sizeof(int));
+	// every slot the tuner may try.  about 0.28 candidates per sieve work-item,
+	// n_result_d starts at half the largest launch and grows if a chunk overflows.
+	// fused spills are twice the size and aren't rerun, they get the full launch
+	dev->nbuf = dev->fused ? maxsieve : maxsieve / 2;
+	for(int s = 0; s < MAXDEPTH; ++s){
+	        dev->n_result_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, dev->nbuf * sizeof(uint32_t));
+		if(dev->zerocopy){
+			dev->counter_d[s] = dev->res[0].counter_d[s];
+			dev->sol_k_d[s] = dev->res[0].sol_k_d[s];
+			dev->sol_val_d[s] = dev->res[0].sol_val_d[s];
+		}
+		else{
+		        dev->counter_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, NUMCOUNTERS * sizeof(int));
+		        dev->sol_k_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, sol * sizeof(int));
+		        dev->sol_val_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, sol * sizeof(uint64_t));
+		}
+	}
+	if(dev->has_var[VAR_INC]){
+		dev->S59p_d = sclMalloc(dev->hardware, CL_MEM_READ_ONLY, 10 * sizeof(uint32_t));
+	}
+	for(int w = 0; w < 2; ++w){
+	        dev->wn_d[w] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, maxsieve * sizeof(uint64_t));
+	        dev->wk_d[w] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, maxsieve * sizeof(int));
+	        dev->bn_d[w] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, maxsieve * sizeof(uint64_t));
+	        dev->bk_d[w] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, maxsieve * sizeof(int));
+	}
+	dev->wave_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, 6 * sizeof(int));
+	if(dev->batch > 1){
+		dev->n43b_h = (uint64_t*)malloc(dev->batch * numn43s * sizeof(uint64_t));
+		dev->kc_h = (uint64_t*)malloc(dev->batch * KC_WORDS * sizeof(uint64_t));
+	        dev->kc_d = sclMalloc(dev->hardware, CL_MEM_READ_ONLY, dev->batch * KC_WORDS * sizeof(uint64_t));
+		for(int s = 0; s < MAXDEPTH; ++s){
+		        dev->counterb_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, dev->batch * 8 * sizeof(int));
+		        dev->sol_kb_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, dev->batch * sol * sizeof(int));
+		        dev->sol_valb_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, dev->batch * sol * sizeof(uint64_t));
+		}
+	}
+	dev->numn = maxsieve;
+	setCandidateCap(dev, dev->numn / 2);
+	dev->wave = (wave_mode == 1);
+	if(dev->fused){
+		// spills are (n59 index, code) pairs, half as many fit in n_result_d.
+		// work_d is cleared with clearn, which also counts chunks in [5]
+		dev->work_d = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, NUMCOUNTERS * sizeof(int));
+		sclSetGlobalSize( dev->checkspill, dev->nbuf / 2 );
+	}
+
+	// apply the saved setup, otherwise SearchAP26 tunes on the first K
+	if(dev->tuned){
+		dev->sieve = dev->var[dev->variant];
+		dev->sieve.local_size[0] = dev->tune_local;
+		// the saved size is already a multiple of the local size, don't round it up again
+		setSieveSize( dev->sieve, dev->tune_global - 1 );
+		dev->depth = pipe_depth ? pipe_depth : dev->tune_depth;
+		dev->wave = (wave_mode >= 0) ? wave_mode : dev->tune_wave;
+		dev->numn = dev->sieve.global_size[0];
+		setCandidateCap(dev, dev->numn / 2);
+		printf("Sieve %s, local size %u, chunk %u, depth %d, %s\n", var_names[dev->variant], (unsigned int)dev->sieve.local_size[0], (unsigned int)dev->sieve.global_size[0], dev->depth, dev->wave ? "wavefront checkn" : "checkn");
+	}
+
+	dev->profile = !dev->tuned;
+	dev->progress = 1;
+}
+
+
+void free_device(ap26_dev_t *dev)
+{
+	kspec_join(dev);
+	kspec_release(dev, &dev->ks_cur);
+	kspec_release(dev, &dev->ks_next);
+
+        // host
+        free(dev->n43_h);
+	for(int r = 0; r < dev->numres; ++r){
+		kres_t *res = &dev->res[r];
+		if(dev->zerocopy){
+			for(int s = 0; s < MAXDEPTH; ++s){
+			        sclReleaseMemObject(res->counter_d[s]);
+			        sclReleaseMemObject(res->sol_k_d[s]);
+			        sclReleaseMemObject(res->sol_val_d[s]);
+			}
+		}
+		else{
+			clEnqueueUnmapMemObject(dev->hardware.queue, res->pin_d, res->pin_h, 0, NULL, NULL);
+			sclReleaseMemObject(res->pin_d);
+		}
+		free(res->k_sol);
+		free(res->cpu_sol);
+	}
+
+        // device
+        sclReleaseMemObject(dev->n43_d);
+	if(!dev->lean){
+	        sclReleaseMemObject(dev->n59_0_d);
+	        sclReleaseMemObject(dev->n59_1_d);
+	}
+        sclReleaseMemObject(dev->OK_d);
+        sclReleaseMemObject(dev->OKOK_d);
+        sclReleaseMemObject(dev->offset_d);
+	for(int s = 0; s < MAXDEPTH; ++s){
+		if(!dev->zerocopy){
+		        sclReleaseMemObject(dev->counter_d[s]);
+		        sclReleaseMemObject(dev->sol_k_d[s]);
+		        sclReleaseMemObject(dev->sol_val_d[s]);
+		}
+	        sclReleaseMemObject(dev->n_result_d[s]);
+	}
+	if(dev->S59p_d != NULL)
+	        sclReleaseMemObject(dev->S59p_d);
+	if(dev->fused)
+	        sclReleaseMemObject(dev->work_d);
+	for(int w = 0; w < 2; ++w){
+	        sclReleaseMemObject(dev->wn_d[w]);
+	        sclReleaseMemObject(dev->wk_d[w]);
+	        sclReleaseMemObject(dev->bn_d[w]);
+	        sclReleaseMemObject(dev->bk_d[w]);
+	}
+        sclReleaseMemObject(dev->wave_d);
+	if(dev->batch > 1){
+		free(dev->n43b_h);
+		free(dev->kc_h);
+	        sclReleaseMemObject(dev->kc_d);
+		for(int s = 0; s < MAXDEPTH; ++s){
+		        sclReleaseMemObject(dev->counterb_d[s]);
+		        sclReleaseMemObject(dev->sol_kb_d[s]);
+		        sclReleaseMemObject(dev->sol_valb_d[s]);
+		}
+	}
+
+        //free scl
+        sclReleaseClSoft(dev->clearok);
+        sclReleaseClSoft(dev->clearokok);
+        sclReleaseClSoft(dev->clearn);
+        sclReleaseClSoft(dev->offset);
+        sclReleaseClSoft(dev->checkn);
+        sclReleaseClSoft(dev->clearw);
+        sclReleaseClSoft(dev->checkw_first);
+        sclReleaseClSoft(dev->checkw_fwd);
+        sclReleaseClSoft(dev->checkw_back);
+        sclReleaseClSoft(dev->setupokok);
+        sclReleaseClSoft(dev->setupok);
+	// once tuned only the chosen variant is left
+	for(int v = 0; v < NUMVAR; ++v){
+		if(dev->has_var[v])
+		        sclReleaseClSoft(dev->var[v]);
+	}
+	if(!dev->lean)
+	        sclReleaseClSoft(dev->setupn);
+	if(dev->fused){
+	        sclReleaseClSoft(dev->fused_k);
+	        sclReleaseClSoft(dev->checkspill);
+	}
+	if(dev->batch > 1){
+	        sclReleaseClSoft(dev->clearok_b);
+	        sclReleaseClSoft(dev->setupok_b);
+	        sclReleaseClSoft(dev->clearokok_b);
+	        sclReleaseClSoft(dev->setupokok_b);
+	        sclReleaseClSoft(dev->clearn_b);
+	        sclReleaseClSoft(dev->sieve_b);
+	        sclReleaseClSoft(dev->checkn_b);
+	}
+
+	clReleaseCommandQueue(dev->check_hw.queue);
+        sclReleaseClHard(dev->hardware);
+}
+
+
+/* List every OpenCL device on every platform, in platform order.
+*/
+int list_devices(cl_platform_id *plats, cl_device_id *ids, int max)
+{
+	cl_platform_id platform[16];
+	cl_uint nplat = 0;
+	int n = 0;
+
+	cl_int err = clGetPlatformIDs(16, platform, &nplat);
+	if (err != CL_SUCCESS) {
+		printf( "clGetPlatformIDs() failed with %d\n", err );
+		exit(EXIT_FAILURE);
+	}
+
+	for(cl_uint p = 0; p < nplat && n < max; ++p){
+		cl_uint ndev = 0;
+
+		err = clGetDeviceIDs(platform[p], CL_DEVICE_TYPE_ALL, max - n, &ids[n], &ndev);
+		if (err == CL_DEVICE_NOT_FOUND) continue;
+		if (err != CL_SUCCESS) {
+			printf( "clGetDeviceIDs() failed with %d\n", err );
+			exit(EXIT_FAILURE);
+		}
+
+		for(cl_uint d = 0; d < ndev; ++d){
+			char name[1024];
+			clGetDeviceInfo(ids[n], CL_DEVICE_NAME, sizeof(name), &name, NULL);
+			printf("OpenCL device %d: %s\n", n, name);
+			plats[n++] = platform[p];
+		}
+	}
+
+	return n;
+}
+
+
+/* Open the devices in list, "all" or a comma separated list of the indexes
+   printed by list_devices.
+*/
+void select_devices(const char *list)
+{
+	cl_platform_id plats[64];
+	cl_device_id ids[64];
+	int count = list_devices(plats, ids, 64);
+	int sel[64];
+
+	if(strcmp(list, "all") == 0){
+		for(num_devs = 0; num_devs < count; ++num_devs)
+			sel[num_devs] = num_devs;
+	}
+	else{
+		const char *p = list;
+		num_devs = 0;
+
+		while(*p && num_devs < 64){
+			char *end;
+			long d = strtol(p, &end, 10);
+
+			if(end == p || d < 0 || d >= count){
+				printf("Error: bad device list %s, %d OpenCL devices found\n", list, count);
+				fprintf(stderr, "Error: bad device list %s, %d OpenCL devices found\n", list, count);
+				exit(EXIT_FAILURE);
+			}
+
+			sel[num_devs++] = (int)d;
+			p = (*end == ',') ? end + 1 : end;
+		}
+	}
+
+	if(num_devs == 0){
+		printf("Error: no OpenCL devices found\n");
+		fprintf(stderr, "Error: no OpenCL devices found\n");
+		exit(EXIT_FAILURE);
+	}
+
+	devs = (ap26_dev_t*)calloc(num_devs, sizeof(ap26_dev_t));
+
+	for(int i = 0; i < num_devs; ++i){
+		printf("Device %d is OpenCL device %d\n", i, sel[i]);
+		fprintf(stderr, "Device %d is OpenCL device %d\n", i, sel[i]);
+		devs[i].id = i;
+		init_device(&devs[i], plats[sel[i]], ids[sel[i]]);
+	}
+}
+
+
+/* Multi device mode.  Each device thread takes the next K to search, so
+   faster devices search more of them.  Results are committed in K order,
+   the results file and checksum match a single device search.
+*/
+typedef struct {
+	int K;
+	int done;
+	uint32_t cksum;
+	uint32_t aps;
+	sol_t *k_sol;
+	int k_nsol;
+} kslot_t;
+
+static kslot_t *kslots;
+static int num_kslots, next_kslot;
+static int search_shift;
+static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dev_cond = PTHREAD_COND_INITIALIZER;
+
+
+/* Count how many more K the other devices would finish, after their
+   current one, in the time dev takes to search one at my_rate.
+*/
+static int devices_faster(ap26_dev_t *dev, double my_rate)
+{
+	int faster = 0;
+	time_t now = time(NULL);
+
+	for(int i = 0; i < num_devs; ++i){
+		ap26_dev_t *o = &devs[i];
+
+		if(o == dev || !o->active || o->kdone == 0) continue;
+
+		double rate = o->secs / o->kdone;
+		if(rate <= 0.0) continue;
+
+		double left = 0.0;
+		if(o->curK){
+			left = rate - difftime(now, o->started);
+			if(left < 0.0) left = 0.0;
+		}
+
+		if(left + rate < my_rate) faster += (int)((my_rate - left) / rate);
+	}
+
+	return faster;
+}
+
+
+// hand a validated K's APs over to its slot, main frees them once committed
+static void hand_over(kres_t *res, kslot_t *ks)
+{
+	wait_result(res);
+
+	pthread_mutex_lock(&dev_lock);
+
+	ks->cksum = res->cksum;
+	ks->aps = res->aps;
+	ks->k_sol = res->k_sol;
+	ks->k_nsol = res->k_nsol;
+	ks->done = 1;
+	res->k_sol = NULL;
+	res->k_nsol = res->k_size = 0;
+	unmap_result(res);
+	res->state = RES_FREE;
+
+	pthread_cond_signal(&dev_cond);
+	pthread_mutex_unlock(&dev_lock);
+}
+
+
+static void *device_thread(void *arg)
+{
+	ap26_dev_t *dev = (ap26_dev_t*)arg;
+	kres_t *prev = NULL;
+	kslot_t *prev_ks = NULL;
+
+	pthread_mutex_lock(&dev_lock);
+
+	while(next_kslot < num_kslots){
+
+		int left = num_kslots - next_kslot;
+		double my_rate = dev->kdone ? dev->secs / dev->kdone : 0.0;
+
+		if(my_rate > 0.0 && left <= devices_faster(dev, my_rate)){
+			printf("Device %d: leaving the last %d K to faster devices\n", dev->id, left);
+			fprintf(stderr,"Device %d: leaving the last %d K to faster devices\n", dev->id, left);
+			break;
+		}
+
+		kslot_t *ks = &kslots[next_kslot++];
+		dev->curK = ks->K;
+		dev->started = time(NULL);
+
+		pthread_mutex_unlock(&dev_lock);
+
+		kres_t *res = SearchAP26(dev, ks->K, search_shift);
+
+		// the previous K was validated while this one was searched
+		if(prev != NULL)
+			hand_over(prev, prev_ks);
+		prev = res;
+		prev_ks = ks;
+
+		pthread_mutex_lock(&dev_lock);
+
+		dev->secs += difftime(time(NULL), dev->started);
+		dev->kdone++;
+		dev->curK = 0;
+	}
+
+	if(prev != NULL){
+		pthread_mutex_unlock(&dev_lock);
+		hand_over(prev, prev_ks);
+		pthread_mutex_lock(&dev_lock);
+	}
+
+	dev->active = 0;
+	pthread_cond_signal(&dev_cond);
+	pthread_mutex_unlock(&dev_lock);
+
+	return NULL;
+}
+
+
+/* Search K to KMAX on all devices.  Main commits finished K in order and
+   checkpoints at the first K not yet committed.
+*/
+void SearchDevices(int K, int SHIFT)
+{
+	int c, k;
+
+	num_kslots = next_kslot = 0;
+	for (k = K; k <= KMAX; ++k)
+		if (will_search(k))
+			num_kslots++;
+
+	kslots = (kslot_t*)calloc(num_kslots ? num_kslots : 1, sizeof(kslot_t));
+	for (c = 0, k = K; k <= KMAX; ++k)
+		if (will_search(k))
+			kslots[c++].K = k;
+
+	search_shift = SHIFT;
+
+	for(int i = 0; i < num_devs; ++i){
+		devs[i].progress = 0;
+		devs[i].active = 1;
+		if(pthread_create(&devs[i].thread, NULL, device_thread, &devs[i])){
+			fprintf(stderr,"Error: pthread_create failed\n");
+			printf("Error: pthread_create failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_mutex_lock(&dev_lock);
+
+	for (c = 0; c < num_kslots; ){
+
+		kslot_t *ks = &kslots[c];
+
+		if (!ks->done){
+			int active = 0;
+			for(int i = 0; i < num_devs; ++i)
+				active += devs[i].active;
+
+			if (active == 0){
+				fprintf(stderr,"Error: all devices stopped before K %d was searched\n", ks->K);
+				printf("Error: all devices stopped before K %d was searched\n", ks->K);
+				exit(EXIT_FAILURE);
+			}
+
+			pthread_cond_wait(&dev_cond, &dev_lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&dev_lock);
+
+		commit_K(ks->K, ks->cksum, ks->aps, ks->k_sol, ks->k_nsol);
+		free(ks->k_sol);
+		ks->k_sol = NULL;
+
+		K_DONE++;
+		Progress((double)K_DONE / (double)K_COUNT);
+
+		++c;
+		checkpoint(SHIFT, (c < num_kslots) ? kslots[c].K : KMAX+1, 0);
+
+		pthread_mutex_lock(&dev_lock);
+	}
+
+	pthread_mutex_unlock(&dev_lock);
+
+	for(int i = 0; i < num_devs; ++i)
+		pthread_join(devs[i].thread, NULL);
+
+	free(kslots);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, K, SHIFT;
+	char *ledger_path = NULL;
+	char *dev_list = NULL;
+
+	// disable kernel cache.  compile every time, for testing.
+	// linux
+	// setenv("CUDA_CACHE_DISABLE", "1", 1);
+	// windows
+	// _putenv_s("CUDA_CACHE_DISABLE", "1");
+
+        // Initialize BOINC
+        BOINC_OPTIONS options;
+        boinc_options_defaults(options);
+        options.normal_thread_priority = true;    // Raise thread priority to keep GPU busy
+        boinc_init_options(&options);
+
+	fprintf(stderr, "AP26 OpenCL 10-shift search version %s by Bryan Little\n",VERS);
+	fprintf(stderr, "Compiled " __DATE__ " with GCC " __VERSION__ "\n");
+
+	if(boinc_is_standalone()){
+		printf("AP26 OpenCL 10-shift search version %s by Bryan Little\n",VERS);
+		printf("Compiled " __DATE__ " with GCC " __VERSION__ "\n");
+	}
+
+	// Print out cmd line for diagnostics
+        fprintf(stderr, "Command line: ");
+        for (i = 0; i < argc; i++)
+        	fprintf(stderr, "%s ", argv[i]);
+        fprintf(stderr, "\n");
+
+	/* Get search parameters from command line */
+	if(argc < 4){
+		printf("Usage: %s KMIN KMAX SHIFT [-ledger file] [-devices list] [-lean] [-depth n] [-wave 0|1] [-vthreads n] [-nozerocopy] [-spin] [-retune] [-nocache] [-kspec] [-fused] [-batch n] [-cpu n] [-ncap n]\n",argv[0]);
+		printf("-ledger file shares KMIN to KMAX with other processes on this host using the same ledger file.\n");
+		printf("CPU app processes can use the same ledger to search alongside the GPU.\n");
+		printf("-devices list searches on several OpenCL devices, \"all\" or a comma separated list of device numbers.\n");
+		printf("-lean sieves without the 1.1 GB n59 arrays, for devices with little memory.\n");
+		printf("-depth n keeps n sieve chunks in flight, 1 to %d, default tuned.\n", MAXDEPTH);
+		printf("-wave 1 PRP tests one AP term per round for all candidates, 0 one candidate per work-item, default tuned.\n");
+		printf("-vthreads n validates and reports results on n threads while the GPU searches the next K, default %d.\n", val_threads);
+		printf("-nozerocopy copies buffers on integrated GPUs and CPU devices like on discrete GPUs.\n");
+		printf("-spin polls the GPU on short waits instead of always blocking.\n");
+		printf("-retune times the sieve setups again instead of using %s.\n", TUNE_FILENAME);
+		printf("-nocache compiles the kernels from source without reading or writing %s.\n", CACHE_DIRNAME);
+		printf("-kspec builds the sieve and checkn for each K with its constants, in the background during the previous K.\n");
+		printf("-fused sieves and PRP tests in one persistent kernel, candidates stay in local memory. -kspec is ignored.\n");
+		printf("-batch n searches n K at a time, 2 to %d, with the lean sieve. Not used with -ledger, -devices, -fused or -kspec.\n", MAXBATCH);
+		printf("-cpu n searches part of each K on n CPU threads beside the GPU, with the lean sieve. Not used with -devices, -fused or -batch.\n");
+		printf("-ncap n starts each K with n candidate buffer entries, a test of the overflow reruns. Not used with -fused or -batch.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	sscanf(argv[1],"%d",&KMIN);
+	sscanf(argv[2],"%d",&KMAX);
+	sscanf(argv[3],"%d",&SHIFT);
+
+	for(i = 4; i < argc; i++){
+		if( strcmp(argv[i], "-ledger") == 0 && i+1 < argc ){
+			ledger_path = argv[i+1];
+		}
+		else if( strcmp(argv[i], "-devices") == 0 && i+1 < argc ){
+			dev_list = argv[i+1];
+		}
+		else if( strcmp(argv[i], "-lean") == 0 ){
+			lean_mode = 1;
+		}
+		else if( strcmp(argv[i], "-spin") == 0 ){
+			spin_mode = 1;
+		}
+		else if( strcmp(argv[i], "-retune") == 0 ){
+			retune = 1;
+		}
+		else if( strcmp(argv[i], "-nocache") == 0 ){
+			use_cache = 0;
+		}
+		else if( strcmp(argv[i], "-kspec") == 0 ){
+			kspec_mode = 1;
+		}
+		else if( strcmp(argv[i], "-fused") == 0 ){
+			fused_mode = 1;
+		}
+		else if( strcmp(argv[i], "-vthreads") == 0 && i+1 < argc ){
+			val_threads = atoi(argv[i+1]);
+			if(val_threads < 1){
+				printf("Error: -vthreads must be at least 1\n");
+				fprintf(stderr, "Error: -vthreads must be at least 1\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if( strcmp(argv[i], "-nozerocopy") == 0 ){
+			zerocopy_mode = 0;
+		}
+		else if( strcmp(argv[i], "-wave") == 0 && i+1 < argc ){
+			wave_mode = (atoi(argv[i+1]) != 0);
+		}
+		else if( strcmp(argv[i], "-batch") == 0 && i+1 < argc ){
+			batch_size = atoi(argv[i+1]);
+			if(batch_size < 1 || batch_size > MAXBATCH){
+				printf("Error: -batch must be 1 to %d\n", MAXBATCH);
+				fprintf(stderr, "Error: -batch must be 1 to %d\n", MAXBATCH);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if( strcmp(argv[i], "-cpu") == 0 && i+1 < argc ){
+			cpu_threads = atoi(argv[i+1]);
+			if(cpu_threads < 1 || cpu_threads > 64){
+				printf("Error: -cpu must be 1 to 64\n");
+				fprintf(stderr, "Error: -cpu must be 1 to 64\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if( strcmp(argv[i], "-ncap") == 0 && i+1 < argc ){
+			start_cap = atoi(argv[i+1]);
+			if(start_cap < 1){
+				printf("Error: -ncap must be at least 1\n");
+				fprintf(stderr, "Error: -ncap must be at least 1\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if( strcmp(argv[i], "-depth") == 0 && i+1 < argc ){
+			pipe_depth = atoi(argv[i+1]);
+			if(pipe_depth < 1 || pipe_depth > MAXDEPTH){
+				printf("Error: -depth must be 1 to %d\n", MAXDEPTH);
+				fprintf(stderr, "Error: -depth must be 1 to %d\n", MAXDEPTH);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	/* Ledger mode, K are claimed later from a ledger shared with other processes */
+	if (ledger_path != NULL){
+		LedgerOpen(ledger_path, KMIN, KMAX, SHIFT);
+		K = KMIN;
+	}
+	/* Resume from checkpoint if there is one */
+	else if (read_state(KMIN,KMAX,SHIFT,&K)){
+		if(boinc_is_standalone()){
+			printf("Resuming search from checkpoint.\n");
+		}
+		fprintf(stderr,"Resuming from checkpoint. K: %d\n",K);
+	}
+	else{
+		if(boinc_is_standalone()){
+			printf("Beginning a new search with parameters from the command line\n");
+		}
+		K = KMIN;
+		cksum = 0; // zero result checksum for BOINC
+		totalaps = 0;  // total count of APs found
+		write_state_a_next = true;
+
+		// clear result file
+		FILE * temp_file = my_fopen(RESULTS_FILENAME,"w");
+		if (temp_file == NULL){
+			fprintf(stderr,"Cannot open %s !!!\n",RESULTS_FILENAME);
+			exit(EXIT_FAILURE);
+		}
+		fclose(temp_file);
+
+		// setup boinc trickle up
+		last_trickle = (uint64_t)time(NULL);
+	}
+
+	//trying to resume a finished workunit
+	if(K > KMAX){
+		if(boinc_is_standalone()){
+			printf("Workunit complete.\n");
+		}
+		fprintf(stderr,"Workunit complete.\n");
+		boinc_finish(EXIT_SUCCESS);
+		return EXIT_SUCCESS;
+	}
+
+
+	if (dev_list != NULL && !boinc_is_standalone()){
+		fprintf(stderr,"-devices is ignored under BOINC, using the device BOINC assigned\n");
+		dev_list = NULL;
+	}
+	if (dev_list != NULL && ledger_path != NULL){
+		printf("Error: -devices cannot be used with -ledger, run a process per device instead\n");
+		fprintf(stderr,"Error: -devices cannot be used with -ledger, run a process per device instead\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// batches are searched by the single device loop with the plain sieve and checkn
+	if (batch_size > 1 && (ledger_path != NULL || dev_list != NULL || fused_mode || kspec_mode)){
+		fprintf(stderr,"-batch is ignored with -ledger, -devices, -fused and -kspec\n");
+		if(boinc_is_standalone()){
+			printf("-batch is ignored with -ledger, -devices, -fused and -kspec\n");
+		}
+		batch_size = 1;
+	}
+
+	// -cpu splits the n43s of one device's K, the CPU threads share the search globals
+	if (cpu_threads && (dev_list != NULL || fused_mode || batch_size > 1)){
+		fprintf(stderr,"-cpu is ignored with -devices, -fused and -batch\n");
+		if(boinc_is_standalone()){
+			printf("-cpu is ignored with -devices, -fused and -batch\n");
+		}
+		cpu_threads = 0;
+	}
+	if (cpu_threads){
+		detect_isa();
+		alloc_thread_bufs(cpu_threads);
+		search_report = 0;
+	}
+
+	// compiled kernels are reused when the source, device and driver match
+	if (use_cache){
+		char cache_dir[1024];
+		project_path(cache_dir, sizeof(cache_dir), CACHE_DIRNAME);
+		sclSetCacheDir(cache_dir);
+	}
+
+	if (dev_list != NULL){
+		select_devices(dev_list);
+	}
+	else{
+		cl_int err;
+		cl_platform_id platform = 0;
+		cl_device_id device = 0;
+
+		int retval = 0;
+		retval = boinc_get_opencl_ids(argc, argv, 0, &device, &platform);
+		if (retval) {
+			if(boinc_is_standalone()){
+				printf("init_data.xml not found, using device 0.\n");
+
+				err = clGetPlatformIDs(1, &platform, NULL);
+				if (err != CL_SUCCESS) {
+					printf( "clGetPlatformIDs() failed with %d\n", err );
+					exit(EXIT_FAILURE);
+				}
+				err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, NULL);
+				if (err == CL_DEVICE_NOT_FOUND) {
+					// no GPU, use any device.  allows testing with a CPU implementation like PoCL
+					printf("No GPU found, using the first OpenCL device.\n");
+					err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL);
+				}
+				if (err != CL_SUCCESS) {
+					printf( "clGetDeviceIDs() failed with %d\n", err );
+					exit(EXIT_FAILURE);
+				}
+			}
+			else{
+				fprintf(stderr, "Error: boinc_get_opencl_ids() failed with error %d\n", retval );
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		num_devs = 1;
+		devs = (ap26_dev_t*)calloc(1, sizeof(ap26_dev_t));
+		init_device(&devs[0], platform, device);
+	}
 
 
 	/* Count the number of K in the range KMIN <= K <= KMAX that will actually
@@ -984,19 +2331,88 @@ int main(int argc, char *argv[])
 
 	time(&last_ckpt);
 
-	/* Top-level loop */
-	for (; K <= KMAX; ++K){
-		if (will_search(K)){
+	start_validators();
+
+	/* Ledger mode, claim K until there are none left */
+	if (ledger_path != NULL){
+
+		K_COUNT = 1;
+		K_DONE = 0;
+
+		kres_t *prev = NULL;
+
+		// a K is completed in the ledger while the next one is searched
+		while(LedgerClaim(&K)){
+			kres_t *res = SearchAP26(&devs[0],K,SHIFT);
+
+			if(prev != NULL)
+				finish_result(prev, LedgerComplete);
+			prev = res;
+		}
+		if(prev != NULL)
+			finish_result(prev, LedgerComplete);
+
+		K = KMAX+1;
+	}
+
+	/* Multi device mode, the devices share the K between them */
+	if (num_devs > 1){
+		SearchDevices(K,SHIFT);
 
-			checkpoint(SHIFT,K,0);
+		K = KMAX+1;
+	}
+
+	/* Top-level loop.  Each K, or batch of K with -batch, is committed while
+	   the next one is searched, the checkpoint is the first K not yet committed */
+	kres_t *prev[MAXBATCH];
+	int nprev = 0;
+
+	while (K <= KMAX){
+
+		// an untuned device times the sieve setups on a K of its own
+		int Kb[MAXBATCH];
+		int nk = 0;
+		int size = devs[0].profile ? 1 : devs[0].batch;
 
-			SearchAP26(K,SHIFT,profile,computeunits,COMPUTE);
+		for (; K <= KMAX && nk < size; ++K)
+			if (will_search(K))
+				Kb[nk++] = K;
+
+		if (nk == 0)
+			break;
+
+		if(nprev == 0)
+			checkpoint(SHIFT,Kb[0],0);
+
+		kres_t *res[MAXBATCH];
+		if (nk == 1)
+			res[0] = SearchAP26(&devs[0],Kb[0],SHIFT);
+		else
+			SearchBatch(&devs[0],Kb,nk,SHIFT,res);
 
-		 	K_DONE++;
+		if(nprev != 0){
+			for (int b = 0; b < nprev; ++b){
+				finish_result(prev[b], commit_K);
+
+				K_DONE++;
+			}
 
 			Progress((double)K_DONE / (double)K_COUNT);
+
+			checkpoint(SHIFT,Kb[0],0);
 		}
+
+		for (int b = 0; b < nk; ++b)
+			prev[b] = res[b];
+		nprev = nk;
+	}
+	for (int b = 0; b < nprev; ++b){
+		finish_result(prev[b], commit_K);
+
+		K_DONE++;
 	}
+	if(nprev != 0)
+		Progress((double)K_DONE / (double)K_COUNT);
 
 	if(boinc_is_standalone()){
 		time(&totalf);
@@ -1004,44 +2420,32 @@ int main(int argc, char *argv[])
 	}
 
 
-	boinc_begin_critical_section();
-	boinc_fraction_done(1.0);
-	checkpoint(SHIFT,K,1);
-	write_cksum();
-	fprintf(stderr,"Workunit complete.  Number of AP10+ found %u\n", totalaps);
-	boinc_end_critical_section();
+	if (ledger_path != NULL){
+		if(LedgerFinish()){
+			fprintf(stderr,"Workunit complete.  Number of AP10+ found %u\n", totalaps);
+		}
+		else{
+			fprintf(stderr,"No more K to claim from the ledger\n");
+			if(boinc_is_standalone()){
+				printf("No more K to claim from the ledger\n");
+			}
+		}
+	}
+	else{
+		boinc_begin_critical_section();
+		boinc_fraction_done(1.0);
+		checkpoint(SHIFT,K,1);
+		write_cksum();
+		fprintf(stderr,"Workunit complete.  Number of AP10+ found %u\n", totalaps);
+		boinc_end_critical_section();
+	}
 
         // free memory
-        // host
-        free(n43_h);
-        free(sol_k_h);
-        free(sol_val_h);
-	free(counter_h);
-
-        // device
-        sclReleaseMemObject(counter_d);
-        sclReleaseMemObject(n43_d);
-        sclReleaseMemObject(n59_0_d);
-        sclReleaseMemObject(n59_1_d);
-        sclReleaseMemObject(OK_d);
-        sclReleaseMemObject(OKOK_d);
-        sclReleaseMemObject(offset_d);
-        sclReleaseMemObject(sol_k_d);
-        sclReleaseMemObject(sol_val_d);
-        sclReleaseMemObject(n_result_d);
-
-        //free scl
-        sclReleaseClSoft(clearok);
-        sclReleaseClSoft(clearokok);
-        sclReleaseClSoft(clearn);
-        sclReleaseClSoft(offset);
-        sclReleaseClSoft(checkn);
-        sclReleaseClSoft(setupokok);
-        sclReleaseClSoft(setupok);
-        sclReleaseClSoft(sieve);
-        sclReleaseClSoft(setupn);
-
-        sclReleaseClHard(hardware);
+	for(i = 0; i < num_devs; ++i){
+		free_device(&devs[i]);
+	}
+	free(devs);
+	if(cpu_threads) free_thread_bufs(cpu_threads);
 
 	boinc_finish(EXIT_SUCCESS);
 
@@ -5,13 +5,47 @@
  	Jan 10, 2023				*/
 
 
-void waitOnEvent(sclHard hardware, cl_event event){
+// completion of an event, signalled by its callback
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+} event_wait_t;
+
+
+void CL_CALLBACK eventDone(cl_event event, cl_int status, void *data){
+
+	event_wait_t *w = (event_wait_t*)data;
+
+	pthread_mutex_lock(&w->lock);
+	w->done = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+
+double usNow(){
+
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (double)t.tv_sec * 1e6 + (double)t.tv_nsec / 1e3;
+}
+
+
+/* Block until event is complete, then release it.
+   With -spin, short waits poll the event instead of blocking.  avg_us is the
+   caller's running average wait, when it is below SPIN_US the event is polled
+   for up to twice that before blocking.
+*/
+#define SPIN_US 200.0
+
+void waitOnEvent(sclHard hardware, cl_event event, double *avg_us){
 
 	cl_int err;
 	cl_int info;
-	struct timespec sleep_time;
-	sleep_time.tv_sec = 0;
-	sleep_time.tv_nsec = 1000000;	// 1ms
+	double start = usNow();
+	int done = 0;
 
 	err = clFlush(hardware.queue);
 	if ( err != CL_SUCCESS ) {
@@ -20,39 +54,65 @@ void waitOnEvent(sclHard hardware, cl_event event){
 		sclPrintErrorFlags( err );
        	}
 
-	while(true){
-
-		nanosleep(&sleep_time,NULL);
+	if(spin_mode && avg_us != NULL && *avg_us < SPIN_US){
 
-		err = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &info, NULL);
-		if ( err != CL_SUCCESS ) {
-			printf( "ERROR: clGetEventInfo\n" );
-			fprintf(stderr, "ERROR: clGetEventInfo\n" );
-			sclPrintErrorFlags( err );
-	       	}
+		double limit = (*avg_us < 10.0) ? 20.0 : 2.0 * *avg_us;
 
-		if(info == CL_COMPLETE){
-			err = clReleaseEvent(event);
+		do{
+			err = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &info, NULL);
 			if ( err != CL_SUCCESS ) {
-				printf( "ERROR: clReleaseEvent\n" );
-				fprintf(stderr, "ERROR: clReleaseEvent\n" );
+				printf( "ERROR: clGetEventInfo\n" );
+				fprintf(stderr, "ERROR: clGetEventInfo\n" );
 				sclPrintErrorFlags( err );
+				break;
 		       	}
+			done = (info == CL_COMPLETE);
+		}while( !done && usNow() - start < limit );
+	}
+
+	if(!done){
+		event_wait_t w;
+		pthread_mutex_init(&w.lock, NULL);
+		pthread_cond_init(&w.cond, NULL);
+		w.done = 0;
+
+		err = clSetEventCallback(event, CL_COMPLETE, eventDone, &w);
+		if ( err != CL_SUCCESS ) {
+			printf( "ERROR: clSetEventCallback\n" );
+			fprintf(stderr, "ERROR: clSetEventCallback\n" );
+			sclPrintErrorFlags( err );
+			clWaitForEvents(1, &event);
+			w.done = 1;
+	       	}
 
-			return;
+		pthread_mutex_lock(&w.lock);
+		while(!w.done){
+			pthread_cond_wait(&w.cond, &w.lock);
 		}
+		pthread_mutex_unlock(&w.lock);
+
+		pthread_cond_destroy(&w.cond);
+		pthread_mutex_destroy(&w.lock);
+	}
+
+	if(avg_us != NULL){
+		*avg_us = 0.75 * *avg_us + 0.25 * (usNow() - start);
 	}
+
+	err = clReleaseEvent(event);
+	if ( err != CL_SUCCESS ) {
+		printf( "ERROR: clReleaseEvent\n" );
+		fprintf(stderr, "ERROR: clReleaseEvent\n" );
+		sclPrintErrorFlags( err );
+       	}
 }
 
 
+// block until everything queued on hardware is done
 void sleepCPU(sclHard hardware){
 
 	cl_event kernelsDone;
 	cl_int err;
-	cl_int info;
-	struct timespec sleep_time;
-	sleep_time.tv_sec = 0;
-	sleep_time.tv_nsec = 1000000;	// 1ms
 
 	err = clEnqueueMarker( hardware.queue, &kernelsDone);
 	if ( err != CL_SUCCESS ) {
@@ -61,51 +121,753 @@ void sleepCPU(sclHard hardware){
 		sclPrintErrorFlags(err); 
 	}
 
-	err = clFlush(hardware.queue);
+	waitOnEvent(hardware, kernelsDone, NULL);
+}
+
+
+// add the idle time between the previous chunk's sieve and this one, from the
+// sieve queue's profiling info, and release the sieve's event
+void sieveGap(cl_event ev, cl_ulong *prev_end, double *total_ms, double *max_ms){
+
+	cl_ulong t_start = 0, t_end = 0;
+
+	clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &t_start, NULL);
+	clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &t_end, NULL);
+
+	if(*prev_end != 0 && t_start > *prev_end){
+		double ms = (double)(t_start - *prev_end) / 1e6;
+		*total_ms += ms;
+		if(ms > *max_ms) *max_ms = ms;
+	}
+	*prev_end = t_end;
+
+	clReleaseEvent(ev);
+}
+
+
+// sieve candidates are packed in 32 bits, which limits the launch size
+void setSieveSize(sclSoft &sieve, uint64_t size){
+
+	sclSetGlobalSize( sieve, size );
+
+	while(sieve.global_size[0] > maxsieve){
+		sieve.global_size[0] -= sieve.local_size[0];
+	}
+}
+
+
+// map a buffer for the host, ev is set if not NULL
+void *mapBuffer(sclHard hardware, cl_mem buffer, cl_bool blocking, cl_map_flags flags, size_t size, cl_event *ev){
+
+	cl_int err;
+
+	void *p = clEnqueueMapBuffer(hardware.queue, buffer, blocking, flags, 0, size, 0, NULL, ev, &err);
 	if ( err != CL_SUCCESS ) {
-		printf( "ERROR: clFlush\n" );
-		fprintf(stderr, "ERROR: clFlush\n" );
+		printf( "ERROR: clEnqueueMapBuffer\n" );
+		fprintf(stderr, "ERROR: clEnqueueMapBuffer\n" );
 		sclPrintErrorFlags( err );
-       	}
+		exit(EXIT_FAILURE);
+	}
+
+	return p;
+}
 
-	while(true){
 
-		nanosleep(&sleep_time,NULL);
+// per K args of sieve variant v
+void setSieveArgs(ap26_dev_t *dev, sclSoft &sieve, int v, uint64_t S59, int SHIFT, uint64_t S43, uint64_t S47, uint64_t S53){
 
-		err = clGetEventInfo(kernelsDone, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &info, NULL);
-		if ( err != CL_SUCCESS ) {
-			printf( "ERROR: clGetEventInfo\n" );
-			fprintf(stderr, "ERROR: clGetEventInfo\n" );
-			sclPrintErrorFlags( err );
-	       	}
+	sclSetKernelArg(sieve, 1, sizeof(uint64_t), &S59);
+	sclSetKernelArg(sieve, 2, sizeof(int), &SHIFT);
+	sclSetKernelArg(sieve, 4, sizeof(cl_mem), &dev->OKOK_d);
+
+	if(v == VAR_INC){
+		sclSetKernelArg(sieve, 7, sizeof(cl_mem), &dev->S59p_d);
+	}
+	else if(LEAN_VAR(v)){
+		sclSetKernelArg(sieve, 7, sizeof(uint64_t), &S43);
+		sclSetKernelArg(sieve, 8, sizeof(uint64_t), &S47);
+		sclSetKernelArg(sieve, 9, sizeof(uint64_t), &S53);
+		sclSetKernelArg(sieve, 10, sizeof(int), &dev->n59_limit);
+	}
+}
 
-		if(info == CL_COMPLETE){
-			err = clReleaseEvent(kernelsDone);
-			if ( err != CL_SUCCESS ) {
-				printf( "ERROR: clReleaseEvent\n" );
-				fprintf(stderr, "ERROR: clReleaseEvent\n" );
-				sclPrintErrorFlags( err );
-		       	}
 
-			return;
+// per K args of checkn
+void setCheckArgs(ap26_dev_t *dev, sclSoft &checkn, uint64_t STEP, uint64_t S59, int SHIFT, uint64_t S43, uint64_t S47, uint64_t S53){
+
+	sclSetKernelArg(checkn, 1, sizeof(uint64_t), &STEP);
+	sclSetKernelArg(checkn, 6, sizeof(uint64_t), &S59);
+	sclSetKernelArg(checkn, 7, sizeof(int), &SHIFT);
+	sclSetKernelArg(checkn, 9, sizeof(int), &dev->lean);
+	sclSetKernelArg(checkn, 10, sizeof(uint64_t), &S43);
+	sclSetKernelArg(checkn, 11, sizeof(uint64_t), &S47);
+	sclSetKernelArg(checkn, 12, sizeof(uint64_t), &S53);
+}
+
+
+// per K and static args of the wavefront checkn kernels
+void setWaveArgs(ap26_dev_t *dev, uint64_t STEP, uint64_t S59, int SHIFT, uint64_t S43, uint64_t S47, uint64_t S53){
+
+	sclSetKernelArg(dev->clearw, 0, sizeof(cl_mem), &dev->wave_d);
+
+	sclSetKernelArg(dev->checkw_first, 1, sizeof(uint64_t), &STEP);
+	sclSetKernelArg(dev->checkw_first, 4, sizeof(uint64_t), &S59);
+	sclSetKernelArg(dev->checkw_first, 5, sizeof(int), &SHIFT);
+	sclSetKernelArg(dev->checkw_first, 7, sizeof(int), &dev->lean);
+	sclSetKernelArg(dev->checkw_first, 8, sizeof(uint64_t), &S43);
+	sclSetKernelArg(dev->checkw_first, 9, sizeof(uint64_t), &S47);
+	sclSetKernelArg(dev->checkw_first, 10, sizeof(uint64_t), &S53);
+	sclSetKernelArg(dev->checkw_first, 11, sizeof(cl_mem), &dev->wn_d[1]);
+	sclSetKernelArg(dev->checkw_first, 12, sizeof(cl_mem), &dev->wk_d[1]);
+	sclSetKernelArg(dev->checkw_first, 13, sizeof(cl_mem), &dev->wave_d);
+
+	// forward rounds start the backward walk in list 0
+	sclSetKernelArg(dev->checkw_fwd, 4, sizeof(cl_mem), &dev->bn_d[0]);
+	sclSetKernelArg(dev->checkw_fwd, 5, sizeof(cl_mem), &dev->bk_d[0]);
+	sclSetKernelArg(dev->checkw_fwd, 6, sizeof(cl_mem), &dev->wave_d);
+	sclSetKernelArg(dev->checkw_fwd, 9, sizeof(uint64_t), &STEP);
+
+	sclSetKernelArg(dev->checkw_back, 4, sizeof(cl_mem), &dev->wave_d);
+	sclSetKernelArg(dev->checkw_back, 7, sizeof(uint64_t), &STEP);
+}
+
+
+// the sieve stores up to cap candidates per chunk and checkn launches cover
+// them.  n_result_d is reallocated when it's too small
+void setCandidateCap(ap26_dev_t *dev, int cap){
+
+	if(cap > maxsieve) cap = maxsieve;
+	if(cap < 1) cap = 1;
+
+	if(cap > dev->nbuf){
+		for(int s = 0; s < MAXDEPTH; ++s){
+		        sclReleaseMemObject(dev->n_result_d[s]);
+		        dev->n_result_d[s] = sclMalloc(dev->hardware, CL_MEM_READ_WRITE, cap * sizeof(uint32_t));
 		}
+		dev->nbuf = cap;
 	}
+	dev->ncap = cap;
 
+	sclSetGlobalSize( dev->checkn, cap );
+	sclSetGlobalSize( dev->checkw_first, cap );
+	sclSetGlobalSize( dev->checkw_fwd, cap );
+	sclSetGlobalSize( dev->checkw_back, cap );
 }
 
 
-void SearchAP26(int K, int startSHIFT, int & profile, uint32_t CU, int COMPUTE)
-{ 
+// clear the counters of the first slots slots and set their candidate buffer
+// size, counter[4].  fused spills are (n59 index, code) pairs
+void resetCounters(ap26_dev_t *dev, int slots){
 
-	uint64_t STEP;
-	uint64_t n0;
+	int c[NUMCOUNTERS] = { 0 };
+	c[4] = dev->fused ? dev->nbuf / 2 : dev->ncap;
+
+	for(int slot=0; slot<slots; ++slot){
+		sclWrite(dev->hardware, NUMCOUNTERS * sizeof(int), dev->counter_d[slot], c);
+	}
+}
+
+
+// wavefront checkn of slot after the sieve, WAVE_FWD forward and WAVE_BACK
+// backward rounds on check_hw.  returns the last round's event
+cl_event enqueueWave(ap26_dev_t *dev, int slot, cl_mem *n59buf, int p, cl_event *sieveDone){
+
+	cl_event ev = NULL;
+
+	sclEnqueueKernel(dev->check_hw, dev->clearw);
+
+	sclSetKernelArg(dev->checkw_first, 0, sizeof(cl_mem), &dev->n_result_d[slot]);
+	sclSetKernelArg(dev->checkw_first, 2, sizeof(cl_mem), &dev->counter_d[slot]);
+	sclSetKernelArg(dev->checkw_first, 3, sizeof(cl_mem), n59buf);
+	sclSetKernelArg(dev->checkw_first, 6, sizeof(int), &p);
+
+	ev = sclEnqueueKernelWait(dev->check_hw, dev->checkw_first, 1, sieveDone);
+	clReleaseEvent(ev);
+
+	sclSetKernelArg(dev->checkw_fwd, 10, sizeof(cl_mem), &dev->counter_d[slot]);
+
+	for(int r=1; r<WAVE_FWD; ++r){
+		int last = (r == WAVE_FWD - 1);
+
+		sclSetKernelArg(dev->checkw_fwd, 0, sizeof(cl_mem), &dev->wn_d[r%2]);
+		sclSetKernelArg(dev->checkw_fwd, 1, sizeof(cl_mem), &dev->wk_d[r%2]);
+		sclSetKernelArg(dev->checkw_fwd, 2, sizeof(cl_mem), &dev->wn_d[(r+1)%2]);
+		sclSetKernelArg(dev->checkw_fwd, 3, sizeof(cl_mem), &dev->wk_d[(r+1)%2]);
+		sclSetKernelArg(dev->checkw_fwd, 7, sizeof(int), &r);
+		sclSetKernelArg(dev->checkw_fwd, 8, sizeof(int), &last);
+		sclEnqueueKernel(dev->check_hw, dev->checkw_fwd);
+	}
+
+	sclSetKernelArg(dev->checkw_back, 8, sizeof(cl_mem), &dev->sol_k_d[slot]);
+	sclSetKernelArg(dev->checkw_back, 9, sizeof(cl_mem), &dev->sol_val_d[slot]);
+	sclSetKernelArg(dev->checkw_back, 10, sizeof(cl_mem), &dev->counter_d[slot]);
+
+	for(int r=0; r<WAVE_BACK; ++r){
+		int last = (r == WAVE_BACK - 1);
+
+		sclSetKernelArg(dev->checkw_back, 0, sizeof(cl_mem), &dev->bn_d[r%2]);
+		sclSetKernelArg(dev->checkw_back, 1, sizeof(cl_mem), &dev->bk_d[r%2]);
+		sclSetKernelArg(dev->checkw_back, 2, sizeof(cl_mem), &dev->bn_d[(r+1)%2]);
+		sclSetKernelArg(dev->checkw_back, 3, sizeof(cl_mem), &dev->bk_d[(r+1)%2]);
+		sclSetKernelArg(dev->checkw_back, 5, sizeof(int), &r);
+		sclSetKernelArg(dev->checkw_back, 6, sizeof(int), &last);
+		if(last){
+			ev = sclEnqueueKernelEvent(dev->check_hw, dev->checkw_back);
+		}
+		else{
+			sclEnqueueKernel(dev->check_hw, dev->checkw_back);
+		}
+	}
+
+	return ev;
+}
+
+
+// sieve the chunk at p of n59buf into slot, then checkn it on check_hw
+void enqueueChunk(ap26_dev_t *dev, sclSoft &sieve, sclSoft &checkn, int slot, cl_mem *n59buf, int p, cl_event *sieveDone, cl_event *checkDone){
+
+	sclSetKernelArg(dev->clearn, 0, sizeof(cl_mem), &dev->counter_d[slot]);
+	sclEnqueueKernel(dev->hardware, dev->clearn);
+
+	sclSetKernelArg(sieve, 0, sizeof(cl_mem), n59buf);
+	sclSetKernelArg(sieve, 3, sizeof(cl_mem), &dev->n_result_d[slot]);
+	sclSetKernelArg(sieve, 5, sizeof(cl_mem), &dev->counter_d[slot]);
+	sclSetKernelArg(sieve, 6, sizeof(int), &p);
+
+	*sieveDone = sclEnqueueKernelEvent(dev->hardware, sieve);
+	clFlush(dev->hardware.queue);
+
+	if(dev->wave){
+		*checkDone = enqueueWave(dev, slot, n59buf, p, sieveDone);
+		return;
+	}
+
+	// checkn reads the sieve's n59 array to expand candidates
+	sclSetKernelArg(checkn, 0, sizeof(cl_mem), &dev->n_result_d[slot]);
+	sclSetKernelArg(checkn, 2, sizeof(cl_mem), &dev->sol_k_d[slot]);
+	sclSetKernelArg(checkn, 3, sizeof(cl_mem), &dev->sol_val_d[slot]);
+	sclSetKernelArg(checkn, 4, sizeof(cl_mem), &dev->counter_d[slot]);
+	sclSetKernelArg(checkn, 5, sizeof(cl_mem), n59buf);
+	sclSetKernelArg(checkn, 8, sizeof(int), &p);
+
+	*checkDone = sclEnqueueKernelWait(dev->check_hw, checkn, 1, sieveDone);
+}
+
+
+// chunks per us with d chunks in flight
+double chunkRate(ap26_dev_t *dev, cl_mem *n59buf, int d){
+
+	cl_event checkDone[MAXDEPTH];
+	cl_event sieveDone[MAXDEPTH];
+	int chunks = 6;
+
+	double start = usNow();
+
+	for(int c=0; c<chunks; ++c){
+		int slot = c % d;
+		if(c >= d){
+			waitOnEvent(dev->check_hw, checkDone[slot], NULL);
+			clReleaseEvent(sieveDone[slot]);
+		}
+		enqueueChunk(dev, dev->sieve, dev->checkn, slot, n59buf, (int)(c * dev->sieve.global_size[0]) % halfn59s, &sieveDone[slot], &checkDone[slot]);
+	}
+	for(int c = chunks - d; c < chunks; ++c){
+		int slot = c % d;
+		waitOnEvent(dev->check_hw, checkDone[slot], NULL);
+		clReleaseEvent(sieveDone[slot]);
+	}
+
+	return (double)chunks / (usNow() - start);
+}
+
+
+/* Time the sieve variants, local sizes, chunk sizes and pipeline depths on
+   the first K and keep the fastest.  The result is saved in TUNE_FILENAME so
+   later runs on the same device and driver skip this.
+*/
+void tuneSieve(ap26_dev_t *dev, uint64_t S59, int SHIFT, uint64_t S43, uint64_t S47, uint64_t S53){
+
+	cl_mem *n59buf = dev->lean ? &dev->n43_d : &dev->n59_0_d;
+	int p = 0;
+	int best_v = -1;
+	size_t best_local = 0;
+	double best_rate = 0.0;
+	double best_ms = 1.0;
+
+	// calculate approximate chunk size based on gpu's CU
+	// each n59 is sieved for all 640 shifts.  a CPU core sieves far fewer
+	uint64_t multiplier = dev->cpu ? 1024 : 20000;
+	uint64_t worksize = (uint64_t)dev->computeunits * multiplier;
+	if(worksize > halfn59s){
+		worksize = halfn59s;
+	}
+
+	dev->numn = maxsieve;
+	setCandidateCap(dev, dev->numn / 2);
+
+	// variant and local size, sieve kernel time only
+	for(int v=0; v<NUMVAR; ++v){
+		if(!dev->has_var[v]) continue;
+
+		sclSoft &sieve = dev->var[v];
+		size_t max_local = sieve.local_size[0];
+		size_t local = (v == VAR_NV || max_local < 64) ? max_local : 64;
+		size_t top = 1024;
+
+		// CPU work-groups run as loops over the work-items, try the SIMD widths
+		if(dev->cpu){
+			local = (max_local < 4) ? max_local : 4;
+			top = 64;
+		}
+
+		setSieveArgs(dev, sieve, v, S59, SHIFT, S43, S47, S53);
+		sclSetKernelArg(sieve, 0, sizeof(cl_mem), n59buf);
+		sclSetKernelArg(sieve, 3, sizeof(cl_mem), &dev->n_result_d[0]);
+		sclSetKernelArg(sieve, 5, sizeof(cl_mem), &dev->counter_d[0]);
+		sclSetKernelArg(sieve, 6, sizeof(int), &p);
+		sclSetKernelArg(dev->clearn, 0, sizeof(cl_mem), &dev->counter_d[0]);
+
+		// warm up, the first launch can include driver setup
+		setSieveSize( sieve, worksize );
+		sclEnqueueKernel(dev->hardware, dev->clearn);
+		ProfilesclEnqueueKernel(dev->hardware, sieve);
+
+		for(; local <= max_local && local <= top; local *= 2){
+			sieve.local_size[0] = local;
+			setSieveSize( sieve, worksize );
+
+			sclEnqueueKernel(dev->hardware, dev->clearn);
+			double ms = ProfilesclEnqueueKernel(dev->hardware, sieve);
+			if(ms == 0.0) ms = 0.001;
+
+			double rate = (double)sieve.global_size[0] / ms;
+			if(rate > best_rate){
+				best_rate = rate;
+				best_v = v;
+				best_local = local;
+				best_ms = ms;
+			}
+		}
+
+		sieve.local_size[0] = max_local;
+	}
+
+	// keep the winner
+	for(int v=0; v<NUMVAR; ++v){
+		if(dev->has_var[v] && v != best_v){
+			sclReleaseClSoft(dev->var[v]);
+			dev->has_var[v] = 0;
+		}
+	}
+	dev->variant = best_v;
+	dev->sieve = dev->var[best_v];
+	dev->sieve.local_size[0] = best_local;
+	setSieveSize( dev->sieve, worksize );
+	uint64_t base = dev->sieve.global_size[0];
+
+	// chunk size, up to the kernel runtime limit.  a smaller chunk within 5%
+	// is kept, it gives finer progress and shorter waits
+	double limit_ms = dev->COMPUTE ? 100.0 : 10.0;
+	double target[3] = { limit_ms / 4.0, limit_ms / 2.0, limit_ms };
+	uint64_t best_global = base;
+	best_rate = 0.0;
+
+	for(int t=0; t<3; ++t){
+		uint64_t range = (uint64_t)((double)base * target[t] / best_ms);
+		if(range > halfn59s){
+			range = halfn59s;
+		}
+		setSieveSize( dev->sieve, range );
+
+		sclEnqueueKernel(dev->hardware, dev->clearn);
+		double ms = ProfilesclEnqueueKernel(dev->hardware, dev->sieve);
+		if(ms == 0.0) ms = 0.001;
+
+		double rate = (double)dev->sieve.global_size[0] / ms;
+		if(rate > best_rate * 1.05){
+			best_rate = rate;
+			best_global = dev->sieve.global_size[0];
+		}
+	}
+	setSieveSize( dev->sieve, best_global );
+
+	dev->numn = dev->sieve.global_size[0];
+	setCandidateCap(dev, dev->numn / 2);
+	resetCounters(dev, MAXDEPTH);
+
+	// checkn or wavefront checkn, whole chunks at depth 1 so the PRP time counts
+	int best_wave = 0;
+	best_rate = 0.0;
+
+	for(int w=0; w<2; ++w){
+		dev->wave = w;
+
+		double rate = chunkRate(dev, n59buf, 1);
+		if(rate > best_rate){
+			best_rate = rate;
+			best_wave = w;
+		}
+	}
+	dev->wave = (wave_mode >= 0) ? wave_mode : best_wave;
+
+	// pipeline depth, sieve and checkn of a few chunks in flight
+	int best_depth = 1;
+	best_rate = 0.0;
+
+	for(int d=1; d<=3; ++d){
+		double rate = chunkRate(dev, n59buf, d);
+		if(rate > best_rate * 1.05){
+			best_rate = rate;
+			best_depth = d;
+		}
+	}
+
+	dev->tune_local = dev->sieve.local_size[0];
+	dev->tune_global = dev->sieve.global_size[0];
+	dev->tune_depth = best_depth;
+	dev->tune_wave = best_wave;
+	dev->tuned = 1;
+	save_tune(dev);
+
+	dev->depth = pipe_depth ? pipe_depth : best_depth;
+
+	if(boinc_is_standalone()){
+		if(num_devs > 1) printf("Device %d: ", dev->id);
+		printf("Tuned sieve %s, local size %u, chunk %u, depth %d, %s\n", var_names[dev->variant], (unsigned int)dev->sieve.local_size[0], (unsigned int)dev->sieve.global_size[0], best_depth, best_wave ? "wavefront checkn" : "checkn");
+	}
+	fprintf(stderr, "Tuned sieve %s, local size %u, chunk %u, depth %d, %s\n", var_names[dev->variant], (unsigned int)dev->sieve.local_size[0], (unsigned int)dev->sieve.global_size[0], best_depth, best_wave ? "wavefront checkn" : "checkn");
+
+	// the tuning chunks counted candidates and solutions, start clean
+	resetCounters(dev, MAXDEPTH);
+}
+
+
+/* -fused: sieve and PRP test each n59 array with sieve_fused, fused_range n59s
+   per launch.  The first launch uses the tuned sieve chunk and sizes the others
+   to the kernel runtime limit.  Candidates that overflow a work-group's list
+   are spilled to n_result_d[0] and tested by checkspill after the array.
+   Returns the number of launches.
+*/
+int searchFused(ap26_dev_t *dev, int K, int arrays, int arraysize, uint64_t STEP, uint64_t S59, int SHIFT, uint64_t S43, uint64_t S47, uint64_t S53, cl_ulong *prev_end, double *gap_ms, double *gap_max){
+
+	sclSoft &fused = dev->fused_k;
+	sclSoft &spill = dev->checkspill;
+	time_t last_time, curr_time;
+	double dd;
+	int launches = 0;
+	cl_event prev = NULL;
+
+	// the persistent grid is the tuned sieve launch, work-groups loop over the range
+	sclSetGlobalSize( fused, dev->sieve.global_size[0] - 1 );
+
+	sclSetKernelArg(fused, 1, sizeof(uint64_t), &S59);
+	sclSetKernelArg(fused, 2, sizeof(int), &SHIFT);
+	sclSetKernelArg(fused, 3, sizeof(cl_mem), &dev->n_result_d[0]);
+	sclSetKernelArg(fused, 4, sizeof(cl_mem), &dev->OKOK_d);
+	sclSetKernelArg(fused, 5, sizeof(cl_mem), &dev->counter_d[0]);
+	sclSetKernelArg(fused, 8, sizeof(cl_mem), &dev->work_d);
+	sclSetKernelArg(fused, 9, sizeof(uint64_t), &STEP);
+	sclSetKernelArg(fused, 10, sizeof(cl_mem), &dev->sol_k_d[0]);
+	sclSetKernelArg(fused, 11, sizeof(cl_mem), &dev->sol_val_d[0]);
+	sclSetKernelArg(fused, 12, sizeof(int), &dev->lean);
+	sclSetKernelArg(fused, 13, sizeof(uint64_t), &S43);
+	sclSetKernelArg(fused, 14, sizeof(uint64_t), &S47);
+	sclSetKernelArg(fused, 15, sizeof(uint64_t), &S53);
+
+	sclSetKernelArg(spill, 0, sizeof(cl_mem), &dev->n_result_d[0]);
+	sclSetKernelArg(spill, 1, sizeof(uint64_t), &STEP);
+	sclSetKernelArg(spill, 2, sizeof(cl_mem), &dev->sol_k_d[0]);
+	sclSetKernelArg(spill, 3, sizeof(cl_mem), &dev->sol_val_d[0]);
+	sclSetKernelArg(spill, 4, sizeof(cl_mem), &dev->counter_d[0]);
+	sclSetKernelArg(spill, 6, sizeof(uint64_t), &S59);
+	sclSetKernelArg(spill, 7, sizeof(int), &SHIFT);
+	sclSetKernelArg(spill, 8, sizeof(int), &dev->lean);
+	sclSetKernelArg(spill, 9, sizeof(uint64_t), &S43);
+	sclSetKernelArg(spill, 10, sizeof(uint64_t), &S47);
+	sclSetKernelArg(spill, 11, sizeof(uint64_t), &S53);
+
+	time (&last_time);
+
+	for(int devicearray=0; devicearray<arrays; devicearray++){
+
+		cl_mem *n59buf;
+		if(dev->lean){
+			n59buf = &dev->n43_d;
+		}
+		else if(devicearray == 0){
+			n59buf = &dev->n59_0_d;
+		}
+		else{
+			n59buf = &dev->n59_1_d;
+		}
+		sclSetKernelArg(fused, 0, sizeof(cl_mem), n59buf);
+		sclSetKernelArg(spill, 5, sizeof(cl_mem), n59buf);
+
+		// spills index this array, clear them per array
+		sclSetKernelArg(dev->clearn, 0, sizeof(cl_mem), &dev->counter_d[0]);
+		sclEnqueueKernel(dev->hardware, dev->clearn);
+
+		int p = 0;
+		while(p < arraysize){
+
+			int count = dev->fused_range ? dev->fused_range : (int)fused.global_size[0];
+			if(count > arraysize - p){
+				count = arraysize - p;
+			}
+
+			sclSetKernelArg(dev->clearn, 0, sizeof(cl_mem), &dev->work_d);
+			sclEnqueueKernel(dev->hardware, dev->clearn);
+
+			sclSetKernelArg(fused, 6, sizeof(int), &p);
+			sclSetKernelArg(fused, 7, sizeof(int), &count);
+			cl_event ev = sclEnqueueKernelEvent(dev->hardware, fused);
+			clFlush(dev->hardware.queue);
+			++launches;
+
+			if(dev->fused_range == 0){
+				// size the launches from the first one
+				cl_ulong t_start = 0, t_end = 0;
+				double limit_ms = dev->COMPUTE ? 100.0 : 10.0;
+
+				clWaitForEvents(1, &ev);
+				clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &t_start, NULL);
+				clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &t_end, NULL);
+
+				double ms = (t_end > t_start) ? (double)(t_end - t_start) / 1e6 : 0.001;
+				double range = (double)count * limit_ms / ms;
+				if(range > arraysize) range = arraysize;
+				if(range < count) range = count;
+				dev->fused_range = (int)range;
+
+				if(boinc_is_standalone()){
+					if(num_devs > 1) printf("Device %d: ", dev->id);
+					printf("Fused kernel: %d n59s in %.2f ms, %d per launch\n", count, ms, dev->fused_range);
+				}
+			}
+
+			// one launch in flight behind the running one
+			if(prev != NULL){
+				clRetainEvent(prev);
+				waitOnEvent(dev->hardware, prev, NULL);
+				sieveGap(prev, prev_end, gap_ms, gap_max);
+			}
+			prev = ev;
+
+			p += count;
+
+			// update BOINC progress every 2 sec, main does it per K in multi device mode
+			time (&curr_time);
+			if( dev->progress && ((int)curr_time - (int)last_time) > 1 ){
+				dd = ( (double)K_DONE + (double)(devicearray*arraysize + p) / numn59s ) / K_COUNT;
+				Progress(dd);
+				last_time = curr_time;
+			}
+		}
+
+		// test this array's spills
+		sclEnqueueKernel(dev->hardware, spill);
+	}
+
+	if(prev != NULL){
+		clRetainEvent(prev);
+		waitOnEvent(dev->hardware, prev, NULL);
+		sieveGap(prev, prev_end, gap_ms, gap_max);
+	}
+
+	return launches;
+}
+
+
+// K's 10840 n43 values, setupn and the lean sieve derive the n59s from them
+void setupN43(int K, uint64_t *n43_h){
 
 	int i3, i5, i31, i37, i41;
-	uint64_t S31, S37, S41, S43, S47, S53, S59;
-	double d = (double)1.0 / (K_COUNT*10);
+
+	uint64_t n0=(N0*(K%17835)+((N0*17835)%MOD)*(K/17835)+N30)%MOD;
+	uint64_t S31=(PRES2*(K%17835)+((PRES2*17835)%MOD)*(K/17835))%MOD;
+	uint64_t S37=(PRES3*(K%17835)+((PRES3*17835)%MOD)*(K/17835))%MOD;
+	uint64_t S41=(PRES4*(K%17835)+((PRES4*17835)%MOD)*(K/17835))%MOD;
+
+	int count=0;
+
+	for(i31=0;i31<7;++i31)
+	for(i37=0;i37<13;++i37)
+	if(i37-i31<=10&&i31-i37<=4)
+	for(i41=0;i41<17;++i41)
+	if(i41-i31<=14&&i41-i37<=14&&i31-i41<=4&&i37-i41<=10)
+	for(i3=0;i3<2;++i3)
+	for(i5=0;i5<4;++i5){ 
+		n43_h[count]=(n0+i3*S3+i5*S5+i31*S31+i37*S37+i41*S41)%MOD;  //10840 of these  12673 n53 per
+		count++;
+	}
+}
+
+
+// search chunk ch of the K again in slot and wait for it
+void rerunChunk(ap26_dev_t *dev, sclSoft &sieve, sclSoft &checkn, int slot, int ch, int per_array){
+
+	int devicearray = ch / per_array;
+	int p = (ch % per_array) * (int)sieve.global_size[0];
+
+	cl_mem *n59buf;
+	if(dev->lean){
+		n59buf = &dev->n43_d;
+	}
+	else if(devicearray == 0){
+		n59buf = &dev->n59_0_d;
+	}
+	else{
+		n59buf = &dev->n59_1_d;
+	}
+
+	cl_event sieveDone, checkDone;
+	enqueueChunk(dev, sieve, checkn, slot, n59buf, p, &sieveDone, &checkDone);
+	waitOnEvent(dev->check_hw, checkDone, NULL);
+	clReleaseEvent(sieveDone);
+}
+
+
+/* checkn lists the chunks with more candidates than the buffer holds in
+   their slot's counters, from counter[8].  Grow the buffer to the largest
+   count seen plus a quarter and search those chunks again, or every chunk
+   of the slot when more than OVF_MAX overflowed.  The K had chunks chunks,
+   chunk c used slot c % depth.  Returns the number of chunks rerun.
+*/
+int rerunOverflow(ap26_dev_t *dev, sclSoft &sieve, sclSoft &checkn, int chunks, int arraysize){
+
+	int per_array = (arraysize + (int)sieve.global_size[0] - 1) / (int)sieve.global_size[0];
+	int rerun = 0;
+
+	for(int slot=0; slot<dev->depth; ++slot){
+
+		int c[NUMCOUNTERS];
+		sclRead(dev->hardware, NUMCOUNTERS * sizeof(int), dev->counter_d[slot], c);
+
+		int over = c[6];
+		if(over == 0){
+			continue;
+		}
+
+		int grow = c[1] + c[1] / 4;
+		if(grow > dev->ncap){
+			setCandidateCap(dev, grow);
+			checkn.global_size[0] = dev->checkn.global_size[0];
+		}
+
+		// the whole slot is searched again, its solutions, largest count and
+		// chunk numbers too.  single chunk reruns keep them, the largest count
+		// covers the chunks that aren't rerun and a rerun can't overflow again
+		if(over > OVF_MAX){
+			c[1] = 0;
+			c[2] = 0;
+			c[3] = 0;
+			c[5] = 0;
+			c[7] = 0;
+		}
+		c[4] = dev->ncap;
+		c[6] = 0;
+		sclWrite(dev->hardware, NUMCOUNTERS * sizeof(int), dev->counter_d[slot], c);
+
+		// chunk numbers in the slot count from 1
+		if(over <= OVF_MAX){
+			for(int o=0; o<over; ++o){
+				rerunChunk(dev, sieve, checkn, slot, (c[8 + o] - 1) * dev->depth + slot, per_array);
+			}
+			rerun += over;
+		}
+		else{
+			for(int ch=slot; ch<chunks; ch+=dev->depth){
+				rerunChunk(dev, sieve, checkn, slot, ch, per_array);
+				++rerun;
+			}
+		}
+	}
+
+	return rerun;
+}
+
+
+/* -cpu, the CPU threads' share of a K, searched beside the device.
+*/
+typedef struct {
+	int K, SHIFT;
+	double secs;
+} cpu_part_t;
+
+static void *cpu_part_thread(void *arg)
+{
+	cpu_part_t *cp = (cpu_part_t *)arg;
+	double start = usNow();
+
+	SearchCPU(cp->K, cp->SHIFT, K_COUNT, K_DONE, cpu_threads);
+	cp->secs = (usNow() - start) / 1e6;
+
+	return NULL;
+}
+
+
+static int cpu_sol_compare(const void *a, const void *b)
+{
+	const sol_t *x = (const sol_t *)a, *y = (const sol_t *)b;
+
+	if(x->First_Term != y->First_Term) return (x->First_Term < y->First_Term) ? -1 : 1;
+	return x->AP_Length - y->AP_Length;
+}
+
+
+// move the CPU threads' raw APs to res, in First_Term order so the results
+// file doesn't depend on which thread found them
+static void collectCPU(kres_t *res)
+{
+	int count = TakeSolutions(NULL, cpu_threads);
+
+	if(count > res->cpu_size){
+		res->cpu_size = count;
+		res->cpu_sol = (sol_t*)realloc(res->cpu_sol, count * sizeof(sol_t));
+		if(res->cpu_sol == NULL){
+			fprintf(stderr,"Error: solution buffer allocation failed\n");
+			printf("Error: solution buffer allocation failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	res->cpu_nsol = TakeSolutions(res->cpu_sol, cpu_threads);
+
+	qsort(res->cpu_sol, res->cpu_nsol, sizeof(sol_t), cpu_sol_compare);
+}
+
+
+/* Move the -cpu split so the device and the CPU threads take the same time on
+   the next K, from the n43 per second each did on this one averaged with the
+   rates so far.  The CPU threads keep at least one n43 each.
+*/
+static void balanceCPU(ap26_dev_t *dev, double gpu_secs, double cpu_secs)
+{
+	double g = dev->cpu_n43 / ((gpu_secs > 0.001) ? gpu_secs : 0.001);
+	double c = (numn43s - dev->cpu_n43) / ((cpu_secs > 0.001) ? cpu_secs : 0.001);
+
+	if(dev->gpu_rate > 0){
+		g = (g + dev->gpu_rate) / 2;
+		c = (c + dev->cpu_rate) / 2;
+	}
+	dev->gpu_rate = g;
+	dev->cpu_rate = c;
+
+	int split = (int)(numn43s * g / (g + c));
+	if(split > numn43s - cpu_threads) split = numn43s - cpu_threads;
+	if(split < 1) split = 1;
+
+	dev->cpu_n43 = split;
+}
+
+
+kres_t *SearchAP26(ap26_dev_t *dev, int K, int startSHIFT)
+{ 
+
+	uint64_t STEP;
+	uint64_t S43, S47, S53, S59;
 	double dd;
 	int SHIFT=startSHIFT;
-//	uint64_t totaln = 0;
 
 	time_t total_start_time, total_finish_time;
 	time_t last_time, curr_time;
@@ -122,280 +884,488 @@ void SearchAP26(int K, int startSHIFT, int & profile, uint32_t CU, int COMPUTE)
 	
 */
 
-	STEP=K*PRIM23;
-	n0=(N0*(K%17835)+((N0*17835)%MOD)*(K/17835)+N30)%MOD;
-	S31=(PRES2*(K%17835)+((PRES2*17835)%MOD)*(K/17835))%MOD;
-	S37=(PRES3*(K%17835)+((PRES3*17835)%MOD)*(K/17835))%MOD;
-	S41=(PRES4*(K%17835)+((PRES4*17835)%MOD)*(K/17835))%MOD;
-	S43=(PRES5*(K%17835)+((PRES5*17835)%MOD)*(K/17835))%MOD;
-	S47=(PRES6*(K%17835)+((PRES6*17835)%MOD)*(K/17835))%MOD;
-	S53=(PRES7*(K%17835)+((PRES7*17835)%MOD)*(K/17835))%MOD;
-	S59=(PRES8*(K%17835)+((PRES8*17835)%MOD)*(K/17835))%MOD;
+	kconst_t kc;
+	getKconst(K, &kc);
 
+	STEP=kc.STEP;
+	S43=kc.S43;
+	S47=kc.S47;
+	S53=kc.S53;
+	S59=kc.S59;
 
-	int count=0;
 
-	for(i31=0;i31<7;++i31)
-	for(i37=0;i37<13;++i37)
-	if(i37-i31<=10&&i31-i37<=4)
-	for(i41=0;i41<17;++i41)
-	if(i41-i31<=14&&i41-i37<=14&&i31-i41<=4&&i37-i41<=10)
-	for(i3=0;i3<2;++i3)
-	for(i5=0;i5<4;++i5){ 
-		n43_h[count]=(n0+i3*S3+i5*S5+i31*S31+i37*S37+i41*S41)%MOD;  //10840 of these  12673 n53 per
-		count++;
+	// this K's results.  zero-copy devices write them straight into its buffers
+	kres_t *res = &dev->res[dev->res_next];
+	dev->res_next = (dev->res_next + 1) % dev->numres;
+
+	if(dev->zerocopy){
+		for(int slot=0; slot<MAXDEPTH; ++slot){
+			dev->counter_d[slot] = res->counter_d[slot];
+			dev->sol_k_d[slot] = res->sol_k_d[slot];
+			dev->sol_val_d[slot] = res->sol_val_d[slot];
+		}
+	}
+
+	// zero-copy devices fill n43_d in place
+	uint64_t *n43_h = dev->n43_h;
+	if(dev->zerocopy){
+		n43_h = (uint64_t*)mapBuffer(dev->hardware, dev->n43_d, CL_TRUE, CL_MAP_WRITE, numn43s * sizeof(uint64_t), NULL);
 	}
 
+	setupN43(K, n43_h);
+
 	// offload to gpu, blocking
-	sclWrite(hardware, numn43s * sizeof(uint64_t), n43_d, n43_h);
-
-	// setup n59s kernel
-	sclSetKernelArg(setupn, 0, sizeof(cl_mem), &n43_d);
-	sclSetKernelArg(setupn, 1, sizeof(cl_mem), &n59_0_d);
-	sclSetKernelArg(setupn, 2, sizeof(cl_mem), &n59_1_d);
-	sclSetKernelArg(setupn, 3, sizeof(uint64_t), &S53);
-	sclSetKernelArg(setupn, 4, sizeof(uint64_t), &S47);
-	sclSetKernelArg(setupn, 5, sizeof(uint64_t), &S43);
-	sclEnqueueKernel(hardware, setupn);
+	if(dev->zerocopy){
+		clEnqueueUnmapMemObject(dev->hardware.queue, dev->n43_d, n43_h, 0, NULL, NULL);
+	}
+	else{
+		sclWrite(dev->hardware, numn43s * sizeof(uint64_t), dev->n43_d, n43_h);
+	}
+
+	// setup n59s kernel, the lean sieve computes them itself
+	if(!dev->lean){
+		sclSetKernelArg(dev->setupn, 0, sizeof(cl_mem), &dev->n43_d);
+		sclSetKernelArg(dev->setupn, 1, sizeof(cl_mem), &dev->n59_0_d);
+		sclSetKernelArg(dev->setupn, 2, sizeof(cl_mem), &dev->n59_1_d);
+		sclSetKernelArg(dev->setupn, 3, sizeof(uint64_t), &S53);
+		sclSetKernelArg(dev->setupn, 4, sizeof(uint64_t), &S47);
+		sclSetKernelArg(dev->setupn, 5, sizeof(uint64_t), &S43);
+		sclEnqueueKernel(dev->hardware, dev->setupn);
+	}
 	// end setup n59s
 
+	// S59 mod the primes the incremental sieve keeps residues for
+	if(dev->has_var[VAR_INC]){
+		uint32_t S59p[10];
+
+		for(int j=0; j<10; ++j){
+			S59p[j] = (uint32_t)(S59 % inc_p[j]);
+		}
+
+		sclWrite(dev->hardware, 10 * sizeof(uint32_t), dev->S59p_d, S59p);
+	}
+
 	// offset kernel
-	sclSetKernelArg(offset, 0, sizeof(cl_mem), &offset_d);
-	sclEnqueueKernel(hardware, offset);
+	sclSetKernelArg(dev->offset, 0, sizeof(cl_mem), &dev->offset_d);
+	sclEnqueueKernel(dev->hardware, dev->offset);
 	// end offset
 
 	// clearok kernel
-	sclSetKernelArg(clearok, 0, sizeof(cl_mem), &OK_d);
-	sclSetKernelArg(clearok, 1, sizeof(cl_mem), &counter_d);
-	sclEnqueueKernel(hardware, clearok);
+	sclSetKernelArg(dev->clearok, 0, sizeof(cl_mem), &dev->OK_d);
+	sclSetKernelArg(dev->clearok, 1, sizeof(cl_mem), &dev->counter_d[0]);
+	sclEnqueueKernel(dev->hardware, dev->clearok);
 	// end clearok
 
+	// clear the slots' counters, the tuner may use all of them
+	resetCounters(dev, dev->profile ? MAXDEPTH : dev->depth);
+
 	// setupok kernel
-	sclSetKernelArg(setupok, 0, sizeof(uint64_t), &STEP);
-	sclSetKernelArg(setupok, 1, sizeof(cl_mem), &OK_d);
-	sclSetKernelArg(setupok, 2, sizeof(cl_mem), &offset_d);
-	sclEnqueueKernel(hardware, setupok);
+	sclSetKernelArg(dev->setupok, 0, sizeof(uint64_t), &STEP);
+	sclSetKernelArg(dev->setupok, 1, sizeof(cl_mem), &dev->OK_d);
+	sclSetKernelArg(dev->setupok, 2, sizeof(cl_mem), &dev->offset_d);
+	sclEnqueueKernel(dev->hardware, dev->setupok);
 	// end setupok
 
-	// profile gpu sieve kernel time, once at program start
-	if(profile){
-		double kernel_ms = 0.0;
-		profile = 0;
+	// all 640 shifts are sieved in one pass, each OKOK entry is 10 words
+	sclSetKernelArg(dev->clearokok, 0, sizeof(cl_mem), &dev->OKOK_d);
+	sclEnqueueKernel(dev->hardware, dev->clearokok);
+
+	sclSetKernelArg(dev->setupokok, 0, sizeof(int), &SHIFT);
+	sclSetKernelArg(dev->setupokok, 1, sizeof(cl_mem), &dev->OK_d);
+	sclSetKernelArg(dev->setupokok, 2, sizeof(cl_mem), &dev->OKOK_d);
+	sclSetKernelArg(dev->setupokok, 3, sizeof(cl_mem), &dev->offset_d);
+	sclEnqueueKernel(dev->hardware, dev->setupokok);
+
+	// set static kernel args
+	setCheckArgs(dev, dev->checkn, STEP, S59, SHIFT, S43, S47, S53);
+	setWaveArgs(dev, STEP, S59, SHIFT, S43, S47, S53);
+
+	// pick the sieve setup on the first K of an untuned device
+	if(dev->profile){
+		dev->profile = 0;
+		tuneSieve(dev, S59, SHIFT, S43, S47, S53);
+	}
+
+	// -ncap, every K starts with a small candidate buffer so its chunks overflow
+	if(start_cap && !dev->fused){
+		setCandidateCap(dev, start_cap);
+		resetCounters(dev, dev->depth);
+	}
 
-		// calculate approximate chunk size based on gpu's CU
-		uint64_t multiplier = 200000;
-		uint64_t worksize = CU * multiplier;
-		if(worksize > halfn59s){
-			worksize = halfn59s;
+	// with -kspec use the kernels built for this K during the previous one
+	sclSoft sieve = dev->sieve;
+	sclSoft checkn = dev->checkn;
+
+	if(kspec_mode && !dev->fused && kspec_begin(dev, K, SHIFT)){
+		sieve.program = dev->ks_cur.sieve.program;
+		sieve.kernel = dev->ks_cur.sieve.kernel;
+		checkn.program = dev->ks_cur.checkn.program;
+		checkn.kernel = dev->ks_cur.checkn.kernel;
+		setCheckArgs(dev, checkn, STEP, S59, SHIFT, S43, S47, S53);
+	}
+
+	// -cpu leaves the n43s from cpu_n43 up to the CPU threads, the device's
+	// lean sieve stops at the first of their n59s
+	if(cpu_threads){
+		dev->n59_limit = dev->cpu_n43 * 12673;
+	}
+
+	setSieveArgs(dev, sieve, dev->variant, S59, SHIFT, S43, S47, S53);
+
+	cpu_part_t cp;
+	pthread_t cpu_thread;
+	double gpu_start = usNow();
+
+	if(cpu_threads){
+		cp.K = K;
+		cp.SHIFT = SHIFT;
+		n43_start = dev->cpu_n43;
+		n43_stop = numn43s;
+		if(pthread_create(&cpu_thread, NULL, cpu_part_thread, &cp)){
+			fprintf(stderr,"Error: pthread_create failed\n");
+			printf("Error: pthread_create failed\n");
+			exit(EXIT_FAILURE);
 		}
+	}
 
-		sclSetGlobalSize( sieve, worksize );
+	time (&last_time);
 
-		uint64_t estimated = sieve.global_size[0];
+	// chunk c uses pipeline slot c % depth.  the sieve runs on the device queue and checkn
+	// on check_hw after the sieve's event, so checkn of one chunk overlaps the sieve of the
+	// next.  a slot is reused once its checkn is done, this also limits the queue depth
+	cl_event checkDone[MAXDEPTH];
+	cl_event sieveDone[MAXDEPTH];
+	for(int slot=0; slot<dev->depth; ++slot){
+		checkDone[slot] = NULL;
+		sieveDone[slot] = NULL;
+	}
+	int chunk = 0;
 
-		// set n result array size
-		numn = sieve.global_size[0] / 2;
+	// gpu idle time between sieve chunks
+	cl_ulong prev_end = 0;
+	double gap_ms = 0.0, gap_max = 0.0;
 
-		// allocate
-		n_result_d = sclMalloc(hardware, CL_MEM_READ_WRITE, numn * sizeof(uint64_t));
+	// the lean sieve indexes all n59s from n43_d in one range
+	int arrays = dev->lean ? 1 : 2;
+	int arraysize = dev->lean ? dev->n59_limit : halfn59s;
 
-		// clearokok kernel
-		sclSetKernelArg(clearokok, 0, sizeof(cl_mem), &OKOK_d);
-		sclEnqueueKernel(hardware, clearokok);
-		// end clearokok
+	// -fused searches the whole K in sieve_fused launches instead of chunks
+	int launches = 0;
+	if(dev->fused){
+		launches = searchFused(dev, K, arrays, arraysize, STEP, S59, SHIFT, S43, S47, S53, &prev_end, &gap_ms, &gap_max);
+		arrays = 0;
+	}
 
-		// setupokok kernel
-		sclSetKernelArg(setupokok, 0, sizeof(int), &SHIFT);
-		sclSetKernelArg(setupokok, 1, sizeof(cl_mem), &OK_d);
-		sclSetKernelArg(setupokok, 2, sizeof(cl_mem), &OKOK_d);
-		sclSetKernelArg(setupokok, 3, sizeof(cl_mem), &offset_d);
-		sclEnqueueKernel(hardware, setupokok);
-		// end setupokok
+	for(int devicearray=0; devicearray<arrays; devicearray++){
+		for(int p=0; p<arraysize; p+=sieve.global_size[0] ){
 
-		//set static kernel args
-		sclSetKernelArg(clearn, 0, sizeof(cl_mem), &counter_d);
+			int slot = chunk % dev->depth;
+			++chunk;
 
-		int p=0;
-		sclSetKernelArg(sieve, 0, sizeof(cl_mem), &n59_0_d);
-		sclSetKernelArg(sieve, 1, sizeof(uint64_t), &S59);
-		sclSetKernelArg(sieve, 2, sizeof(int), &SHIFT);
-		sclSetKernelArg(sieve, 3, sizeof(cl_mem), &n_result_d);
-		sclSetKernelArg(sieve, 4, sizeof(cl_mem), &OKOK_d);
-		sclSetKernelArg(sieve, 5, sizeof(cl_mem), &counter_d);
-		sclSetKernelArg(sieve, 6, sizeof(int), &p);
+			if(checkDone[slot] != NULL){
+				// sleep cpu until this slot's checkn is done
+				waitOnEvent(dev->check_hw, checkDone[slot], &dev->wait_us);
+				checkDone[slot] = NULL;
+				sieveGap(sieveDone[slot], &prev_end, &gap_ms, &gap_max);
+			}
 
-		sclEnqueueKernel(hardware, clearn);
-		kernel_ms = ProfilesclEnqueueKernel(hardware, sieve);
+			// update BOINC progress every 2 sec, main does it per K in multi device mode
+			time (&curr_time);
+			if( dev->progress && ((int)curr_time - (int)last_time) > 1 ){
+				dd = ( (double)K_DONE + (double)(devicearray*arraysize + p) / numn59s ) / K_COUNT;
+				Progress(dd);
+				last_time = curr_time;
+			}
 
-		if(kernel_ms == 0.0) kernel_ms = 1.0;
+			cl_mem *n59buf;
+			if(dev->lean){
+				n59buf = &dev->n43_d;
+			}
+			else if(devicearray == 0){
+				n59buf = &dev->n59_0_d;
+			}
+			else{
+				n59buf = &dev->n59_1_d;
+			}
 
-		double multi = COMPUTE?(100.0 / kernel_ms):(10.0 / kernel_ms);
+			enqueueChunk(dev, sieve, checkn, slot, n59buf, p, &sieveDone[slot], &checkDone[slot]);
 
-		uint64_t new_range = (uint64_t)((double)sieve.global_size[0] * multi);
-		if(new_range > halfn59s){
-			new_range = halfn59s;
 		}
 
-		sclSetGlobalSize( sieve, new_range );
-
-		// adjust n result array size
-		sclReleaseMemObject(n_result_d);
-		numn = sieve.global_size[0] / 2;
-		n_result_d = sclMalloc(hardware, CL_MEM_READ_WRITE, numn * sizeof(uint64_t));
+	}
 
-		sclSetGlobalSize( checkn, numn );
 
+	// sleep CPU thread while GPU is busy, oldest chunk first
+	for(int c = (chunk > dev->depth) ? chunk - dev->depth : 0; c < chunk; ++c){
+		int slot = c % dev->depth;
+		waitOnEvent(dev->check_hw, checkDone[slot], &dev->wait_us);
+		sieveGap(sieveDone[slot], &prev_end, &gap_ms, &gap_max);
 	}
+	sleepCPU(dev->hardware);
+
+	// chunks that overflowed the candidate buffer, rerun with a larger one
+	if(!dev->fused){
+		int rerun = rerunOverflow(dev, sieve, checkn, chunk, arraysize);
+		if(rerun){
+			if(boinc_is_standalone()){
+				if(num_devs > 1) printf("Device %d: ", dev->id);
+				printf("K %d: %d chunks overflowed the candidate buffer, rerun with %d entries\n", K, rerun, dev->ncap);
+			}
+			fprintf(stderr, "K %d: %d chunks overflowed the candidate buffer, rerun with %d entries\n", K, rerun, dev->ncap);
+		}
+	}
+	chunk += launches;
 
+	// wait for the CPU threads' n43s and split the next K by the time both took
+	if(cpu_threads){
+		double gpu_secs = (usNow() - gpu_start) / 1e6;
 
-	// set static kernel args
-	sclSetKernelArg(clearokok, 0, sizeof(cl_mem), &OKOK_d);
+		pthread_join(cpu_thread, NULL);
+		collectCPU(res);
 
-	sclSetKernelArg(setupokok, 1, sizeof(cl_mem), &OK_d);
-	sclSetKernelArg(setupokok, 2, sizeof(cl_mem), &OKOK_d);
-	sclSetKernelArg(setupokok, 3, sizeof(cl_mem), &offset_d);
+		if(boinc_is_standalone()){
+			printf("K %d: device %d n43s in %.1f sec, %d CPU threads %d n43s in %.1f sec\n", K, dev->cpu_n43, gpu_secs, cpu_threads, numn43s - dev->cpu_n43, cp.secs);
+		}
 
-	sclSetKernelArg(clearn, 0, sizeof(cl_mem), &counter_d);
+		balanceCPU(dev, gpu_secs, cp.secs);
+	}
 
-	sclSetKernelArg(sieve, 1, sizeof(uint64_t), &S59);
-	sclSetKernelArg(sieve, 3, sizeof(cl_mem), &n_result_d);
-	sclSetKernelArg(sieve, 4, sizeof(cl_mem), &OKOK_d);
-	sclSetKernelArg(sieve, 5, sizeof(cl_mem), &counter_d);
+	// read the results into pinned memory, or map them on zero-copy devices,
+	// without blocking.  the validation pool checks and reports them while the
+	// next K's kernels run
+	res->K = K;
+	res->depth = dev->depth;
+	res->numn = dev->fused ? dev->nbuf / 2 : dev->ncap;
+	res->cksum = 0;
+	res->aps = 0;
+	res->k_nsol = 0;
+
+	for(int slot=0; slot<dev->depth; ++slot){
+		cl_event *ev = (slot == dev->depth - 1) ? &res->read_done : NULL;
+
+		if(dev->zerocopy){
+			res->counter_h[slot] = (int*)mapBuffer(dev->hardware, res->counter_d[slot], CL_FALSE, CL_MAP_READ, READCOUNTERS * sizeof(int), NULL);
+			res->sol_k_h[slot] = (int*)mapBuffer(dev->hardware, res->sol_k_d[slot], CL_FALSE, CL_MAP_READ, sol * sizeof(int), NULL);
+			res->sol_val_h[slot] = (uint64_t*)mapBuffer(dev->hardware, res->sol_val_d[slot], CL_FALSE, CL_MAP_READ, sol * sizeof(uint64_t), ev);
+			continue;
+		}
 
-	sclSetKernelArg(checkn, 0, sizeof(cl_mem), &n_result_d);
-	sclSetKernelArg(checkn, 1, sizeof(uint64_t), &STEP);
-	sclSetKernelArg(checkn, 2, sizeof(cl_mem), &sol_k_d);
-	sclSetKernelArg(checkn, 3, sizeof(cl_mem), &sol_val_d);
-	sclSetKernelArg(checkn, 4, sizeof(cl_mem), &counter_d);
+		clEnqueueReadBuffer(dev->hardware.queue, dev->counter_d[slot], CL_FALSE, 0, READCOUNTERS * sizeof(int), res->counter_h[slot], 0, NULL, NULL);
+		clEnqueueReadBuffer(dev->hardware.queue, dev->sol_k_d[slot], CL_FALSE, 0, sol * sizeof(int), res->sol_k_h[slot], 0, NULL, NULL);
+		clEnqueueReadBuffer(dev->hardware.queue, dev->sol_val_d[slot], CL_FALSE, 0, sol * sizeof(uint64_t), res->sol_val_h[slot], 0, NULL, ev);
+	}
+	res->mapped = dev->zerocopy;
+	clFlush(dev->hardware.queue);
 
-	time (&last_time);
+	time(&total_finish_time);
+	res->secs = (int)total_finish_time - (int)total_start_time;
 
-	uint32_t iteration = 0;
+	queue_result(res);
 
-	cl_event launchEvent = NULL;
-	int iter = 0;
+	if(boinc_is_standalone()){
+		if(num_devs > 1) printf("Device %d: ", dev->id);
+		printf("K %d sieve idle between %d chunks: %.2f ms total, %.3f ms max\n", K, chunk, gap_ms, gap_max);
+	}
 
-	for(; SHIFT<(startSHIFT+640); SHIFT+=64){
+	return res;
+}
 
-		sclEnqueueKernel(hardware, clearokok);
 
-		sclSetKernelArg(setupokok, 0, sizeof(int), &SHIFT);
-		sclEnqueueKernel(hardware, setupokok);
+/* Search the nk K of a batch, -batch.  Every launch sieves the same n59
+   range of each K, so the n43 and table setup, the pipeline drain and the
+   result reads are paid once per batch instead of once per K.  res gets
+   each K's results, queued for validation like SearchAP26's.
+*/
+void SearchBatch(ap26_dev_t *dev, int *Ks, int nk, int SHIFT, kres_t **res)
+{
+	double dd;
+	time_t total_start_time, total_finish_time;
+	time_t last_time, curr_time;
 
-		for(int devicearray=0; devicearray<2; devicearray++){
-			for(int p=0; p<halfn59s; p+=sieve.global_size[0] ){
+	time (&total_start_time);
 
-				if(iter == 3){
-					// sleep cpu while waiting on iter 0 kernel launch event to complete
-					// iter 1,2 kernels will be running on gpu while cpu queues more kernels
-					// this way we limit the queue depth and prevent stalling the gpu
-					waitOnEvent(hardware, launchEvent);
-					iter = 0;
-				}
+	// constants and n43 values of the batch's K, one write each
+	for(int b=0; b<nk; ++b){
+		kconst_t kc;
+		getKconst(Ks[b], &kc);
 
-				// update BOINC progress every 2 sec
-				time (&curr_time);
-				if( ((int)curr_time - (int)last_time) > 1 ){
-		    			dd = (double)(K_DONE*10+iteration) * d;
-					Progress(dd);
-					last_time = curr_time;
-				}
+		uint64_t *k = dev->kc_h + b*KC_WORDS;
+		k[0] = kc.STEP;
+		k[1] = kc.S43;
+		k[2] = kc.S47;
+		k[3] = kc.S53;
+		k[4] = kc.S59;
 
-				sclEnqueueKernel(hardware, clearn);
+		setupN43(Ks[b], dev->n43b_h + b*numn43s);
+	}
+	sclWrite(dev->hardware, nk * KC_WORDS * sizeof(uint64_t), dev->kc_d, dev->kc_h);
+	sclWrite(dev->hardware, nk * numn43s * sizeof(uint64_t), dev->n43_d, dev->n43b_h);
 
-				if(devicearray == 0){
-					sclSetKernelArg(sieve, 0, sizeof(cl_mem), &n59_0_d);
-				}
-				else if(devicearray == 1){
-					sclSetKernelArg(sieve, 0, sizeof(cl_mem), &n59_1_d);
-				}
-				sclSetKernelArg(sieve, 2, sizeof(int), &SHIFT);
-				sclSetKernelArg(sieve, 6, sizeof(int), &p);
+	// offset kernel
+	sclSetKernelArg(dev->offset, 0, sizeof(cl_mem), &dev->offset_d);
+	sclEnqueueKernel(dev->hardware, dev->offset);
+
+	// every K's OK and OKOK tables, one launch per step
+	dev->clearok_b.global_size[1] = nk;
+	sclSetKernelArg(dev->clearok_b, 0, sizeof(cl_mem), &dev->OK_d);
+	sclEnqueueKernel(dev->hardware, dev->clearok_b);
+
+	dev->setupok_b.global_size[1] = nk;
+	sclSetKernelArg(dev->setupok_b, 0, sizeof(cl_mem), &dev->kc_d);
+	sclSetKernelArg(dev->setupok_b, 1, sizeof(cl_mem), &dev->OK_d);
+	sclSetKernelArg(dev->setupok_b, 2, sizeof(cl_mem), &dev->offset_d);
+	sclEnqueueKernel(dev->hardware, dev->setupok_b);
+
+	dev->clearokok_b.global_size[1] = nk;
+	sclSetKernelArg(dev->clearokok_b, 0, sizeof(cl_mem), &dev->OKOK_d);
+	sclEnqueueKernel(dev->hardware, dev->clearokok_b);
+
+	dev->setupokok_b.global_size[1] = nk;
+	sclSetKernelArg(dev->setupokok_b, 0, sizeof(int), &SHIFT);
+	sclSetKernelArg(dev->setupokok_b, 1, sizeof(cl_mem), &dev->OK_d);
+	sclSetKernelArg(dev->setupokok_b, 2, sizeof(cl_mem), &dev->OKOK_d);
+	sclSetKernelArg(dev->setupokok_b, 3, sizeof(cl_mem), &dev->offset_d);
+	sclEnqueueKernel(dev->hardware, dev->setupokok_b);
+
+	// the tuned chunk is split between the K, seg n59s of each per launch
+	sclSoft sieve = dev->sieve_b;
+	sclSoft checkn = dev->checkn_b;
+
+	if(dev->sieve.local_size[0] < sieve.local_size[0]){
+		sieve.local_size[0] = dev->sieve.local_size[0];
+	}
+	int seg = (int)(dev->sieve.global_size[0] / nk / sieve.local_size[0] * sieve.local_size[0]);
+	if(seg < (int)sieve.local_size[0]){
+		seg = (int)sieve.local_size[0];
+	}
 
-				if(iter == 0){
-					launchEvent = sclEnqueueKernelEvent(hardware, sieve);
-				}
-				else{
-					sclEnqueueKernel(hardware, sieve);
-				}
-				++iter;
+	// K b's candidates go to n_result_d[slot] from b*cap.  a batch can't
+	// rerun an overflowed chunk, each K gets the whole segment
+	int cap = seg;
+	if(nk * cap > dev->nbuf){
+		setCandidateCap(dev, nk * cap);
+	}
 
+	// each slot has 8 counters per K, [4] is the K's candidate buffer size
+	int header[MAXBATCH * 8] = { 0 };
+	for(int b=0; b<nk; ++b){
+		header[b*8 + 4] = cap;
+	}
+	for(int slot=0; slot<dev->depth; ++slot){
+		sclWrite(dev->hardware, nk * 8 * sizeof(int), dev->counterb_d[slot], header);
+	}
 
-/*				int* numbern = (int*)malloc(3 * sizeof(int));
-				sclRead(hardware, 3 * sizeof(int), counter_d, numbern);
-				totaln += (int64_t)numbern[0];
-				printf("K: %d narray size: %d of max %d\n",K,numbern[0],numn);
-				free(numbern);
-*/
+	// seg is a multiple of the local size, don't round it up
+	sclSetGlobalSize( sieve, seg - 1 );
+	sclSetGlobalSize( checkn, cap );
+	sieve.global_size[1] = nk;
+	checkn.global_size[1] = nk;
 
-				sclEnqueueKernel(hardware, checkn);
+	sclSetKernelArg(sieve, 0, sizeof(cl_mem), &dev->n43_d);
+	sclSetKernelArg(sieve, 1, sizeof(cl_mem), &dev->kc_d);
+	sclSetKernelArg(sieve, 2, sizeof(int), &SHIFT);
+	sclSetKernelArg(sieve, 4, sizeof(cl_mem), &dev->OKOK_d);
+	sclSetKernelArg(sieve, 7, sizeof(int), &seg);
 
-			}
+	sclSetKernelArg(checkn, 1, sizeof(cl_mem), &dev->kc_d);
+	sclSetKernelArg(checkn, 5, sizeof(cl_mem), &dev->n43_d);
+	sclSetKernelArg(checkn, 6, sizeof(int), &SHIFT);
 
-		}
+	sclSetKernelArg(dev->clearn_b, 1, sizeof(int), &nk);
 
-		++iteration;
+	time (&last_time);
 
+	// same pipeline as SearchAP26, chunk c uses slot c % depth
+	cl_event checkDone[MAXDEPTH];
+	cl_event sieveDone[MAXDEPTH];
+	for(int slot=0; slot<dev->depth; ++slot){
+		checkDone[slot] = NULL;
+		sieveDone[slot] = NULL;
 	}
+	int chunk = 0;
 
+	cl_ulong prev_end = 0;
+	double gap_ms = 0.0, gap_max = 0.0;
 
-	// sleep CPU thread while GPU is busy
-	waitOnEvent(hardware, launchEvent);
-	sleepCPU(hardware);
+	for(int p=0; p<numn59s; p+=seg){
 
-	// copy solution count to host memory
-	// blocking read
-	sclRead(hardware, 4 * sizeof(int), counter_d, counter_h);
+		int slot = chunk % dev->depth;
+		++chunk;
 
-	//printf("largest ncount: %d / %d, solution count: %d / %d\n",counter_h[1], numn ,counter_h[2], sol);
+		if(checkDone[slot] != NULL){
+			waitOnEvent(dev->check_hw, checkDone[slot], &dev->wait_us);
+			checkDone[slot] = NULL;
+			sieveGap(sieveDone[slot], &prev_end, &gap_ms, &gap_max);
+		}
 
-	/*
-		counter_h[0] is the number of candidates sent from the sieve kernel to the prp test kernel
-		counter_h[1] is the maximum value of counter[0] since the last clear, used to check for buffer overflow
-		counter_h[2] is the number of solutions found
-		counter_h[3] is a flag set to 1 if the AP sequence PRP test kernel encountered an overflow over 2^64-1
+		// update BOINC progress every 2 sec
+		time (&curr_time);
+		if( dev->progress && ((int)curr_time - (int)last_time) > 1 ){
+			dd = ( (double)K_DONE + (double)nk * p / numn59s ) / K_COUNT;
+			Progress(dd);
+			last_time = curr_time;
+		}
 
-	*/
+		sclSetKernelArg(dev->clearn_b, 0, sizeof(cl_mem), &dev->counterb_d[slot]);
+		sclEnqueueKernel(dev->hardware, dev->clearn_b);
 
-	// check if number of candidates overflowed the array
-	if(counter_h[1] > numn){
-		printf("Error: checkn array overflow.\n");
-		fprintf(stderr, "Error: checkn array overflow.\n");
-		exit(EXIT_FAILURE);
-	}
-	// check if number of solutions overflowed the array
-	if(counter_h[2] > sol){
-		printf("Error: solution array overflow.\n");
-		fprintf(stderr, "Error: solution array overflow.\n");
-		exit(EXIT_FAILURE);
-	}
-	// check if PRP test kernel has reached the software limit
-	if(counter_h[3] != 0){
-		printf("Error: AP sequence PRP test kernel overflowed.  SHIFT is too large.\n");
-		fprintf(stderr, "Error: AP sequence PRP test kernel overflowed.  SHIFT is too large.\n");
-		exit(EXIT_FAILURE);
-	}
+		sclSetKernelArg(sieve, 3, sizeof(cl_mem), &dev->n_result_d[slot]);
+		sclSetKernelArg(sieve, 5, sizeof(cl_mem), &dev->counterb_d[slot]);
+		sclSetKernelArg(sieve, 6, sizeof(int), &p);
 
-	// copy solutions to host memory
-	// blocking read
-	if( counter_h[2] > 0 ){
-		sclRead(hardware, counter_h[2] * sizeof(int), sol_k_d, sol_k_h);
-		sclRead(hardware, counter_h[2] * sizeof(uint64_t), sol_val_d, sol_val_h);
+		sieveDone[slot] = sclEnqueueKernelEvent(dev->hardware, sieve);
+		clFlush(dev->hardware.queue);
 
-		// report solutions
-		for(int e=0; e < counter_h[2]; ++e){
-			ReportSolution(sol_k_h[e],K,sol_val_h[e]);
-		}
+		sclSetKernelArg(checkn, 0, sizeof(cl_mem), &dev->n_result_d[slot]);
+		sclSetKernelArg(checkn, 2, sizeof(cl_mem), &dev->sol_kb_d[slot]);
+		sclSetKernelArg(checkn, 3, sizeof(cl_mem), &dev->sol_valb_d[slot]);
+		sclSetKernelArg(checkn, 4, sizeof(cl_mem), &dev->counterb_d[slot]);
+		sclSetKernelArg(checkn, 7, sizeof(int), &p);
 
-		totalaps += counter_h[2];
+		checkDone[slot] = sclEnqueueKernelWait(dev->check_hw, checkn, 1, &sieveDone[slot]);
 	}
 
-	if(boinc_is_standalone()){
-		time(&total_finish_time);
-		printf("K %d done in %d sec. AP10+ found: %u\n", K, (int)total_finish_time - (int)total_start_time, counter_h[2]);
+	for(int c = (chunk > dev->depth) ? chunk - dev->depth : 0; c < chunk; ++c){
+		int slot = c % dev->depth;
+		waitOnEvent(dev->check_hw, checkDone[slot], &dev->wait_us);
+		sieveGap(sieveDone[slot], &prev_end, &gap_ms, &gap_max);
 	}
+	sleepCPU(dev->hardware);
+
+	time(&total_finish_time);
+
+	// read each K's counters and solutions from its segment of every slot into
+	// its pinned memory, without blocking
+	for(int b=0; b<nk; ++b){
+		kres_t *r = &dev->res[dev->res_next];
+		dev->res_next = (dev->res_next + 1) % dev->numres;
+
+		r->K = Ks[b];
+		r->depth = dev->depth;
+		r->numn = cap;
+		r->cksum = 0;
+		r->aps = 0;
+		r->k_nsol = 0;
+		r->mapped = 0;
+		r->secs = (int)total_finish_time - (int)total_start_time;
+
+		for(int slot=0; slot<dev->depth; ++slot){
+			cl_event *ev = (slot == dev->depth - 1) ? &r->read_done : NULL;
+
+			clEnqueueReadBuffer(dev->hardware.queue, dev->counterb_d[slot], CL_FALSE, b * 8 * sizeof(int), READCOUNTERS * sizeof(int), r->counter_h[slot], 0, NULL, NULL);
+			clEnqueueReadBuffer(dev->hardware.queue, dev->sol_kb_d[slot], CL_FALSE, b * sol * sizeof(int), sol * sizeof(int), r->sol_k_h[slot], 0, NULL, NULL);
+			clEnqueueReadBuffer(dev->hardware.queue, dev->sol_valb_d[slot], CL_FALSE, b * sol * sizeof(uint64_t), sol * sizeof(uint64_t), r->sol_val_h[slot], 0, NULL, ev);
+		}
 
-//	printf("total n for K: %" PRIu64 "\n",totaln);  // for K 366384 this should be 38838420
+		res[b] = r;
+	}
+	clFlush(dev->hardware.queue);
 
+	for(int b=0; b<nk; ++b){
+		queue_result(res[b]);
+	}
 
+	if(boinc_is_standalone()){
+		printf("K %d to %d sieve idle between %d chunks: %.2f ms total, %.3f ms max\n", Ks[0], Ks[nk-1], chunk, gap_ms, gap_max);
+	}
 }
@@ -0,0 +1,144 @@
+/*
+
+	batched kernels for -batch
+
+	built appended to sieve.cl, checkn.cl, setupok.cl and setupokok.cl.  one
+	launch covers up to MAXBATCH K, get_global_id(1) is the K's index b in
+	the batch.  kc holds each K's STEP, S43, S47, S53 and S59.  K b has its
+	own n43 values, OK and OKOK tables, 8 counters and solution arrays at b
+	times their size in the shared buffers, and a candidate segment of
+	counter[4] entries.  the sieve is the lean one, the n59s are derived
+	from n43.
+
+*/
+
+#define KC_WORDS 5
+#define BATCH_N43 10840
+#define BATCH_N59 137375320
+#define BATCH_OK 23693
+#define BATCH_OKOK 236930
+#define BATCH_SOL 10240
+
+
+__kernel void clearok_b(__global char *OK){
+
+	int i = get_global_id(0);
+	int b = get_global_id(1);
+
+	if(i < BATCH_OK){
+		OK[b*BATCH_OK + i] = 1;
+	}
+
+}
+
+
+__kernel void setupok_b(__global ulong *kc, __global char *OK, __global int *offset){
+
+	int b = get_global_id(1);
+
+	setup_ok(get_global_id(0), kc[b*KC_WORDS], OK + b*BATCH_OK, offset);
+
+}
+
+
+__kernel void clearokok_b(__global ulong *OKOK){
+
+	int i = get_global_id(0);
+	int b = get_global_id(1);
+
+	if(i < BATCH_OKOK){
+		OKOK[b*BATCH_OKOK + i] = 0;
+	}
+
+}
+
+
+__kernel void setupokok_b(int shift, __global char *OK, __global ulong *OKOK, __global int *offset){
+
+	int b = get_global_id(1);
+
+	setup_okok(get_global_id(0), shift, OK + b*BATCH_OK, OKOK + b*BATCH_OKOK, offset);
+
+}
+
+
+// clear the candidate count of each K
+__kernel void clearn_b(__global int *counter, int nk){
+
+	int b = get_global_id(0);
+
+	if(b < nk){
+		counter[b*8] = 0;
+	}
+
+}
+
+
+__kernel void sieve_b(__global ulong * n43g, __global ulong * kc, int shift, __global uint * n_result, __global ulong * OKOK, __global int * counter, int offset, int seg){
+
+	uint gid = get_global_id(0);
+	int b = get_global_id(1);
+	int idx = gid + offset;
+
+	__global ulong * k = kc + b*KC_WORDS;
+	__global int * k_counter = counter + b*8;
+	__global uint * k_result = n_result + b*k_counter[4];
+
+	__local uint list[LOCAL_N];
+	__local int lcount[2];
+
+	sieve_start(lcount);
+
+	if(gid < seg && idx < BATCH_N59){
+
+		ulong S59 = k[4];
+		ulong n59 = get_n59(n43g + b*BATCH_N43, idx, 1, k[1], k[2], k[3]);
+
+		int i59;
+		for(i59=0;i59<35;i59++){
+
+			sieve_n59(n59, (gid*35 + i59)*640, shift, list, lcount, k_result, OKOK + b*BATCH_OKOK, k_counter);
+
+			n59+=S59;
+			if(n59>= MOD ){
+				n59-= MOD;
+			}
+
+		}
+
+	}
+
+	sieve_flush(list, lcount, k_result, k_counter);
+
+}
+
+
+__kernel void checkn_b(__global uint * n_result, __global ulong * kc, __global int * sol_k, __global ulong * sol_val, __global int * counter, __global ulong * n43g, int shift, int offset){
+
+	int gid = get_global_id(0);
+	int b = get_global_id(1);
+
+	__global ulong * k = kc + b*KC_WORDS;
+	__global int * k_counter = counter + b*8;
+
+	// a K with more candidates than its segment is reported by the host
+	if(gid < min(k_counter[0], k_counter[4])){
+
+		ulong n = expand_n(n_result[b*k_counter[4] + gid], n43g + b*BATCH_N43, k[4], shift, offset, 1, k[1], k[2], k[3]);
+
+		check_n(n, k[0], sol_k + b*BATCH_SOL, sol_val + b*BATCH_SOL, k_counter);
+
+	}
+
+	// store largest ncount, count the candidates tested
+	if(gid == 0){
+		int nc = k_counter[0];
+		if(nc > k_counter[1]){
+			k_counter[1] = nc;
+		}
+		if(nc <= k_counter[4]){
+			k_counter[7] += nc;
+		}
+	}
+}
+
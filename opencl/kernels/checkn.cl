@@ -5,6 +5,19 @@
 
 */
 
+// also defined by sieve.cl, which the fused kernel is built with
+#ifndef AP26_MOD
+#define AP26_MOD
+__constant ulong MOD = (ulong)258559632607830;
+#endif
+
+
+
+// solution arrays, the host reports an overflow
+#define SOL_MAX 10240
+
+// chunks that overflowed the candidate buffer, see chunk_overflow
+#define OVF_MAX 16
 
 
 // r0 + 2^64 * r1 = a * b
@@ -121,59 +134,296 @@ inline bool strong_prp(ulong N)
 
 
 
+// n59 number idx, in lean mode derived from n43g like sieve_lean
+inline ulong get_n59(__global ulong * n59g, int idx, int lean, ulong S43, ulong S47, ulong S53){
+
+	if(lean){
+		int i = idx / 12673;
+		int r = idx - i * 12673;
+		int i43 = r / 667;
+		r -= i43 * 667;
+		int i47 = r / 29;
+		int i53 = r - i47 * 29;
+
+		return ( n59g[i] + i43*S43 + i47*S47 + i53*S53 ) % MOD;
+	}
+
+	return n59g[idx];
+}
+
+
 /*
-	main prime sequence checking kernel
+	expand a sieve candidate, (index*35 + i59)*640 + bit, back to n.
+	n59g and offset are the sieve launch's, in lean mode n59g is n43g
 */
-__kernel void checkn(__global ulong * n_result, ulong STEP, __global int * sol_k, __global ulong * sol_val, __global int * counter){
+inline ulong expand_n(uint code, __global ulong * n59g, ulong S59, int shift, int offset, int lean, ulong S43, ulong S47, ulong S53){
 
-	int gid = get_global_id(0);
+	int bit = code % 640;
+	code /= 640;
+	int i59 = code % 35;
+	int idx = code / 35 + offset;
+
+	ulong n59 = get_n59(n59g, idx, lean, S43, S47, S53);
+
+	n59 = ( n59 + i59*S59 ) % MOD;
+
+	return n59 + (bit + shift) * MOD;
+}
 
-	if(gid < counter[0]){
 
-		ulong n = n_result[gid];
+/*
+	PRP test the AP from n, store it if it has 10 or more terms
+*/
+inline void check_n(ulong n, ulong STEP, __global int * sol_k, __global ulong * sol_val, __global int * counter){
 
-		ulong m = n + STEP*5;
+	ulong m = n + STEP*5;
+
+	if(m < n){  // software limit
+		atomic_or(&counter[3], 1);
+	}
 
+	int k=0;
+
+	// forward
+	while(strong_prp( m )){
+		m += STEP;
+		++k;
 		if(m < n){  // software limit
 			atomic_or(&counter[3], 1);
+			break;
 		}
+	}
 
-		int k=0;
+	if(k >= 10){
+		m = n + STEP*4;
+		ulong start = m;
 
-		// forward
+		// reverse
 		while(strong_prp( m )){
-			m += STEP;
+			m -= STEP;
 			++k;
-			if(m < n){  // software limit
-				atomic_or(&counter[3], 1);
-				break;
-			}
+			if(m > start)break;  // m < 0
+		}
+
+		// AP length >= 10 store to results
+		int index = atomic_inc(&counter[2]);
+		if(index < SOL_MAX){
+			sol_k[index] = k;
+			sol_val[index] = m+STEP;
+		}
+	}
+}
+
+
+/*
+	the sieve stores at most counter[4] candidates.  a chunk with more isn't
+	tested, its number in the slot (counter[5], counted by clearn) is listed
+	from counter[8] for the host to rerun with a larger buffer.  counter[6]
+	counts the listed chunks, past OVF_MAX the host reruns the whole slot
+*/
+inline int chunk_overflow(__global int * counter){
+
+	if(counter[0] <= counter[4]){
+		return 0;
+	}
+
+	if(get_global_id(0) == 0){
+		int o = atomic_inc(&counter[6]);
+		if(o < OVF_MAX){
+			counter[8 + o] = counter[5];
+		}
+	}
+
+	return 1;
+}
+
+
+/*
+	main prime sequence checking kernel
+*/
+__kernel void checkn(__global uint * n_result, ulong STEP, __global int * sol_k, __global ulong * sol_val, __global int * counter, __global ulong * n59g, ulong S59, int shift, int offset, int lean, ulong S43, ulong S47, ulong S53){
+
+	// per K constants with -kspec, see sieve.cl
+#ifdef K_S59
+	STEP = K_STEP;
+	S59 = K_S59;
+	shift = K_SHIFT;
+	S43 = K_S43;
+	S47 = K_S47;
+	S53 = K_S53;
+#endif
+
+	int gid = get_global_id(0);
+
+	if(gid < counter[0] && !chunk_overflow(counter)){
+
+		ulong n = expand_n(n_result[gid], n59g, S59, shift, offset, lean, S43, S47, S53);
+
+		check_n(n, STEP, sol_k, sol_val, counter);
+
+	}
+
+	// store largest ncount, count the candidates tested
+	if(gid == 0){
+		int nc = counter[0];
+		if(nc > counter[1]){
+			counter[1] = nc;
+		}
+		if(nc <= counter[4]){
+			counter[7] += nc;
 		}
+	}
+}
+
+
+/*
+	wavefront PRP test, the other choice of the sieve tuner.  each round tests
+	one term of every live AP and compacts the survivors into the next round's
+	list, so no lane waits on a long AP.  forward lists hold (n, k) with the
+	next term n + (5+k)*STEP, backward lists (m, k) with m the next term down.
+	the counts are in wave[0..2] for forward rounds and wave[3..5] for
+	backward rounds, round r reads wave[r%3], appends to wave[(r+1)%3] and
+	clears wave[(r+2)%3] for the round after.  the last round of each
+	direction runs its APs to the end like checkn.
+*/
 
+__kernel void clearw(__global int * wave){
+
+	int gid = get_global_id(0);
+
+	if(gid < 6){
+		wave[gid] = 0;
+	}
+}
+
+
+// forward AP from n, k terms found, n + (5+k)*STEP is prime
+inline void wave_next(ulong n, int k, ulong STEP, __global ulong * out_n, __global int * out_k, __global int * out_count, __global ulong * back_n, __global int * back_k, __global int * wave, __global int * counter){
+
+	ulong m = n + (5+k)*STEP;
+
+	++k;
+	m += STEP;
+
+	if(m < n){  // software limit
+		atomic_or(&counter[3], 1);
 		if(k >= 10){
-			m = n + STEP*4;
-			ulong start = m;
+			int index = atomic_inc(&wave[3]);
+			back_n[index] = n + STEP*4;
+			back_k[index] = k;
+		}
+		return;
+	}
 
-			// reverse
-			while(strong_prp( m )){
-				m -= STEP;
-				++k;
-				if(m > start)break;  // m < 0
-			}
+	int index = atomic_inc(out_count);
+	out_n[index] = n;
+	out_k[index] = k;
+}
 
-			// AP length >= 10 store to results
-			int index = atomic_inc(&counter[2]);
-			sol_k[index] = k;
-			sol_val[index] = m+STEP;
+
+// first round, expand the sieve's candidates
+__kernel void checkw_first(__global uint * n_result, ulong STEP, __global int * counter, __global ulong * n59g, ulong S59, int shift, int offset, int lean, ulong S43, ulong S47, ulong S53, __global ulong * out_n, __global int * out_k, __global int * wave){
+
+	int gid = get_global_id(0);
+
+	if(gid < counter[0] && !chunk_overflow(counter)){
+
+		ulong n = expand_n(n_result[gid], n59g, S59, shift, offset, lean, S43, S47, S53);
+
+		if(n + STEP*5 < n){  // software limit
+			atomic_or(&counter[3], 1);
 		}
 
+		// a single term can't reach the backward walk, out_n is passed for it
+		if(strong_prp( n + STEP*5 )){
+			wave_next(n, 0, STEP, out_n, out_k, &wave[1], out_n, out_k, wave, counter);
+		}
 	}
 
-	// store largest ncount
+	// store largest ncount, count the candidates tested
 	if(gid == 0){
 		int nc = counter[0];
 		if(nc > counter[1]){
 			counter[1] = nc;
 		}
+		if(nc <= counter[4]){
+			counter[7] += nc;
+		}
+	}
+}
+
+
+__kernel void checkw_fwd(__global ulong * in_n, __global int * in_k, __global ulong * out_n, __global int * out_k, __global ulong * back_n, __global int * back_k, __global int * wave, int r, int last, ulong STEP, __global int * counter){
+
+	int gid = get_global_id(0);
+
+	if(gid == 0){
+		wave[(r+2)%3] = 0;
+	}
+
+	if(gid < wave[r%3]){
+
+		ulong n = in_n[gid];
+		int k = in_k[gid];
+		ulong m = n + (5+k)*STEP;
+
+		if(last){
+			// forward
+			while(strong_prp( m )){
+				m += STEP;
+				++k;
+				if(m < n){  // software limit
+					atomic_or(&counter[3], 1);
+					break;
+				}
+			}
+		}
+		else if(strong_prp( m )){
+			wave_next(n, k, STEP, out_n, out_k, &wave[(r+1)%3], back_n, back_k, wave, counter);
+			return;
+		}
+
+		if(k >= 10){
+			int index = atomic_inc(&wave[3]);
+			back_n[index] = n + STEP*4;
+			back_k[index] = k;
+		}
+	}
+}
+
+
+__kernel void checkw_back(__global ulong * in_m, __global int * in_k, __global ulong * out_m, __global int * out_k, __global int * wave, int r, int last, ulong STEP, __global int * sol_k, __global ulong * sol_val, __global int * counter){
+
+	int gid = get_global_id(0);
+
+	if(gid == 0){
+		wave[3 + (r+2)%3] = 0;
+	}
+
+	if(gid < wave[3 + r%3]){
+
+		ulong m = in_m[gid];
+		int k = in_k[gid];
+
+		// reverse
+		while(strong_prp( m )){
+			ulong prev = m;
+			m -= STEP;
+			++k;
+			if(m > prev)break;  // m < 0
+			if(!last){
+				int index = atomic_inc(&wave[3 + (r+1)%3]);
+				out_m[index] = m;
+				out_k[index] = k;
+				return;
+			}
+		}
+
+		// AP length >= 10 store to results
+		int index = atomic_inc(&counter[2]);
+		if(index < SOL_MAX){
+			sol_k[index] = k;
+			sol_val[index] = m+STEP;
+		}
 	}
 }
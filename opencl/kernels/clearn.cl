@@ -11,6 +11,7 @@ __kernel void clearn(__global int *counter){
 
 	if(i==0){
 		counter[0]=0;
+		counter[5]++; // chunk number in the slot, see checkn.cl
 	}
 
 
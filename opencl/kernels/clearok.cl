@@ -25,6 +25,9 @@ __kernel void clearok(__global char *OK, __global int *counter){
 		counter[1] = 0; // largest n count
 		counter[2] = 0; // solutions
 		counter[3] = 0; // PRP kernel overflow flag
+		counter[5] = 0; // chunks
+		counter[6] = 0; // overflowed chunks
+		counter[7] = 0; // candidates tested
 	}
 
 }
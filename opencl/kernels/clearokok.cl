@@ -11,7 +11,7 @@ __kernel void clearokok(__global ulong *OKOK){
 	int i = get_global_id(0);
 
 	// clear array
-	if(i < 23693){
+	if(i < 236930){
 		OKOK[i] = 0;
 	}
 
@@ -11,10 +11,8 @@
 		OK[ ((i*(step%_X))%_X) + offset[_X] ]=0;
 
 
-__kernel void setupok(ulong step, __global char *OK, __global int *offset){
-
-
-	int i = get_global_id(0);
+// also called by setupok_b for each K of a batch
+inline void setup_ok(int i, ulong step, __global char *OK, __global int *offset){
 
 	if(i < 542){
 		SET_OK(61);
@@ -105,5 +103,9 @@ __kernel void setupok(ulong step, __global char *OK, __global int *offset){
 }
 
 
+__kernel void setupok(ulong step, __global char *OK, __global int *offset){
+
+	setup_ok(get_global_id(0), step, OK, offset);
 
+}
 
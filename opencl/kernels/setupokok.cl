@@ -2,23 +2,30 @@
 
 	setupOKOK kernel
 
+	each OKOK entry is 10 words, bit jj of word w is shift+64*w+jj
+
 */
 
 
 #define DO_OKOK(_X) \
 	if(i<_X) \
+		for(w=0;w<10;w++) \
 		for(jj=0;jj<64;jj++){ \
-      			OKOK[ i + offset[_X] ]  |=  (((ulong)OK[ ((i+(jj+shift)*MOD)%_X) + offset[_X] ])<<jj); \
+      			OKOK[ (i + offset[_X])*10 + w ]  |=  (((ulong)OK[ ((i+(jj+shift+64*w)*MOD)%_X) + offset[_X] ])<<jj); \
 		}
 
 
+// also defined by sieve.cl, which the batch kernels are built with
+#ifndef AP26_MOD
+#define AP26_MOD
 __constant ulong MOD = (ulong)258559632607830;
+#endif
 
 
-__kernel void setupokok(int shift, __global char *OK, __global ulong *OKOK, __global int *offset){
+// also called by setupokok_b for each K of a batch
+inline void setup_okok(int i, int shift, __global char *OK, __global ulong *OKOK, __global int *offset){
 
-	int i = get_global_id(0);
-	int jj;
+	int jj, w;
 
 	if(i < 542){
 		DO_OKOK(61);
@@ -109,5 +116,9 @@ __kernel void setupokok(int shift, __global char *OK, __global ulong *OKOK, __gl
 }
 
 
+__kernel void setupokok(int shift, __global char *OK, __global ulong *OKOK, __global int *offset){
 
+	setup_okok(get_global_id(0), shift, OK, OKOK, offset);
+
+}
 
@@ -0,0 +1,92 @@
+/*
+
+	fused sieve and PRP kernel
+
+	built with -D SIEVE_FUSED appended to sieve.cl and checkn.cl.  a
+	persistent grid of work-groups takes blocks of local size n59s from a
+	work counter, sieves them into the local candidate list and PRP tests
+	the list before taking the next block, so a launch can cover millions
+	of n59s and the candidates never go through global memory.  a full
+	list spills (block's first n59 index, code) pairs to n_result, which
+	checkspill tests after the pass.
+
+*/
+
+
+__kernel void sieve_fused(__global ulong * n59g, ulong S59, int shift, __global uint * n_result, __global ulong * OKOK, __global int * counter, int offset, int count, __global int * work, ulong STEP, __global int * sol_k, __global ulong * sol_val, int lean, ulong S43, ulong S47, ulong S53){
+
+	int lid = get_local_id(0);
+	int lsize = get_local_size(0);
+
+	__local uint list[LOCAL_N];
+	__local int lcount[2];
+	__local int lwork[1];
+
+	for(;;){
+
+		if(lid == 0){
+			lwork[0] = atomic_add(&work[0], lsize);
+			lcount[0] = 0;
+			lcount[1] = offset + lwork[0];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		int first = lwork[0];
+
+		if(first >= count){
+			break;
+		}
+
+		if(first + lid < count){
+
+			ulong n59 = get_n59(n59g, offset + first + lid, lean, S43, S47, S53);
+
+			int i59;
+			for(i59=0;i59<35;i59++){
+
+				sieve_n59(n59, (lid*35 + i59)*640, shift, list, lcount, n_result, OKOK, counter);
+
+				n59+=S59;
+				if(n59>= MOD ){
+					n59-= MOD;
+				}
+
+			}
+
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		int total = min(lcount[0], LOCAL_N);
+		int base = lcount[1];
+
+		for(int q = lid; q < total; q += lsize){
+			check_n(expand_n(list[q], n59g, S59, shift, base, lean, S43, S47, S53), STEP, sol_k, sol_val, counter);
+		}
+
+		// list and lwork are reused by the next block
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+}
+
+
+__kernel void checkspill(__global ulong * spill, ulong STEP, __global int * sol_k, __global ulong * sol_val, __global int * counter, __global ulong * n59g, ulong S59, int shift, int lean, ulong S43, ulong S47, ulong S53){
+
+	int gid = get_global_id(0);
+
+	if(gid < min(counter[0], counter[4])){
+
+		ulong e = spill[gid];
+
+		check_n(expand_n((uint)e, n59g, S59, shift, (int)(e >> 32), lean, S43, S47, S53), STEP, sol_k, sol_val, counter);
+
+	}
+
+	// store largest spill count
+	if(gid == 0){
+		int nc = counter[0];
+		if(nc > counter[1]){
+			counter[1] = nc;
+		}
+	}
+}
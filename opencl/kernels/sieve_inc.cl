@@ -0,0 +1,236 @@
+/*
+
+	incremental residue sieve kernel
+
+	built appended to sieve.cl.  residues of n59 mod the first 10 primes are
+	kept in registers and stepped with S59 mod p, set per K in S59p, so the
+	35 i59 steps need no division for them.  the deeper primes reduce
+	n59a+c*n59b, which is below 2^31, with a mul_hi reciprocal.
+
+*/
+
+#define NUM_INC 10
+
+__constant uint inc_p[NUM_INC] = { 61, 67, 71, 73, 79, 83, 89, 97, 101, 103 };
+__constant uint inc_c[NUM_INC] = { 60, 25, 20, 8, 52, 40, 78, 33, 17, 93 };
+
+// p - (MOD mod p), added when n59 wraps past MOD
+__constant uint inc_wrap[NUM_INC] = { 18, 19, 38, 20, 58, 10, 6, 84, 24, 36 };
+
+
+// x mod p for x < 2^31.  q is at most one below x/p, so one subtract fixes r
+inline uint modp(uint x, uint p){
+
+	uint r = x - mul_hi(x, 0xFFFFFFFFu / p) * p;
+
+	return (r >= p) ? r - p : r;
+}
+
+
+inline void sieve_n59_inc(ulong n59, uint *r, uint code, int shift, __local uint * list, __local int * lcount, __global uint * n_result, __global ulong * OKOK, __global int * counter){
+
+	ulong s[10];
+	uint n59a = n59 & ((1<<30)-1);
+	uint n59b = n59 >> 30;
+
+	// the first 10 primes use the residues kept by the caller
+	sieve_first(s, OKOK, r[0]);
+	sieve_and(s, OKOK, r[1] + 61);
+	sieve_and(s, OKOK, r[2] + 128);
+	sieve_and(s, OKOK, r[3] + 199);
+	if(!sieve_and(s, OKOK, r[4] + 272)) return;
+
+	sieve_and(s, OKOK, r[5] + 351);
+	sieve_and(s, OKOK, r[6] + 434);
+	sieve_and(s, OKOK, r[7] + 523);
+	sieve_and(s, OKOK, r[8] + 620);
+	if(!sieve_and(s, OKOK, r[9] + 721)) return;
+
+	sieve_and(s, OKOK, modp(n59a+34*n59b, 107) + 824);
+	sieve_and(s, OKOK, modp(n59a+46*n59b, 109) + 931);
+	sieve_and(s, OKOK, modp(n59a+4*n59b, 113) + 1040);
+	sieve_and(s, OKOK, modp(n59a+4*n59b, 127) + 1153);
+	if(!sieve_and(s, OKOK, modp(n59a+62*n59b, 131) + 1280)) return;
+
+	sieve_and(s, OKOK, modp(n59a+77*n59b, 137) + 1411);
+	sieve_and(s, OKOK, modp(n59a+45*n59b, 139) + 1548);
+	sieve_and(s, OKOK, modp(n59a+144*n59b, 149) + 1687);
+	if(!sieve_and(s, OKOK, modp(n59a+n59b, 151) + 1836)) return;
+
+	sieve_and(s, OKOK, modp(n59a+141*n59b, 157) + 1987);
+	sieve_and(s, OKOK, modp(n59a+25*n59b, 163) + 2144);
+	sieve_and(s, OKOK, modp(n59a+127*n59b, 167) + 2307);
+	if(!sieve_and(s, OKOK, modp(n59a+24*n59b, 173) + 2474)) return;
+
+	sieve_and(s, OKOK, modp(n59a+121*n59b, 179) + 2647);
+	if(!sieve_and(s, OKOK, modp(n59a+49*n59b, 181) + 2826)) return;
+
+	sieve_and(s, OKOK, modp(n59a+180*n59b, 191) + 3007);
+	if(!sieve_and(s, OKOK, modp(n59a+27*n59b, 193) + 3198)) return;
+
+	sieve_and(s, OKOK, modp(n59a+22*n59b, 197) + 3391);
+	if(!sieve_and(s, OKOK, modp(n59a+111*n59b, 199) + 3588)) return;
+
+	sieve_and(s, OKOK, modp(n59a+171*n59b, 211) + 3787);
+	if(!sieve_and(s, OKOK, modp(n59a+169*n59b, 223) + 3998)) return;
+
+	sieve_and(s, OKOK, modp(n59a+44*n59b, 227) + 4221);
+	if(!sieve_and(s, OKOK, modp(n59a+212*n59b, 229) + 4448)) return;
+
+	sieve_and(s, OKOK, modp(n59a+2*n59b, 233) + 4677);
+	if(!sieve_and(s, OKOK, modp(n59a+147*n59b, 239) + 4910)) return;
+
+	sieve_and(s, OKOK, modp(n59a+64*n59b, 241) + 5149);
+	if(!sieve_and(s, OKOK, modp(n59a+219*n59b, 251) + 5390)) return;
+
+	sieve_and(s, OKOK, modp(n59a+193*n59b, 257) + 5641);
+	if(!sieve_and(s, OKOK, modp(n59a+140*n59b, 263) + 5898)) return;
+
+	sieve_and(s, OKOK, modp(n59a+79*n59b, 269) + 6161);
+	if(!sieve_and(s, OKOK, modp(n59a+258*n59b, 271) + 6430)) return;
+
+	sieve_and(s, OKOK, modp(n59a+76*n59b, 277) + 6701);
+	if(!sieve_and(s, OKOK, modp(n59a+79*n59b, 281) + 6978)) return;
+
+	sieve_and(s, OKOK, modp(n59a+204*n59b, 283) + 7259);
+	if(!sieve_and(s, OKOK, modp(n59a+253*n59b, 293) + 7542)) return;
+
+	sieve_and(s, OKOK, modp(n59a+114*n59b, 307) + 7835);
+	if(!sieve_and(s, OKOK, modp(n59a+18*n59b, 311) + 8142)) return;
+
+	sieve_and(s, OKOK, modp(n59a+19*n59b, 313) + 8453);
+	if(!sieve_and(s, OKOK, modp(n59a+58*n59b, 317) + 8766)) return;
+
+	sieve_and(s, OKOK, modp(n59a+n59b, 331) + 9083);
+	if(!sieve_and(s, OKOK, modp(n59a+175*n59b, 337) + 9414)) return;
+
+	sieve_and(s, OKOK, modp(n59a+292*n59b, 347) + 9751);
+	if(!sieve_and(s, OKOK, modp(n59a+48*n59b, 349) + 10098)) return;
+
+	sieve_and(s, OKOK, modp(n59a+191*n59b, 353) + 10447);
+	if(!sieve_and(s, OKOK, modp(n59a+108*n59b, 359) + 10800)) return;
+
+	sieve_and(s, OKOK, modp(n59a+15*n59b, 367) + 11159);
+	if(!sieve_and(s, OKOK, modp(n59a+152*n59b, 373) + 11526)) return;
+
+	sieve_and(s, OKOK, modp(n59a+335*n59b, 379) + 11899);
+	if(!sieve_and(s, OKOK, modp(n59a+175*n59b, 383) + 12278)) return;
+
+	sieve_and(s, OKOK, modp(n59a+295*n59b, 389) + 12661);
+	if(!sieve_and(s, OKOK, modp(n59a+141*n59b, 397) + 13050)) return;
+
+	sieve_and(s, OKOK, modp(n59a+164*n59b, 401) + 13447);
+	if(!sieve_and(s, OKOK, modp(n59a+259*n59b, 409) + 13848)) return;
+
+	sieve_and(s, OKOK, modp(n59a+273*n59b, 419) + 14257);
+	if(!sieve_and(s, OKOK, modp(n59a+269*n59b, 421) + 14676)) return;
+
+	sieve_and(s, OKOK, modp(n59a+144*n59b, 431) + 15097);
+	if(!sieve_and(s, OKOK, modp(n59a+115*n59b, 433) + 15528)) return;
+
+	sieve_and(s, OKOK, modp(n59a+65*n59b, 439) + 15961);
+	if(!sieve_and(s, OKOK, modp(n59a+196*n59b, 443) + 16400)) return;
+
+	sieve_and(s, OKOK, modp(n59a+81*n59b, 449) + 16843);
+	if(!sieve_and(s, OKOK, modp(n59a+216*n59b, 457) + 17292)) return;
+
+	sieve_and(s, OKOK, modp(n59a+447*n59b, 461) + 17749);
+	if(!sieve_and(s, OKOK, modp(n59a+376*n59b, 463) + 18210)) return;
+
+	sieve_and(s, OKOK, modp(n59a+13*n59b, 467) + 18673);
+	if(!sieve_and(s, OKOK, modp(n59a+96*n59b, 479) + 19140)) return;
+
+	sieve_and(s, OKOK, modp(n59a+328*n59b, 487) + 19619);
+	if(!sieve_and(s, OKOK, modp(n59a+438*n59b, 491) + 20106)) return;
+
+	sieve_and(s, OKOK, modp(n59a+111*n59b, 499) + 20597);
+	if(!sieve_and(s, OKOK, modp(n59a+299*n59b, 503) + 21096)) return;
+
+	sieve_and(s, OKOK, modp(n59a+216*n59b, 509) + 21599);
+	if(!sieve_and(s, OKOK, modp(n59a+420*n59b, 521) + 22108)) return;
+
+	sieve_and(s, OKOK, modp(n59a+335*n59b, 523) + 22629);
+	if(!sieve_and(s, OKOK, modp(n59a+189*n59b, 541) + 23152)) return;
+
+	for(int w=0; w<10; ++w){
+
+		ulong sito = s[w];
+
+		while(sito){
+			int setbit = 63 - clz(sito);
+			ulong n=n59+(setbit+shift+64*w)*MOD;
+
+			if(n%7 && n%11 && n%13 && n%17 && n%19 && n%23){
+				sieve_emit(code + setbit + 64*w, list, lcount, n_result, counter);
+			}
+
+			sito ^= ((ulong)1) << setbit; // toggle bit off
+		}
+
+	}
+
+}
+
+
+__kernel void sieve_inc(__global ulong * n59g, ulong S59, int shift, __global uint * n_result, __global ulong * OKOK, __global int * counter, int offset, __constant uint * S59p){
+
+	K_CONSTANTS
+
+	uint gid = get_global_id(0);
+	int idx = gid + offset;
+
+	__local uint list[LOCAL_N];
+	__local int lcount[2];
+
+	sieve_start(lcount);
+
+	if(idx < halfn59s){
+
+		ulong n59 = n59g[idx];
+		uint n59a = n59 & ((1<<30)-1);
+		uint n59b = n59 >> 30;
+		uint r[NUM_INC];
+
+		// S59 mod p, literal when built for one K
+#ifdef K_S59
+		const uint step[NUM_INC] = { K_S59P0, K_S59P1, K_S59P2, K_S59P3, K_S59P4, K_S59P5, K_S59P6, K_S59P7, K_S59P8, K_S59P9 };
+#else
+		uint step[NUM_INC];
+		for(int j=0; j<NUM_INC; ++j){
+			step[j] = S59p[j];
+		}
+#endif
+
+		for(int j=0; j<NUM_INC; ++j){
+			r[j] = modp(n59a + inc_c[j]*n59b, inc_p[j]);
+		}
+
+		int i59;
+		for(i59=0;i59<35;i59++){
+
+			sieve_n59_inc(n59, r, (gid*35 + i59)*640, shift, list, lcount, n_result, OKOK, counter);
+
+			n59+=S59;
+			int wrap = (n59 >= MOD);
+			if(wrap){
+				n59-= MOD;
+			}
+
+			for(int j=0; j<NUM_INC; ++j){
+				uint p = inc_p[j];
+				uint x = r[j] + step[j];
+				if(x >= p) x -= p;
+				if(wrap){
+					x += inc_wrap[j];
+					if(x >= p) x -= p;
+				}
+				r[j] = x;
+			}
+
+		}
+
+	}
+
+	sieve_flush(list, lcount, n_result, counter);
+
+}
@@ -0,0 +1,60 @@
+/*
+
+	lean sieve kernel
+
+	built appended to sieve.cl.  each work-item derives its n53 from the
+	n43 index and the i43, i47, i53 counters of setupn, so the n59 arrays
+	are not needed and device memory use is a few MB.
+	limit is the end of the n59 range, less than all 137375320 when
+	-cpu leaves the last n43s to the CPU threads.
+
+*/
+
+
+__kernel void sieve_lean(__global ulong * n43g, ulong S59, int shift, __global uint * n_result, __global ulong * OKOK, __global int * counter, int offset, ulong S43, ulong S47, ulong S53, int limit){
+
+	K_CONSTANTS
+#ifdef K_S59
+	S43 = K_S43;
+	S47 = K_S47;
+	S53 = K_S53;
+#endif
+
+	uint gid = get_global_id(0);
+	int idx = gid + offset;
+
+	__local uint list[LOCAL_N];
+	__local int lcount[2];
+
+	sieve_start(lcount);
+
+	if(idx < limit){
+
+		// same order as setupn, 19*23*29 = 12673 n53 per n43
+		int i = idx / 12673;
+		int r = idx - i * 12673;
+		int i43 = r / 667;
+		r -= i43 * 667;
+		int i47 = r / 29;
+		int i53 = r - i47 * 29;
+
+		// each term is less than 29*MOD, the sum fits in 64 bits
+		ulong n59 = ( n43g[i] + i43*S43 + i47*S47 + i53*S53 ) % MOD;
+
+		int i59;
+		for(i59=0;i59<35;i59++){
+
+			sieve_n59(n59, (gid*35 + i59)*640, shift, list, lcount, n_result, OKOK, counter);
+
+			n59+=S59;
+			if(n59>= MOD ){
+				n59-= MOD;
+			}
+
+		}
+
+	}
+
+	sieve_flush(list, lcount, n_result, counter);
+
+}
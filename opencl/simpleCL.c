@@ -349,25 +349,37 @@ void sclPrintErrorFlags( cl_int flag ){
 
 
 
-void sclGetBinary( sclSoft software ){
+// program binary, the caller deletes it.  returns NULL if the driver has none
+unsigned char* _sclProgramBinary( cl_program program, size_t *size ){
 
-	size_t size;
 	cl_int err;
 
-	err = clGetProgramInfo( software.program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL );
-	if ( err!=CL_SUCCESS ) {
-		printf( "Error: clGetProgramInfo\n" );
-		fprintf(stderr, "Error: clGetProgramInfo\n" );
-		sclPrintErrorFlags( err );
+	err = clGetProgramInfo( program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), size, NULL );
+	if ( err!=CL_SUCCESS || *size == 0 ) {
+		return NULL;
 	}
 
-	unsigned char * binary = new unsigned char [ size ];
+	unsigned char * binary = new unsigned char [ *size ];
 
-	err = clGetProgramInfo( software.program, CL_PROGRAM_BINARIES, size, &binary, NULL );
+	err = clGetProgramInfo( program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binary, NULL );
 	if ( err!=CL_SUCCESS ) {
+		delete [ ] binary;
+		return NULL;
+	}
+
+	return binary;
+}
+
+
+void sclGetBinary( sclSoft software ){
+
+	size_t size;
+
+	unsigned char * binary = _sclProgramBinary( software.program, &size );
+	if( binary == NULL ){
 		printf( "Error: clGetProgramInfo\n" );
 		fprintf(stderr, "Error: clGetProgramInfo\n" );
-		sclPrintErrorFlags( err );
+		return;
 	}
 
 	FILE * fpbin = fopen( software.kernelName, "wb" );
@@ -385,6 +397,196 @@ void sclGetBinary( sclSoft software ){
 }
 
 
+/* ####### Program binary cache ############################ */
+
+// cache directory, empty when disabled
+static char sclCacheDir[1024] = "";
+
+typedef struct {
+	char magic[8];
+	cl_ulong key;
+	cl_ulong size;
+	cl_ulong sum;
+} _sclCacheHeader;
+
+#define SCL_CACHE_MAGIC "SCLBIN01"
+#define SCL_FNV_BASIS 14695981039346656037ULL
+
+
+void sclSetCacheDir( const char *dir ){
+
+	if( dir == NULL ){
+		sclCacheDir[0] = 0;
+		return;
+	}
+
+#ifdef _WIN32
+	_mkdir( dir );
+#else
+	mkdir( dir, 0755 );
+#endif
+
+	snprintf( sclCacheDir, sizeof(sclCacheDir), "%s", dir );
+}
+
+
+// 64 bit FNV-1a
+cl_ulong _sclHash( cl_ulong h, const void *data, size_t len ){
+
+	const unsigned char *p = (const unsigned char *)data;
+
+	for( size_t i = 0; i < len; ++i ){
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+
+// hash of everything the binary depends on: source, kernel, build options, device and driver
+cl_ulong _sclCacheKey( const char *source, const char *name, const char *options, sclHard hardware ){
+
+	char info[1024];
+	cl_ulong h = SCL_FNV_BASIS;
+
+	h = _sclHash( h, source, strlen(source) + 1 );
+	h = _sclHash( h, name, strlen(name) + 1 );
+	if( options != NULL ){
+		h = _sclHash( h, options, strlen(options) );
+	}
+	h = _sclHash( h, "", 1 );
+
+	const cl_device_info dinfo[3] = { CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION };
+	for( int i = 0; i < 3; ++i ){
+		info[0] = 0;
+		clGetDeviceInfo( hardware.device, dinfo[i], sizeof(info), info, NULL );
+		info[sizeof(info) - 1] = 0;
+		h = _sclHash( h, info, strlen(info) + 1 );
+	}
+
+	info[0] = 0;
+	clGetPlatformInfo( hardware.platform, CL_PLATFORM_VERSION, sizeof(info), info, NULL );
+	info[sizeof(info) - 1] = 0;
+	h = _sclHash( h, info, strlen(info) + 1 );
+
+	return h;
+}
+
+
+// built program from the cache file, or NULL if it is missing, stale or rejected by the driver
+cl_program _sclLoadCachedProgram( const char *path, cl_ulong key, sclHard hardware, const char *options ){
+
+	_sclCacheHeader head;
+	cl_program program = NULL;
+	unsigned char *binary = NULL;
+	cl_int err, status;
+
+	FILE *in = fopen( path, "rb" );
+	if( in == NULL ){
+		return NULL;
+	}
+
+	if( fread( &head, sizeof(head), 1, in ) == 1
+	    && memcmp( head.magic, SCL_CACHE_MAGIC, 8 ) == 0
+	    && head.key == key
+	    && head.size > 0 && head.size < ((cl_ulong)1 << 30) ){
+
+		binary = (unsigned char *)malloc( head.size );
+		if( binary != NULL && fread( binary, head.size, 1, in ) != 1 ){
+			free( binary );
+			binary = NULL;
+		}
+	}
+	fclose( in );
+
+	if( binary == NULL ){
+		return NULL;
+	}
+
+	if( _sclHash( SCL_FNV_BASIS, binary, head.size ) == head.sum ){
+
+		size_t size = head.size;
+		const unsigned char *b = binary;
+
+		program = clCreateProgramWithBinary( hardware.context, 1, &hardware.device, &size, &b, &status, &err );
+		if( err != CL_SUCCESS || status != CL_SUCCESS ){
+			if( program != NULL ) clReleaseProgram( program );
+			program = NULL;
+		}
+		else if( clBuildProgram( program, 0, NULL, options, NULL, NULL ) != CL_SUCCESS ){
+			clReleaseProgram( program );
+			program = NULL;
+		}
+	}
+
+	free( binary );
+
+	return program;
+}
+
+
+// write the program's binary to the cache.  written to a temporary file and renamed
+// so other processes never read a partial file
+void _sclSaveCachedProgram( cl_program program, const char *path, cl_ulong key ){
+
+	_sclCacheHeader head;
+	size_t size;
+	char tmp[1100];
+
+	unsigned char *binary = _sclProgramBinary( program, &size );
+	if( binary == NULL ){
+		return;
+	}
+
+	memcpy( head.magic, SCL_CACHE_MAGIC, 8 );
+	head.key = key;
+	head.size = size;
+	head.sum = _sclHash( SCL_FNV_BASIS, binary, size );
+
+#ifdef _WIN32
+	snprintf( tmp, sizeof(tmp), "%s.%d.tmp", path, _getpid() );
+#else
+	snprintf( tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid() );
+#endif
+
+	FILE *out = fopen( tmp, "wb" );
+	if( out != NULL ){
+		int ok = fwrite( &head, sizeof(head), 1, out ) == 1 && fwrite( binary, size, 1, out ) == 1;
+		ok = (fclose( out ) == 0) && ok;
+
+		if( ok ){
+			remove( path );
+			ok = (rename( tmp, path ) == 0);
+		}
+		if( !ok ){
+			remove( tmp );
+		}
+	}
+
+	delete [ ] binary;
+}
+
+
+// drop the cached binary of a program that won't be built again, such as a per K build
+void sclRemoveCached( const char* source, const char* name, sclHard hardware, int opt, const char *options ){
+
+	char opt_c[4096];
+	char cache_path[1100];
+
+	if( !sclCacheDir[0] ){
+		return;
+	}
+
+	cl_ulong key = _sclCacheKey( source, name, _sclBuildOptions( opt_c, sizeof(opt_c), opt, options ), hardware );
+	snprintf( cache_path, sizeof(cache_path), "%s/%s_%016llx.bin", sclCacheDir, name, (unsigned long long)key );
+
+	remove( cache_path );
+}
+
+/* ######################################################## */
+
+
 char* _sclLoadProgramSource( const char *filename )
 { 
 	struct stat statbuf;
@@ -422,21 +624,33 @@ cl_program _sclCreateProgram( const char* program_source, cl_context context )
 	return program;
 }
 
-void _sclBuildProgram( cl_program program, cl_device_id devices, const char* pName, int opt )
+// build options for opt and the caller's extra options, NULL if there are none
+const char* _sclBuildOptions( char *buf, size_t size, int opt, const char *options )
+{
+	if( opt && options == NULL ){
+		return NULL;
+	}
+
+	snprintf( buf, size, "%s%s", opt ? "" : "-cl-opt-disable ", options ? options : "" );
+
+	return buf;
+}
+
+void _sclBuildProgram( cl_program program, cl_device_id devices, const char* pName, int opt, const char *options )
 {
 	cl_int err;
 	char build_c[4096];
+	char opt_c[4096];
 	
 //	err = clBuildProgram( program, 0, NULL, NULL, NULL, NULL );
 	// Bryan Little
 	if(opt){
 		printf("building with optimizations\n");
-		err = clBuildProgram( program, 0, NULL, NULL, NULL, NULL );
 	}
 	else{
 		printf("building withOUT optimizations\n");
-		err = clBuildProgram( program, 0, NULL, "-cl-opt-disable", NULL, NULL );
 	}
+	err = clBuildProgram( program, 0, NULL, _sclBuildOptions( opt_c, sizeof(opt_c), opt, options ), NULL, NULL );
 
 
 	// print nvidia kernel buld log
@@ -505,6 +719,24 @@ cl_event sclEnqueueKernelEvent( sclHard hardware, sclSoft software) {
 }
 
 
+// enqueue after the events in waitList, returns an event for the kernel
+cl_event sclEnqueueKernelWait( sclHard hardware, sclSoft software, cl_uint numWait, const cl_event *waitList ) {
+
+	cl_event myEvent;
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel( hardware.queue, software.kernel, 3, NULL, software.global_size, software.local_size, numWait, waitList, &myEvent );
+	if ( err != CL_SUCCESS ) {
+		printf( "\nError on EnqueueKernel %s", software.kernelName );
+		fprintf(stderr, "\nError on EnqueueKernel %s", software.kernelName );
+		sclPrintErrorFlags(err); 
+	}
+
+	return myEvent;
+		
+}
+
+
 double ProfilesclEnqueueKernel( sclHard hardware, sclSoft software) {
 	cl_event myEvent;	
 	cl_int err;
@@ -600,19 +832,53 @@ unsigned long int _sclGetMaxGlobalMemSize( cl_device_id device ){
 // Bryan Little added opt flag to turn on/off optimizations during kernel compile
 sclSoft sclGetCLSoftware( const char* source, const char* name, sclHard hardware, int opt ){
 
+	return sclGetCLSoftwareOpts( source, name, hardware, opt, NULL );
+}
+
+
+// with extra build options, for example -D definitions
+sclSoft sclGetCLSoftwareOpts( const char* source, const char* name, sclHard hardware, int opt, const char *options ){
+
 	sclSoft software;
+	char opt_c[4096];
+	const char *build_opt = _sclBuildOptions( opt_c, sizeof(opt_c), opt, options );
 
 	sprintf( software.kernelName, "%s", name);
-	
-	/* Create program objects from source
+
+	/* Load a cached binary built for the same source, options and driver
 	 ########################################################### */
-	software.program = _sclCreateProgram( source, hardware.context );
+	char cache_path[1100];
+	cl_ulong key = 0;
+
+	software.program = NULL;
+
+	if( sclCacheDir[0] ){
+		key = _sclCacheKey( source, name, build_opt, hardware );
+		snprintf( cache_path, sizeof(cache_path), "%s/%s_%016llx.bin", sclCacheDir, name, (unsigned long long)key );
+
+		software.program = _sclLoadCachedProgram( cache_path, key, hardware, build_opt );
+		if( software.program != NULL ){
+			printf( "loaded %s from cache\n", name );
+		}
+	}
 	/* ########################################################### */
+
+	if( software.program == NULL ){
 	
-	/* Build the program (compile it)
-   	 ############################################ */
-	// Bryan Little
-   	_sclBuildProgram( software.program, hardware.device, name, opt );
+		/* Create program objects from source
+		 ########################################################### */
+		software.program = _sclCreateProgram( source, hardware.context );
+		/* ########################################################### */
+	
+		/* Build the program (compile it)
+	   	 ############################################ */
+		// Bryan Little
+	   	_sclBuildProgram( software.program, hardware.device, name, opt, options );
+
+		if( sclCacheDir[0] ){
+			_sclSaveCachedProgram( software.program, cache_path, key );
+		}
+	}
 
 /*
 	// Query binary (PTX file) size
@@ -33,6 +33,13 @@ extern "C" {
 #include <stdlib.h>
 #include <stdarg.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
 #else
@@ -65,6 +72,8 @@ typedef struct {
 /* USER FUNCTIONS */
 
 void sclGetBinary( sclSoft software );
+void sclSetCacheDir( const char *dir );
+void sclRemoveCached( const char* source, const char* name, sclHard hardware, int opt, const char *options );
 void sclSetGlobalSize( sclSoft & software, uint64_t size );
 
 /* ####### Device memory allocation read and write  ####### */
@@ -78,6 +87,7 @@ void			sclRead( sclHard hardware, size_t size, cl_mem buffer, void *hostPointer
 /* ####### inicialization of sclSoft structs  ############## */
 // Bryan Little
 sclSoft 		sclGetCLSoftware( const char* source, const char* name, sclHard hardware, int opt );
+sclSoft 		sclGetCLSoftwareOpts( const char* source, const char* name, sclHard hardware, int opt, const char *options );
 
 /* ######################################################## */
 
@@ -98,6 +108,7 @@ void 			sclPrintErrorFlags( cl_int flag );
 /* ####### Device execution ############################### */
 void			sclEnqueueKernel( sclHard hardware, sclSoft software );
 cl_event		sclEnqueueKernelEvent( sclHard hardware, sclSoft software );
+cl_event		sclEnqueueKernelWait( sclHard hardware, sclSoft software, cl_uint numWait, const cl_event *waitList );
 double			ProfilesclEnqueueKernel( sclHard hardware, sclSoft software );
 
 /* ######################################################## */
@@ -121,10 +132,21 @@ void 			sclSetKernelArg( sclSoft software, int argnum, size_t typeSize, void *ar
 /* INTERNAL FUNCITONS */
 
 /* ####### cl software management ######################### */
-void 			_sclBuildProgram( cl_program program, cl_device_id devices, const char* pName, int opt );
+const char*		_sclBuildOptions( char *buf, size_t size, int opt, const char *options );
+void 			_sclBuildProgram( cl_program program, cl_device_id devices, const char* pName, int opt, const char *options );
 cl_kernel 		_sclCreateKernel( sclSoft software );
 cl_program 		_sclCreateProgram( const char* program_source, cl_context context );
 char* 			_sclLoadProgramSource( const char *filename );
+unsigned char*		_sclProgramBinary( cl_program program, size_t *size );
+
+/* ######################################################## */
+
+/* ####### program binary cache ########################### */
+
+cl_ulong		_sclHash( cl_ulong h, const void *data, size_t len );
+cl_ulong		_sclCacheKey( const char *source, const char *name, const char *options, sclHard hardware );
+cl_program		_sclLoadCachedProgram( const char *path, cl_ulong key, sclHard hardware, const char *options );
+void			_sclSaveCachedProgram( cl_program program, const char *path, cl_ulong key );
 
 /* ######################################################## */
 